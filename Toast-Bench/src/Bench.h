@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Toast {
+
+	// Micro-benchmarks register themselves with TOAST_BENCHMARK and are run by name from the command line
+	class Benchmarks
+	{
+	public:
+		struct Entry
+		{
+			std::string Name;
+			std::function<void()> Function;
+		};
+	public:
+		static int Register(const std::string& name, std::function<void()> function)
+		{
+			GetEntries().push_back({ name, function });
+			return 0;
+		}
+
+		static std::vector<Entry>& GetEntries()
+		{
+			static std::vector<Entry> entries;
+			return entries;
+		}
+
+		// --name value pairs from the command line, for benchmarks that take inputs
+		static std::unordered_map<std::string, std::string>& GetOptions()
+		{
+			static std::unordered_map<std::string, std::string> options;
+			return options;
+		}
+
+		static std::string GetOption(const std::string& name, const std::string& defaultValue = "")
+		{
+			auto it = GetOptions().find(name);
+			return it != GetOptions().end() ? it->second : defaultValue;
+		}
+
+		// Every operator new in the process since it started, counted in BenchAllocations.cpp
+		static std::atomic<uint64_t>& GetAllocationCount();
+		static std::atomic<uint64_t>& GetAllocatedBytes();
+		// Peak private bytes of the process
+		static uint64_t GetPeakMemory();
+
+		// Best of repeats runs, in nanoseconds per call of function
+		template<typename F>
+		static double Measure(F&& function, uint32_t iterations, uint32_t repeats = 5)
+		{
+			double best = DBL_MAX;
+			for (uint32_t r = 0; r < repeats; r++)
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				for (uint32_t i = 0; i < iterations; i++)
+					function();
+				auto end = std::chrono::high_resolution_clock::now();
+
+				double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)iterations;
+				best = (std::min)(best, ns);
+			}
+
+			return best;
+		}
+	};
+
+}
+
+#define TOAST_BENCHMARK_CONCAT_IMPL(a, b) a##b
+#define TOAST_BENCHMARK_CONCAT(a, b) TOAST_BENCHMARK_CONCAT_IMPL(a, b)
+
+#define TOAST_BENCHMARK(name) \
+	static void TOAST_BENCHMARK_CONCAT(Benchmark_, __LINE__)(); \
+	static int TOAST_BENCHMARK_CONCAT(BenchmarkRegistration_, __LINE__) = ::Toast::Benchmarks::Register(name, &TOAST_BENCHMARK_CONCAT(Benchmark_, __LINE__)); \
+	static void TOAST_BENCHMARK_CONCAT(Benchmark_, __LINE__)()
@@ -0,0 +1,48 @@
+#include <Toast.h>
+
+#include "Bench.h"
+
+#include <windows.h>
+#include <psapi.h>
+
+#include <cstdlib>
+#include <new>
+
+namespace Toast {
+
+	static std::atomic<uint64_t> sAllocationCount{ 0 };
+	static std::atomic<uint64_t> sAllocatedBytes{ 0 };
+
+	std::atomic<uint64_t>& Benchmarks::GetAllocationCount() { return sAllocationCount; }
+	std::atomic<uint64_t>& Benchmarks::GetAllocatedBytes() { return sAllocatedBytes; }
+
+	uint64_t Benchmarks::GetPeakMemory()
+	{
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return 0;
+
+		return (uint64_t)counters.PeakPagefileUsage;
+	}
+
+	static void* CountedAllocate(size_t size)
+	{
+		sAllocationCount.fetch_add(1, std::memory_order_relaxed);
+		sAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+
+		void* memory = std::malloc(size ? size : 1);
+		if (!memory)
+			throw std::bad_alloc();
+
+		return memory;
+	}
+
+}
+
+// The whole bench executable, Toast included, allocates through these
+void* operator new(size_t size) { return Toast::CountedAllocate(size); }
+void* operator new[](size_t size) { return Toast::CountedAllocate(size); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
@@ -0,0 +1,39 @@
+#include <Toast.h>
+
+#include "Bench.h"
+
+// Toast-Bench [filter] [--option value ...], runs every benchmark whose name contains filter
+int main(int argc, char** argv)
+{
+	Toast::Log::Init();
+
+	std::string filter;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg.rfind("--", 0) == 0 && i + 1 < argc)
+			Toast::Benchmarks::GetOptions()[arg.substr(2)] = argv[++i];
+		else
+			filter = arg;
+	}
+
+	int ran = 0;
+	for (auto& entry : Toast::Benchmarks::GetEntries())
+	{
+		if (!filter.empty() && entry.Name.find(filter) == std::string::npos)
+			continue;
+
+		printf("== %s ==\n", entry.Name.c_str());
+		entry.Function();
+		printf("\n");
+
+		ran++;
+	}
+
+	if (ran == 0)
+		printf("No benchmark matches \"%s\"\n", filter.c_str());
+
+	Toast::Log::Shutdown();
+
+	return 0;
+}
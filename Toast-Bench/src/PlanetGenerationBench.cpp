@@ -0,0 +1,263 @@
+#include <Toast.h>
+
+#include "Toast/Physics/PhysicsEngine.h"
+#include "Toast/Renderer/PlanetSystem.h"
+
+#include "Bench.h"
+
+#include <fstream>
+
+// Mars as it's set up in the scenes
+#define BENCH_PLANET_RADIUS 3389500.0
+#define BENCH_PLANET_MIN_ALTITUDE -8200.0
+#define BENCH_PLANET_MAX_ALTITUDE 21200.0
+
+#define BENCH_CAMERA_FOV 45.0f
+#define BENCH_VIEWPORT_WIDTH 1920.0f
+#define BENCH_VIEWPORT_HEIGHT 1080.0f
+
+namespace Toast {
+
+	struct BenchCamera
+	{
+		Vector3 Position;
+		Vector3 Target;
+	};
+
+	// Scripted camera, t goes from 0 to 1 over the path
+	struct BenchCameraPath
+	{
+		const char* Name;
+		std::function<BenchCamera(double t)> Evaluate;
+	};
+
+	struct BenchFrame
+	{
+		double Milliseconds;
+		uint32_t Triangles;
+		uint32_t Vertices;
+		uint32_t PatchesRebuilt;
+		uint64_t Allocations;
+		uint64_t AllocatedBytes;
+	};
+
+	// Same synthetic terrain as the kernel benchmark, with the altitude range of the planet
+	static TerrainData CreateBenchPlanetTerrain()
+	{
+		TerrainData terrainData;
+		terrainData.Width = 4096;
+		terrainData.Height = 2048;
+		terrainData.RowPitch = terrainData.Width * sizeof(uint16_t);
+		terrainData.HeightScale = (BENCH_PLANET_MAX_ALTITUDE - BENCH_PLANET_MIN_ALTITUDE) / MAX_INT_VALUE;
+		terrainData.HeightOffset = BENCH_PLANET_MIN_ALTITUDE;
+
+		terrainData.HeightData.resize(terrainData.Width * terrainData.Height);
+		for (size_t y = 0; y < terrainData.Height; y++)
+		{
+			for (size_t x = 0; x < terrainData.Width; x++)
+				terrainData.HeightData[y * terrainData.Width + x] = (uint16_t)((x * 7 + y * 13 + ((x * y) >> 5)) & 0xFFFF);
+		}
+
+		return terrainData;
+	}
+
+	static std::vector<BenchCameraPath> CreateBenchCameraPaths()
+	{
+		const double radius = BENCH_PLANET_RADIUS;
+
+		return {
+			// Full circle around the equator 2000 km up, looking at the center
+			{ "orbit", [radius](double t)
+			{
+				double angle = t * 2.0 * M_PI;
+				double distance = radius + 2000000.0;
+				return BenchCamera{ Vector3(cos(angle) * distance, 0.0, sin(angle) * distance), Vector3(0.0, 0.0, 0.0) };
+			} },
+			// From 3000 km down to 500 m above the reference radius, altitude falls exponentially so the low part gets most frames
+			{ "descent", [radius](double t)
+			{
+				double altitude = 3000000.0 * pow(500.0 / 3000000.0, t);
+				Vector3 direction = Vector3::Normalize(Vector3(0.3, 0.2, 1.0));
+				Vector3 tangent = Vector3::Normalize(Vector3::Cross(direction, Vector3(0.0, 1.0, 0.0)));
+				Vector3 position = direction * (radius + altitude);
+				return BenchCamera{ position, position - direction * altitude + tangent * altitude * 0.5 };
+			} },
+			// 400 km along the equator just above the highest terrain, looking ahead at the horizon
+			{ "skim", [radius](double t)
+			{
+				double distance = radius + BENCH_PLANET_MAX_ALTITUDE + 1000.0;
+				double angle = t * 400000.0 / radius;
+				Vector3 position(cos(angle) * distance, 0.0, sin(angle) * distance);
+				Vector3 forward(-sin(angle), 0.0, cos(angle));
+				return BenchCamera{ position, position + forward * 10000.0 - Vector3::Normalize(position) * 500.0 };
+			} }
+		};
+	}
+
+	static void UpdateBenchFrustum(Ref<Frustum>& frustum, const BenchCamera& camera, Matrix& planetTransform)
+	{
+		DirectX::XMVECTOR eye = DirectX::XMVectorSet((float)camera.Position.x, (float)camera.Position.y, (float)camera.Position.z, 1.0f);
+		DirectX::XMVECTOR target = DirectX::XMVectorSet((float)camera.Target.x, (float)camera.Target.y, (float)camera.Target.z, 1.0f);
+		DirectX::XMMATRIX view = DirectX::XMMatrixLookAtLH(eye, target, DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+
+		Matrix cameraTransform = { DirectX::XMMatrixInverse(nullptr, view) };
+
+		frustum->Invalidate(BENCH_VIEWPORT_WIDTH / BENCH_VIEWPORT_HEIGHT, BENCH_CAMERA_FOV, 1.0f, 100000000.0f);
+		frustum->Update(cameraTransform, planetTransform);
+	}
+
+	static std::string EscapeJson(const std::string& text)
+	{
+		std::string escaped;
+		for (char c : text)
+		{
+			if (c == '\\' || c == '"')
+				escaped += '\\';
+			escaped += c;
+		}
+
+		return escaped;
+	}
+
+	static double GetPercentile(std::vector<double> values, double percentile)
+	{
+		if (values.empty())
+			return 0.0;
+
+		std::sort(values.begin(), values.end());
+		return values[(std::min)((size_t)(percentile * (double)values.size()), values.size() - 1)];
+	}
+
+	// Toast-Bench PlanetGeneration [--heightmap path] [--frames n] [--json path] [--analytic-normals 0|1]
+	// Replays the camera paths through the planet generation without a window or GPU and writes the frames as JSON
+	TOAST_BENCHMARK("PlanetGeneration")
+	{
+		std::string heightmapPath = Benchmarks::GetOption("heightmap");
+		uint32_t frameCount = (uint32_t)(std::max)(std::stoi(Benchmarks::GetOption("frames", "120")), 2);
+		std::string jsonPath = Benchmarks::GetOption("json", "PlanetGenerationBench.json");
+
+		PlanetComponent planet;
+		planet.Subdivisions = 7;
+		planet.PlanetData.radius = (float)BENCH_PLANET_RADIUS;
+		planet.PlanetData.minAltitude = (float)BENCH_PLANET_MIN_ALTITUDE;
+		planet.PlanetData.maxAltitude = (float)BENCH_PLANET_MAX_ALTITUDE;
+		planet.PlanetData.smoothShading = true;
+		planet.AnalyticNormals = Benchmarks::GetOption("analytic-normals", "0") != "0";
+
+		if (heightmapPath.empty())
+			planet.TerrainData = CreateBenchPlanetTerrain();
+		else
+			planet.TerrainData = PhysicsEngine::LoadTerrainData(heightmapPath.c_str(), BENCH_PLANET_MAX_ALTITUDE, BENCH_PLANET_MIN_ALTITUDE);
+
+		auto baseStart = std::chrono::high_resolution_clock::now();
+		PlanetSystem::CalculateBasePlanet(planet, BENCH_PLANET_RADIUS, heightmapPath);
+		double baseMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - baseStart).count();
+
+		PlanetSystem::GenerateDistanceLUT(planet, BENCH_CAMERA_FOV, BENCH_VIEWPORT_HEIGHT);
+		PlanetSystem::GenerateFaceDotLevelLUT(planet, planet.PlanetData.radius, planet.PlanetData.maxAltitude);
+		PlanetSystem::GenerateHeightMultLUT(planet.HeightMultLUT, planet.PlanetData.radius, planet.PlanetData.maxAltitude);
+
+		Ref<Frustum> frustum = CreateRef<Frustum>();
+		DirectX::XMFLOAT3 scale = { (float)BENCH_PLANET_RADIUS, (float)BENCH_PLANET_RADIUS, (float)BENCH_PLANET_RADIUS };
+		Vector3 planetCenter(0.0, 0.0, 0.0);
+		Matrix planetTransform = Matrix::Identity();
+
+		std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash> terrainColliders;
+		std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash> terrainColliderPositions;
+
+		std::vector<PlanetVertex> vertices;
+		std::vector<uint32_t> indices;
+
+		std::ofstream json(jsonPath, std::ios::trunc);
+		json << "{\n";
+		json << "  \"heightmap\": \"" << (heightmapPath.empty() ? "synthetic" : EscapeJson(heightmapPath)) << "\",\n";
+		json << "  \"basePlanetMs\": " << baseMilliseconds << ",\n";
+		json << "  \"analyticNormals\": " << (planet.AnalyticNormals ? "true" : "false") << ",\n";
+		json << "  \"paths\": [\n";
+
+		printf("base planet:          %.2f ms\n", baseMilliseconds);
+
+		std::vector<BenchCameraPath> paths = CreateBenchCameraPaths();
+		for (size_t p = 0; p < paths.size(); p++)
+		{
+			// Every path starts from cold caches so the paths don't depend on the order they run in
+			PlanetGenerator& generator = PlanetSystem::GetGenerator(planet);
+			generator.PatchCache.Clear();
+			generator.MidpointCache.Clear();
+			planet.MeshLayout.Clear();
+			planet.LODBudgetScale = 1.0;
+
+			std::vector<BenchFrame> frames;
+			frames.reserve(frameCount);
+
+			for (uint32_t f = 0; f < frameCount; f++)
+			{
+				BenchCamera camera = paths[p].Evaluate((double)f / (double)(frameCount - 1));
+				UpdateBenchFrustum(frustum, camera, planetTransform);
+
+				DirectX::XMVECTOR cameraPos = DirectX::XMVectorSet((float)camera.Position.x, (float)camera.Position.y, (float)camera.Position.z, 1.0f);
+
+				uint64_t allocations = Benchmarks::GetAllocationCount().load();
+				uint64_t allocatedBytes = Benchmarks::GetAllocatedBytes().load();
+				auto start = std::chrono::high_resolution_clock::now();
+
+				PlanetSystem::RegeneratePlanet(frustum, scale, planetCenter, DirectX::XMMatrixIdentity(), cameraPos, true, true, planet, terrainColliders, terrainColliderPositions);
+				if (generator.GenerationFuture.valid())
+					generator.GenerationFuture.wait();
+
+				if (generator.NewPlanetReady.load())
+				{
+					PlanetSystem::ApplyBuild(planet, vertices, indices);
+					generator.NewPlanetReady.store(false);
+				}
+
+				BenchFrame frame;
+				frame.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				frame.Triangles = planet.TriangleCount;
+				frame.Vertices = planet.MeshLayout.GetVertexCount();
+				frame.PatchesRebuilt = generator.PatchCache.GetStats().PatchesRebuilt;
+				frame.Allocations = Benchmarks::GetAllocationCount().load() - allocations;
+				frame.AllocatedBytes = Benchmarks::GetAllocatedBytes().load() - allocatedBytes;
+				frames.push_back(frame);
+			}
+
+			std::vector<double> milliseconds;
+			for (auto& frame : frames)
+				milliseconds.push_back(frame.Milliseconds);
+
+			double total = 0.0;
+			for (double ms : milliseconds)
+				total += ms;
+
+			uint64_t peakMemory = Benchmarks::GetPeakMemory();
+
+			printf("%-8s mean %.2f ms, p95 %.2f ms, max %.2f ms, peak memory %.1f MB\n", paths[p].Name, total / (double)frames.size(),
+				GetPercentile(milliseconds, 0.95), GetPercentile(milliseconds, 1.0), (double)peakMemory / (1024.0 * 1024.0));
+
+			json << "    {\n";
+			json << "      \"name\": \"" << paths[p].Name << "\",\n";
+			json << "      \"meanMs\": " << total / (double)frames.size() << ",\n";
+			json << "      \"p95Ms\": " << GetPercentile(milliseconds, 0.95) << ",\n";
+			json << "      \"maxMs\": " << GetPercentile(milliseconds, 1.0) << ",\n";
+			json << "      \"peakMemoryBytes\": " << peakMemory << ",\n";
+			json << "      \"frames\": [\n";
+			for (size_t f = 0; f < frames.size(); f++)
+			{
+				const BenchFrame& frame = frames[f];
+				json << "        { \"ms\": " << frame.Milliseconds << ", \"triangles\": " << frame.Triangles << ", \"vertices\": " << frame.Vertices
+					<< ", \"patchesRebuilt\": " << frame.PatchesRebuilt << ", \"allocations\": " << frame.Allocations << ", \"allocatedBytes\": " << frame.AllocatedBytes
+					<< " }" << (f + 1 < frames.size() ? "," : "") << "\n";
+			}
+			json << "      ]\n";
+			json << "    }" << (p + 1 < paths.size() ? "," : "") << "\n";
+		}
+
+		json << "  ]\n";
+		json << "}\n";
+
+		PlanetSystem::Shutdown(planet);
+
+		printf("frames written to %s\n", jsonPath.c_str());
+	}
+
+}
@@ -0,0 +1,369 @@
+#include <Toast.h>
+
+#include "Toast/Renderer/MeshOptimizer.h"
+#include "Toast/Renderer/PlanetSystem.h"
+#include "Toast/Renderer/TerrainHeightPyramid.h"
+
+#include "Bench.h"
+
+#include <random>
+
+namespace Toast {
+
+	// Synthetic 4096x2048 height map so the benchmark doesn't depend on any assets
+	static TerrainData CreateBenchTerrain()
+	{
+		TerrainData terrainData;
+		terrainData.Width = 4096;
+		terrainData.Height = 2048;
+		terrainData.RowPitch = terrainData.Width * sizeof(uint16_t);
+		terrainData.HeightScale = 20000.0 / MAX_INT_VALUE;
+		terrainData.HeightOffset = -8000.0;
+
+		terrainData.HeightData.resize(terrainData.Width * terrainData.Height);
+		for (size_t y = 0; y < terrainData.Height; y++)
+		{
+			for (size_t x = 0; x < terrainData.Width; x++)
+				terrainData.HeightData[y * terrainData.Width + x] = (uint16_t)((x * 7 + y * 13 + ((x * y) >> 5)) & 0xFFFF);
+		}
+
+		return terrainData;
+	}
+
+	static std::vector<Vector3> CreateBenchPositions(size_t count, double radius)
+	{
+		std::mt19937 random(19871102);
+		std::normal_distribution<double> distribution;
+
+		std::vector<Vector3> positions(count);
+		for (auto& position : positions)
+			position = Vector3::Normalize(Vector3(distribution(random), distribution(random), distribution(random))) * radius;
+
+		return positions;
+	}
+
+	TOAST_BENCHMARK("PlanetVertexKernel")
+	{
+		const size_t count = 1 << 16;
+		const double radius = 3389500.0;
+
+		TerrainData terrainData = CreateBenchTerrain();
+		std::vector<Vector3> positions = CreateBenchPositions(count, radius);
+
+		std::vector<Vector3> scalarPositions(count), directions(count), batchPositions(count);
+		std::vector<Vector2> scalarUVs(count), uvs(count);
+		std::vector<double> heights(count);
+
+		// What ComputeVertex used to do for every vertex
+		auto scalar = [&]()
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				Vector3 n = Vector3::Normalize(positions[i]);
+				scalarUVs[i] = PlanetSystem::GetUVFromPosition(n, (double)terrainData.Width, (double)terrainData.Height);
+				double h = PlanetSystem::GetHeight(scalarUVs[i], terrainData);
+				scalarPositions[i] = n * (radius + h);
+			}
+		};
+
+		auto batch = [&]()
+		{
+			PlanetSystem::DisplaceVertices(positions.data(), count, directions.data(), uvs.data(), heights.data(), batchPositions.data(), terrainData, radius);
+		};
+
+		double scalarNs = Benchmarks::Measure(scalar, 10) / (double)count;
+		double batchNs = Benchmarks::Measure(batch, 10) / (double)count;
+
+		double maxUVError = 0.0, maxPositionError = 0.0;
+		for (size_t i = 0; i < count; i++)
+		{
+			maxUVError = (std::max)(maxUVError, (std::max)(std::abs(uvs[i].x - scalarUVs[i].x), std::abs(uvs[i].y - scalarUVs[i].y)));
+			maxPositionError = (std::max)(maxPositionError, (batchPositions[i] - scalarPositions[i]).Length());
+		}
+
+		printf("vertices:             %zu\n", count);
+		printf("scalar:               %.2f ns/vertex\n", scalarNs);
+		printf("batched:              %.2f ns/vertex\n", batchNs);
+		printf("speedup:              %.2fx\n", scalarNs / batchNs);
+		printf("max uv error:         %.3e texels\n", maxUVError);
+		printf("max position error:   %.3e m\n", maxPositionError);
+	}
+
+	// Round trip of the compact planet vertex, on vertices spread over a patch sized piece of the surface
+	TOAST_BENCHMARK("PlanetVertexCodec")
+	{
+		const size_t count = 1 << 16;
+		const double radius = 3389500.0;
+		const double patchSize = 30000.0;
+
+		std::mt19937 random(19871102);
+		std::uniform_real_distribution<double> offset(-0.5 * patchSize, 0.5 * patchSize);
+		std::normal_distribution<double> distribution;
+
+		Vector3 mins, maxs;
+		std::vector<Vertex> vertices(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			Vector3 position = Vector3::Normalize(Vector3(radius, offset(random), offset(random))) * (radius + offset(random));
+			Vector3 normal = Vector3::Normalize(Vector3(distribution(random), distribution(random), distribution(random)));
+			Vector2 uv = PlanetSystem::GetUVFromPosition(position, 1.0, 1.0);
+
+			vertices[i] = Vertex(position, uv, normal);
+
+			// Bounds of the float positions, like the frames of the fixed LOD patches
+			Vector3 stored = vertices[i].Position;
+			mins = i == 0 ? stored : Vector3((std::min)(mins.x, stored.x), (std::min)(mins.y, stored.y), (std::min)(mins.z, stored.z));
+			maxs = i == 0 ? stored : Vector3((std::max)(maxs.x, stored.x), (std::max)(maxs.y, stored.y), (std::max)(maxs.z, stored.z));
+		}
+
+		PlanetVertexFrame frame = PlanetVertexCodec::CreateFrame(mins, maxs);
+
+		std::vector<PlanetVertex> encoded;
+		double encodeNs = Benchmarks::Measure([&]() { PlanetVertexCodec::Encode(vertices, frame, encoded); }, 10) / (double)count;
+
+		double maxPositionError = 0.0, maxNormalError = 0.0, maxUVError = 0.0;
+		for (size_t i = 0; i < count; i++)
+		{
+			Vertex decoded = PlanetVertexCodec::Decode(encoded[i], frame);
+
+			Vector3 position = vertices[i].Position, decodedPosition = decoded.Position;
+			Vector3 normal = vertices[i].Normal, decodedNormal = decoded.Normal;
+
+			maxPositionError = (std::max)(maxPositionError, (decodedPosition - position).Length());
+			maxNormalError = (std::max)(maxNormalError, acos((std::min)(Vector3::Dot(normal, decodedNormal), 1.0)) * 180.0 / M_PI);
+			maxUVError = (std::max)(maxUVError, (double)(std::max)(std::abs(decoded.Texcoord.x - vertices[i].Texcoord.x), std::abs(decoded.Texcoord.y - vertices[i].Texcoord.y)));
+		}
+
+		printf("vertices:             %zu\n", count);
+		printf("vertex size:          %zu -> %zu bytes\n", sizeof(Vertex), sizeof(PlanetVertex));
+		printf("encode:               %.2f ns/vertex\n", encodeNs);
+		printf("max position error:   %.3e m\n", maxPositionError);
+		printf("max normal error:     %.3e degrees\n", maxNormalError);
+		printf("max uv error:         %.3e\n", maxUVError);
+	}
+
+	// Shared vertex triangle emitted depth first, the order UpdatePatch gets its smooth shaded patches in
+	static void SubdivideBenchTriangle(uint32_t a, uint32_t b, uint32_t c, int levels, std::unordered_map<uint64_t, uint32_t>& midpoints, uint32_t& vertexCount, std::vector<uint32_t>& indices)
+	{
+		if (levels == 0)
+		{
+			indices.insert(indices.end(), { a, b, c });
+			return;
+		}
+
+		auto midpoint = [&](uint32_t first, uint32_t second) {
+			uint64_t key = ((uint64_t)(std::min)(first, second) << 32) | (std::max)(first, second);
+			auto it = midpoints.find(key);
+			if (it != midpoints.end())
+				return it->second;
+
+			return midpoints[key] = vertexCount++;
+		};
+
+		uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+		SubdivideBenchTriangle(a, ab, ca, levels - 1, midpoints, vertexCount, indices);
+		SubdivideBenchTriangle(ab, b, bc, levels - 1, midpoints, vertexCount, indices);
+		SubdivideBenchTriangle(ca, bc, c, levels - 1, midpoints, vertexCount, indices);
+		SubdivideBenchTriangle(ab, bc, ca, levels - 1, midpoints, vertexCount, indices);
+	}
+
+	// Post transform cache numbers of a patch sized mesh before and after reordering, simulated on the CPU
+	TOAST_BENCHMARK("MeshOptimizer")
+	{
+		std::unordered_map<uint64_t, uint32_t> midpoints;
+		uint32_t vertexCount = 3;
+		std::vector<uint32_t> input;
+		SubdivideBenchTriangle(0, 1, 2, 7, midpoints, vertexCount, input);
+
+		std::vector<uint32_t> indices;
+		std::vector<uint32_t> remap;
+		double optimizeNs = Benchmarks::Measure([&]() {
+			indices = input;
+			MeshOptimizer::OptimizeVertexCache(indices.data(), indices.size(), vertexCount);
+			MeshOptimizer::OptimizeVertexFetch(indices.data(), indices.size(), vertexCount, remap);
+		}, 20);
+
+		printf("triangles:            %zu\n", input.size() / 3);
+		printf("vertices:             %u\n", vertexCount);
+		printf("optimize:             %.3f ms\n", optimizeNs / 1000000.0);
+
+		for (uint32_t cacheSize : { 16u, 32u })
+		{
+			VertexCacheStats before = MeshOptimizer::AnalyzeVertexCache(input.data(), input.size(), vertexCount, cacheSize);
+			VertexCacheStats after = MeshOptimizer::AnalyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize);
+			printf("cache %2u:             ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", cacheSize, before.ACMR, after.ACMR, before.ATVR, after.ATVR);
+		}
+	}
+
+	// Planet nodes against the frustum of a camera 100 km up looking at the horizon, one triangle at a time with the
+	// volume test the planet used before and all at once with the bounding spheres
+	TOAST_BENCHMARK("FrustumCulling")
+	{
+		const size_t count = (size_t)(std::max)(std::stoi(Benchmarks::GetOption("nodes", "20480")), 1);
+		const double radius = 3389500.0;
+		const double minHeight = -8000.0, maxHeight = 12000.0;
+		const double nodeAngle = 0.02;
+
+		Matrix cameraTransform = { DirectX::XMMatrixRotationRollPitchYaw(0.0f, 0.5f, 0.0f) * DirectX::XMMatrixTranslation(0.0f, 0.0f, (float)-(radius + 100000.0)) };
+		Matrix planetTransform = Matrix::Identity();
+
+		Frustum frustum;
+		frustum.Invalidate(16.0f / 9.0f, 45.0f, 0.1f, 5000000.0f);
+		frustum.Update(cameraTransform, planetTransform);
+
+		std::mt19937 random(19871102);
+		std::uniform_real_distribution<double> offset(-nodeAngle, nodeAngle);
+
+		std::vector<Vector3> corners(count * 3);
+		BoundingSphereBatch spheres;
+		std::vector<Vector3> positions = CreateBenchPositions(count, 1.0);
+		for (size_t i = 0; i < count; i++)
+		{
+			Vector3 axis = positions[i];
+			for (int k = 0; k < 3; k++)
+				corners[i * 3 + k] = Vector3::Normalize(axis + Vector3(offset(random), offset(random), offset(random)));
+
+			// Same sphere as PlanetSystem::GetNodeBoundingSphere
+			axis = Vector3::Normalize(corners[i * 3] + corners[i * 3 + 1] + corners[i * 3 + 2]);
+			double cosCorner = (std::min)(Vector3::Dot(axis, corners[i * 3]), (std::min)(Vector3::Dot(axis, corners[i * 3 + 1]), Vector3::Dot(axis, corners[i * 3 + 2])));
+			double sinCorner = sqrt((std::max)(1.0 - cosCorner * cosCorner, 0.0));
+			double bottom = (radius + minHeight) * cosCorner, top = radius + maxHeight;
+			double halfHeight = (top - bottom) * 0.5;
+			spheres.Add(axis * ((bottom + top) * 0.5), sqrt(halfHeight * halfHeight + top * sinCorner * top * sinCorner));
+
+			for (int k = 0; k < 3; k++)
+				corners[i * 3 + k] = corners[i * 3 + k] * radius;
+		}
+
+		std::vector<uint8_t> triangleVisible(count), sphereVisible;
+		double heightRange = maxHeight / radius;
+
+		auto triangles = [&]()
+		{
+			for (size_t i = 0; i < count; i++)
+				triangleVisible[i] = frustum.ContainsTriangleVolume(corners[i * 3], corners[i * 3 + 1], corners[i * 3 + 2], heightRange) != VolumeTri::OUTSIDE;
+		};
+
+		auto batch = [&]()
+		{
+			frustum.CullSpheres(spheres, sphereVisible, true);
+		};
+
+		double triangleNs = Benchmarks::Measure(triangles, 20) / (double)count;
+		double batchNs = Benchmarks::Measure(batch, 20) / (double)count;
+
+		size_t visibleTriangles = 0, visibleSpheres = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			visibleTriangles += triangleVisible[i];
+			visibleSpheres += sphereVisible[i];
+		}
+
+		printf("nodes:                %zu\n", count);
+		printf("per triangle:         %.2f ns/node, %zu visible\n", triangleNs, visibleTriangles);
+		printf("sphere batch:         %.2f ns/node, %zu visible\n", batchNs, visibleSpheres);
+		printf("speedup:              %.2fx\n", triangleNs / batchNs);
+	}
+
+	TOAST_BENCHMARK("TerrainRaycast")
+	{
+		const size_t count = (size_t)(std::max)(std::stoi(Benchmarks::GetOption("rays", "256")), 1);
+		const double radius = 3389500.0;
+		const double altitude = 20000.0;
+		// Brute force reference step along the ray, in meters
+		const double referenceStep = 2.0;
+
+		PlanetComponent planet;
+		planet.PlanetData.radius = (float)radius;
+		planet.TerrainData = CreateBenchTerrain();
+		planet.TerrainData.HeightRanges = TerrainHeightPyramid::Build(planet.TerrainData);
+
+		std::mt19937 random(19871102);
+		std::uniform_real_distribution<double> tilt(-0.7, 0.7);
+
+		// Straight down and tilted up to 35 degrees from it
+		std::vector<Vector3> origins = CreateBenchPositions(count, radius + altitude);
+		std::vector<Vector3> directions(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			Vector3 down = Vector3::Normalize(-origins[i]);
+			directions[i] = i % 2 == 0 ? down : Vector3::Normalize(down + Vector3(tilt(random), tilt(random), tilt(random)) * 0.5);
+		}
+
+		auto getSurfaceDistance = [&](const Vector3& position) {
+			double r = position.Length();
+			Vector2 uv = PlanetSystem::GetUVFromPosition(position, (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
+			return r - (radius + PlanetSystem::GetHeight(uv, planet.TerrainData));
+		};
+
+		std::vector<TerrainRaycastHit> hits(count);
+		std::vector<uint8_t> hitFound(count);
+
+		auto pyramid = [&]()
+		{
+			for (size_t i = 0; i < count; i++)
+				hitFound[i] = PlanetSystem::RaycastTerrain(planet, nullptr, origins[i], directions[i], 2.0 * altitude, hits[i]);
+		};
+
+		double pyramidNs = Benchmarks::Measure(pyramid, 5) / (double)count;
+
+		// Fixed steps from the top of the terrain, then bisection between the last two samples
+		std::vector<double> referenceDistances(count, -1.0);
+		auto reference = [&]()
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				double previous = 0.0;
+				for (double t = 0.0; t <= 2.0 * altitude; t += referenceStep)
+				{
+					if (getSurfaceDistance(origins[i] + directions[i] * t) > 0.0)
+					{
+						previous = t;
+						continue;
+					}
+
+					double above = previous, below = t;
+					for (int j = 0; j < 32; j++)
+					{
+						double middle = (above + below) * 0.5;
+						if (getSurfaceDistance(origins[i] + directions[i] * middle) > 0.0)
+							above = middle;
+						else
+							below = middle;
+					}
+
+					referenceDistances[i] = below;
+					break;
+				}
+			}
+		};
+
+		double referenceNs = Benchmarks::Measure(reference, 1) / (double)count;
+
+		size_t found = 0, mismatches = 0;
+		double maxError = 0.0;
+		for (size_t i = 0; i < count; i++)
+		{
+			found += hitFound[i];
+			if (!hitFound[i] || referenceDistances[i] < 0.0)
+			{
+				mismatches += hitFound[i] != (referenceDistances[i] >= 0.0);
+				continue;
+			}
+
+			// The reference steps over spikes thinner than its step, a different hit further along is counted as a mismatch
+			double error = std::abs(hits[i].Distance - referenceDistances[i]);
+			if (error > referenceStep)
+				mismatches++;
+			else
+				maxError = (std::max)(maxError, error);
+		}
+
+		printf("rays:                 %zu, %zu hits\n", count, found);
+		printf("height pyramid:       %.2f us/ray\n", pyramidNs / 1000.0);
+		printf("fixed steps:          %.2f us/ray\n", referenceNs / 1000.0);
+		printf("speedup:              %.2fx\n", referenceNs / pyramidNs);
+		printf("max distance error:   %.6f m, %zu mismatches\n", maxError, mismatches);
+	}
+
+}
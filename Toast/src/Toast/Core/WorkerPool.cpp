@@ -0,0 +1,84 @@
+#include "tpch.h"
+#include "WorkerPool.h"
+
+namespace Toast {
+
+	WorkerPool::WorkerPool(uint32_t threadCount)
+	{
+		mThreads.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; i++)
+			mThreads.emplace_back(&WorkerPool::WorkerLoop, this);
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStopping = true;
+		}
+		mWake.notify_all();
+
+		for (auto& thread : mThreads)
+			thread.join();
+	}
+
+	void WorkerPool::Run(const std::function<void()>& job, uint32_t helperCount)
+	{
+		Batch batch;
+		batch.Job = &job;
+
+		helperCount = (std::min)(helperCount, GetThreadCount());
+		if (helperCount > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				for (uint32_t i = 0; i < helperCount; i++)
+					mQueue.push_back(&batch);
+			}
+			if (helperCount == 1)
+				mWake.notify_one();
+			else
+				mWake.notify_all();
+		}
+
+		job();
+
+		if (helperCount == 0)
+			return;
+
+		// Drop the copies no pool thread picked up and wait for the ones that are running
+		std::unique_lock<std::mutex> lock(mMutex);
+		mQueue.erase(std::remove(mQueue.begin(), mQueue.end(), &batch), mQueue.end());
+		batch.Done.wait(lock, [&batch]() { return batch.Running == 0; });
+	}
+
+	void WorkerPool::WorkerLoop()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (true)
+		{
+			mWake.wait(lock, [this]() { return mStopping || !mQueue.empty(); });
+			if (mStopping)
+				return;
+
+			Batch* batch = mQueue.front();
+			mQueue.pop_front();
+			batch->Running++;
+
+			lock.unlock();
+			(*batch->Job)();
+			lock.lock();
+
+			if (--batch->Running == 0)
+				batch->Done.notify_all();
+		}
+	}
+
+	WorkerPool& WorkerPool::Get()
+	{
+		// The calling thread always takes part, so one hardware thread is left for it
+		static WorkerPool sPool((std::max)(std::thread::hardware_concurrency(), 2u) - 1);
+		return sPool;
+	}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Toast/Core/Base.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Toast {
+
+	// Long-lived threads shared by the planet builds, the prefetch and the physics step
+	class WorkerPool
+	{
+	public:
+		WorkerPool(uint32_t threadCount);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		// Runs job on the calling thread and on up to helperCount pool threads, returns once every copy has returned.
+		// The job is expected to pull its work from a shared counter, copies that haven't started when the calling thread
+		// is done are dropped so a busy pool never holds up the caller.
+		void Run(const std::function<void()>& job, uint32_t helperCount);
+
+		uint32_t GetThreadCount() const { return (uint32_t)mThreads.size(); }
+
+		static WorkerPool& Get();
+	private:
+		struct Batch
+		{
+			const std::function<void()>* Job = nullptr;
+			uint32_t Running = 0;
+			std::condition_variable Done;
+		};
+
+		void WorkerLoop();
+	private:
+		std::vector<std::thread> mThreads;
+		std::deque<Batch*> mQueue;
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		bool mStopping = false;
+	};
+
+}
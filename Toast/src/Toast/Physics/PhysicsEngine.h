@@ -4,11 +4,14 @@
 
 #include "Toast/Renderer/RendererDebug.h"
 #include "Toast/Renderer/PlanetSystem.h"
+#include "Toast/Renderer/TerrainHeightPyramid.h"
+#include "Toast/Core/WorkerPool.h"
 
 #include <../vendor/directxtex/include/DirectXTex.h>
 
 #define NOMINMAX
 #include <algorithm>
+#include <atomic>
 
 #include <DirectXMath.h>
 
@@ -16,6 +19,9 @@
 #define M_PI			3.14159265358979323846
 #define M_PIDIV2		(3.14159265358979323846 / 2.0)
 
+// Below this many bodies Update steps them on the calling thread, the workers would cost more than they save
+#define PHYSICS_MIN_PARALLEL_BODIES 32
+
 namespace Toast {
 
 	namespace PhysicsEngine 
@@ -30,10 +36,35 @@ namespace Toast {
 			ContactPoint(const Vector3& ptOnPlanet, const Vector3& ptOnObject) : PtOnPlanetWorldSpace(ptOnPlanet), PtOnObjectWorldSpace(ptOnObject) {}
 		};
 
+		// Components of a planet, resolved once per Update
+		struct PhysicsPlanet
+		{
+			PlanetComponent* Planet = nullptr;
+			TransformComponent* Transform = nullptr;
+			const TerrainDetailComponent* TerrainDetail = nullptr;
+		};
+
+		// A body Update steps, gathered once per frame. Bodies are stepped through these pointers only, looking a component
+		// up on a worker could create its entt pool while other threads read the registry
+		struct PhysicsBody
+		{
+			TransformComponent* Transform = nullptr;
+			RigidBodyComponent* RigidBody = nullptr;
+			SphereColliderComponent* SphereCollider = nullptr;
+			BoxColliderComponent* BoxCollider = nullptr;
+			// Collided with, the sphere's when the body has both colliders
+			Ref<Shape> Collider;
+			bool ReqAltitude = false;
+			// Altitude is only measured against this planet, nullptr when the body collides with every planet
+			const PhysicsPlanet* NearestPlanet = nullptr;
+			bool IsCamera = false;
+			// Planets that are bodies themselves move what the others read, they're stepped on their own in view order
+			bool IsPlanet = false;
+		};
+
 		struct TerrainCollision
 		{
-			Entity* Planet;
-			Entity* Object;
+			PhysicsBody* Object;
 			
 			Vector3 Normal;
 			double Depth;
@@ -125,24 +156,23 @@ namespace Toast {
 			return true;
 		}
 
-		// Recursively ray cast through the node hierarchy
-		static bool RaycastPlanetNode(const Ray& ray, Ref<PlanetNode>& node, Vector3& worldTranslation, bool isCamera, double& closestT, Vector3& hitPoint) {
-			// Broad phase: check bounding box intersection
-			Bounds nodeBounds = node->NodeBounds;
-			if (isCamera)
-				nodeBounds += worldTranslation;
+		// Recursively ray cast through the node hierarchy, the ray is in planet space
+		static bool RaycastPlanetNode(const Ray& ray, const PlanetNodeView& view, const PlanetNodePool& nodes, uint32_t nodeIndex, double& closestT, Vector3& hitPoint) {
+			const PlanetNodePool& pool = view.Resolve(nodes, nodeIndex);
+			const PlanetNode* node = &pool[nodeIndex];
 
-			if (!RayIntersectsBounds(ray, nodeBounds))
+			// Broad phase: check bounding box intersection
+			if (!RayIntersectsBounds(ray, node->NodeBounds))
 				return false;
 
 			bool hitFound = false;
 
-			if (!node->ChildNodes.empty()) {
+			if (!node->IsLeaf()) {
 				// Not a leaf, go deeper
-				for (auto& child : node->ChildNodes) {
+				for (uint32_t child = node->FirstChild; child < node->FirstChild + node->ChildCount; child++) {
 					double tChild;
 					Vector3 hpChild;
-					if (RaycastPlanetNode(ray, child, worldTranslation, isCamera, tChild, hpChild)) {
+					if (RaycastPlanetNode(ray, view, pool, child, tChild, hpChild)) {
 						if (!hitFound || tChild < closestT) {
 							hitFound = true;
 							closestT = tChild;
@@ -153,18 +183,8 @@ namespace Toast {
 			}
 			else {
 				// Leaf node: test ray against node's triangle
-				Vector3 Apos = node->A.Position;
-				Vector3 Bpos = node->B.Position;
-				Vector3 Cpos = node->C.Position;
-
-				if (isCamera) {
-					Apos += worldTranslation;
-					Bpos += worldTranslation;
-					Cpos += worldTranslation;
-				}
-
 				double t;
-				if (RayIntersectsTriangle(ray.Origin, ray.Direction, Apos, Bpos, Cpos, t)) {
+				if (RayIntersectsTriangle(ray.Origin, ray.Direction, node->A.Position, node->B.Position, node->C.Position, t)) {
 					Vector3 currentHit = ray.Origin + ray.Direction * t;
 					if (!hitFound || t < closestT) {
 						hitFound = true;
@@ -325,13 +345,12 @@ namespace Toast {
 
 			bool collisionDetected = false;
 
-			auto& planetPos = collision.Planet->GetComponent<TransformComponent>().Translation;
 			std::vector<Vector3> axes, objectColliderPts, terrainPts;
-			auto& rotEuler = collision.Object->GetComponent<TransformComponent>().RotationEulerAngles;
-			auto& rotQuat = collision.Object->GetComponent<TransformComponent>().RotationQuaternion;
-			auto& scale = collision.Object->GetComponent<BoxColliderComponent>().Collider->mSize;
-			auto& objectPos = collision.Object->GetComponent<TransformComponent>().Translation;
-			std::vector<Vertex> objectColliderVertices = collision.Object->GetComponent<BoxColliderComponent>().ColliderMesh->GetVertices();
+			auto& rotEuler = collision.Object->Transform->RotationEulerAngles;
+			auto& rotQuat = collision.Object->Transform->RotationQuaternion;
+			auto& scale = collision.Object->BoxCollider->Collider->mSize;
+			auto& objectPos = collision.Object->Transform->Translation;
+			std::vector<Vertex> objectColliderVertices = collision.Object->BoxCollider->ColliderMesh->GetVertices();
 
 			Matrix objTransform = DirectX::XMMatrixIdentity() * DirectX::XMMatrixScaling(scale.x, scale.y, scale.z)
 				* (DirectX::XMMatrixRotationQuaternion(DirectX::XMQuaternionRotationRollPitchYaw(DirectX::XMConvertToRadians(rotEuler.x), DirectX::XMConvertToRadians(rotEuler.y), DirectX::XMConvertToRadians(rotEuler.z)))) * DirectX::XMMatrixRotationQuaternion(DirectX::XMLoadFloat4(&rotQuat))
@@ -343,7 +362,7 @@ namespace Toast {
 				objectColliderPts.at(objectColliderPts.size() - 1) = objTransform * objectColliderPts.at(objectColliderPts.size() - 1);
 			}
 
-			Matrix colliderRot = { DirectX::XMMatrixIdentity() * (DirectX::XMMatrixRotationQuaternion(DirectX::XMQuaternionRotationRollPitchYaw(DirectX::XMConvertToRadians(rotEuler.x), DirectX::XMConvertToRadians(rotEuler.y), DirectX::XMConvertToRadians(rotEuler.z)))) * DirectX::XMMatrixRotationQuaternion(DirectX::XMLoadFloat4(&collision.Object->GetComponent<TransformComponent>().RotationQuaternion)) };
+			Matrix colliderRot = { DirectX::XMMatrixIdentity() * (DirectX::XMMatrixRotationQuaternion(DirectX::XMQuaternionRotationRollPitchYaw(DirectX::XMConvertToRadians(rotEuler.x), DirectX::XMConvertToRadians(rotEuler.y), DirectX::XMConvertToRadians(rotEuler.z)))) * DirectX::XMMatrixRotationQuaternion(DirectX::XMLoadFloat4(&rotQuat)) };
 
 			Vector3 obbAxes[3] = {
 				colliderRot * Vector3(1.0, 0.0, 0.0),  // Local X-axis
@@ -512,6 +531,31 @@ namespace Toast {
 		
 		static TerrainData LoadTerrainData(const char* path, const double maxAltitude, const double minAltitude)
 		{
+			// The tiled version of the height map is memory mapped, only the tiles the planet LOD touches are read
+			Ref<TiledHeightmap> tiles = TiledHeightmap::Open(path);
+			if (tiles)
+			{
+				TerrainData terrainData;
+				terrainData.Tiles = tiles;
+				terrainData.PhysicsTiles = tiles->MapAgain();
+				terrainData.Width = tiles->GetWidth();
+				terrainData.Height = tiles->GetHeight();
+				terrainData.RowPitch = terrainData.Width * sizeof(uint16_t);
+				terrainData.HeightScale = (maxAltitude - minAltitude) / MAX_INT_VALUE;
+				terrainData.HeightOffset = minAltitude;
+
+				// Without a mapping of its own the physics keeps ray casting the planet nodes
+				if (terrainData.PhysicsTiles)
+				{
+					terrainData.PhysicsTiles->SetCapacity(TILED_HEIGHTMAP_PHYSICS_CAPACITY);
+					terrainData.HeightRanges = TerrainHeightPyramid::Build(terrainData);
+				}
+
+				return terrainData;
+			}
+
+			TOAST_CORE_WARN("Unable to use a tiled height map for %s, decoding all of it", path);
+
 			HRESULT result;
 
 			std::wstring w;
@@ -529,59 +573,26 @@ namespace Toast {
 
 			const uint16_t* rawTerrainData = reinterpret_cast<const uint16_t*>(heightMap->GetPixels());
 
-			size_t totalPixels = heightMapMetadata.width * heightMapMetadata.height;
 			TerrainData terrainDataUpdated;
-			terrainDataUpdated.HeightData.reserve(totalPixels);
+			terrainDataUpdated.RowPitch = heightMap->GetImage(0, 0, 0)->rowPitch;
 
-			for (size_t i = 0; i < totalPixels; ++i) 
-				terrainDataUpdated.HeightData.emplace_back(((static_cast<double>(rawTerrainData[i]) / MAX_INT_VALUE) * (maxAltitude - minAltitude)) + minAltitude);
+			// The texels are kept as they are, the altitude range is applied when sampling
+			size_t totalTexels = (terrainDataUpdated.RowPitch / 2) * heightMapMetadata.height;
+			terrainDataUpdated.HeightData.assign(rawTerrainData, rawTerrainData + totalTexels);
+			terrainDataUpdated.HeightScale = (maxAltitude - minAltitude) / MAX_INT_VALUE;
+			terrainDataUpdated.HeightOffset = minAltitude;
 
-			terrainDataUpdated.RowPitch = heightMap->GetImage(0, 0, 0)->rowPitch;
 			terrainDataUpdated.Width = heightMapMetadata.width;
 			terrainDataUpdated.Height = heightMapMetadata.height;
+			terrainDataUpdated.HeightRanges = TerrainHeightPyramid::Build(terrainDataUpdated);
 
 			return terrainDataUpdated;
 		}
 
-		static double GetObjectDistanceToPlanet(Entity* planet, Vector3& worldSpaceObjectPos, Vector3& triangleNormal, Vector3& A, Vector3& B, Vector3& C)
-		{	
-			PlanetComponent& pc = planet->GetComponent<PlanetComponent>();
-			Vector3 worldSpacePlanetPos = planet->GetComponent<TransformComponent>().Translation;
-
-			std::vector<uint32_t> indices = pc.RenderMesh->GetIndices();
-			std::vector<Vertex> vertices = pc.RenderMesh->GetVertices();
-
-			double distance;
-
-			if (indices.size() > 0)
-			{
-				for (int i = 0; i < indices.size() - 2; i += 3)
-				{
-					distance = Math::PointToPlaneDistance(worldSpaceObjectPos, worldSpacePlanetPos, vertices[indices[i]].Position, vertices[indices[i + 1]].Position, vertices[indices[i + 2]].Position);
-
-					if (distance != -100.0f) 
-					{
-						Vector3 v1(vertices[indices[i + 1]].Position);
-						Vector3 v2(vertices[indices[i]].Position);
-						Vector3 v3(vertices[indices[i + 2]].Position);
-
-						A = v1;
-						B = v2;
-						C = v3;
-
-						triangleNormal = Vector3::Normalize(Vector3::Cross(v1 - v2, v3 - v1));
-						return distance;
-					}
-				}
-			}
-
-			return distance;
-		}
-
-		static void UpdateBody(Entity& body, float dt)
+		static void UpdateBody(PhysicsBody& body, float dt)
 		{
-			TransformComponent& tc = body.GetComponent<TransformComponent>();
-			RigidBodyComponent& rbc = body.GetComponent<RigidBodyComponent>();
+			TransformComponent& tc = *body.Transform;
+			RigidBodyComponent& rbc = *body.RigidBody;
 
 			// Update position due to LinearVelocity
 			Vector3 translation = { tc.Translation };
@@ -597,33 +608,29 @@ namespace Toast {
 			tc.RotationQuaternion = { (float)updatedQuaternion.x, (float)updatedQuaternion.y, (float)updatedQuaternion.z, (float)updatedQuaternion.w };
 		}
 
-		static bool TerrainCollisionCheck(Ref<PlanetNode>& leafNode, Entity* planet, Entity* object, TerrainCollision& collision, float dt)
+		static bool TerrainCollisionCheck(const PlanetNode& leafNode, PhysicsBody& body, TerrainCollision& collision, float dt)
 		{
 			TOAST_PROFILE_FUNCTION();
 
-			collision.Object = object;
-			collision.Planet = planet;
+			collision.Object = &body;
 
-			RigidBodyComponent& rbcObject = object->GetComponent<RigidBodyComponent>();
-			TransformComponent objectTC = object->GetComponent<TransformComponent>();
+			Vector3 posObject = { body.Transform->Translation };
 
-			Vector3 posObject = { object->GetComponent<TransformComponent>().Translation };
+			Vector3 Apos = leafNode.A.Position;
+			Vector3 Bpos = leafNode.B.Position;
+			Vector3 Cpos = leafNode.C.Position;
 
-			Vector3 Apos = leafNode->A.Position;
-			Vector3 Bpos = leafNode->B.Position;
-			Vector3 Cpos = leafNode->C.Position;
-
-			if (object->HasComponent<SphereColliderComponent>())
+			if (body.SphereCollider)
 			{
 				bool collisionDetected = false;
-				double sphereRadius = object->GetComponent<SphereColliderComponent>().Collider->mRadius;
+				double sphereRadius = body.SphereCollider->Collider->mRadius;
 
 				collisionDetected = SphereTerrainCollisionCheck(posObject, sphereRadius, dt, collision, { Apos, Bpos, Cpos });
 
 				if (collisionDetected)
 					return true;
 			}
-			else if (object->HasComponent<BoxColliderComponent>())
+			else if (body.BoxCollider)
 			{
 				bool collisionDetected = false;
 
@@ -638,23 +645,17 @@ namespace Toast {
 
 		static void ResolveTerrainCollision(TerrainCollision& collision)
 		{
-			RigidBodyComponent* rbcObject;
-			RigidBodyComponent rbcPlanet;
-
-			bool objectHasRigidBody = collision.Object->HasComponent<RigidBodyComponent>();
+			PhysicsBody& body = *collision.Object;
+			TransformComponent& tcObject = *body.Transform;
+			RigidBodyComponent* rbcObject = body.RigidBody;
 
-			if (objectHasRigidBody)
-				rbcObject = &collision.Object->GetComponent<RigidBodyComponent>();
+			bool objectHasRigidBody = rbcObject != nullptr;
 
-			Ref<Shape> collider;
-			if (collision.Object->HasComponent<SphereColliderComponent>())
-				collider = collision.Object->GetComponent<SphereColliderComponent>().Collider;
-			else if (collision.Object->HasComponent<BoxColliderComponent>())
-				collider = collision.Object->GetComponent<BoxColliderComponent>().Collider;
+			const Ref<Shape>& collider = body.Collider;
 
-			Vector3 objectCoMWorld = Matrix(collision.Object->GetComponent<TransformComponent>().GetTransform()) * rbcObject->CenterOfMass;
+			Vector3 objectCoMWorld = Matrix(tcObject.GetTransform()) * rbcObject->CenterOfMass;
 
-			Matrix rotationMatrix = Matrix(collision.Object->GetComponent<TransformComponent>().GetRotation());
+			Matrix rotationMatrix = Matrix(tcObject.GetRotation());
 			Matrix objectInvInertiaWorld = rotationMatrix * collider->GetInvInertiaTensor() * rotationMatrix.Transpose();
 
 			// Elasticity
@@ -694,7 +695,7 @@ namespace Toast {
 				totalAngularImpulse /= contactCount;
 			}
 
-			if (collision.Object->HasComponent<SphereColliderComponent>() && totalImpulse.Length() < 1000.0)
+			if (body.SphereCollider && totalImpulse.Length() < 1000.0)
 			{
 				rbcObject->IsStatic = true;
 			}
@@ -704,48 +705,48 @@ namespace Toast {
 				ApplyImpulseAngular(*rbcObject, objectInvInertiaWorld, totalAngularImpulse);
 			}
 
-			Vector3 objectPos = { collision.Object->GetComponent<TransformComponent>().Translation };
+			Vector3 objectPos = { tcObject.Translation };
 
 			Vector3 updatedPos = objectPos + collision.Normal * collision.Depth;
 
-			collision.Object->GetComponent<TransformComponent>().Translation = { (float)updatedPos.x, (float)updatedPos.y, (float)updatedPos.z };
+			tcObject.Translation = { (float)updatedPos.x, (float)updatedPos.y, (float)updatedPos.z };
 
 			// Friction in the future
 
 			return;
 		}
 
-		static Vector3 Gravity(Entity& planet, Entity object, double ts)
+		static Vector3 Gravity(const PhysicsPlanet& planet, const PhysicsBody& body, double ts)
 		{
 			Vector3 impulseGravity = { 0.0, 0.0, 0.0 };
 
-			Vector3 planetPos = { planet.GetComponent<TransformComponent>().Translation };
-			Vector3 objectPos = { object.GetComponent<TransformComponent>().Translation };
+			Vector3 planetPos = { planet.Transform->Translation };
+			Vector3 objectPos = { body.Transform->Translation };
 
-			auto& pc = planet.GetComponent<PlanetComponent>();
+			auto& pc = *planet.Planet;
 
 			// Calculate linear velocity due to gravity
-			double mass = 1.0 / object.GetComponent<RigidBodyComponent>().InvMass;
+			double mass = 1.0 / body.RigidBody->InvMass;
 			impulseGravity = Vector3::Normalize(planetPos - objectPos) * (double)pc.PlanetData.gravAcc * mass * ts;
 
 			return impulseGravity;
 		}
 
-		static void UpdateSphereAltitudeAndCollision(Entity* planetEntity, Entity* objectEntity, Vector3& worldTranslation, bool isCamera, double dt)
+		static void UpdateSphereAltitudeAndCollision(const PhysicsPlanet& physicsPlanet, PhysicsBody& body, Vector3& worldTranslation, double dt)
 		{
 			TerrainCollision terrainCollision;
 
-			terrainCollision.Planet = planetEntity;
-			terrainCollision.Object = objectEntity;
+			terrainCollision.Object = &body;
 
-			auto& planet = planetEntity->GetComponent<PlanetComponent>();
-			auto& rigidBody = objectEntity->GetComponent<RigidBodyComponent>();
+			const PlanetComponent& planet = *physicsPlanet.Planet;
+			auto& rigidBody = *body.RigidBody;
+			bool isCamera = body.IsCamera;
 
 			double sphereRadius = 0.0;
-			if (objectEntity->HasComponent<SphereColliderComponent>()) 
-				sphereRadius = objectEntity->GetComponent<SphereColliderComponent>().Collider->mRadius;
+			if (body.SphereCollider) 
+				sphereRadius = body.SphereCollider->Collider->mRadius;
 
-			Vector3 objectPos = objectEntity->GetComponent<TransformComponent>().Translation;
+			Vector3 objectPos = body.Transform->Translation;
 
 			Vector3 planetCenter = Vector3(planet.PlanetData.planetCenter.x,
 				planet.PlanetData.planetCenter.y,
@@ -762,36 +763,64 @@ namespace Toast {
 				return;
 			}
 
-			// Create a ray from object to planet center
-			Ray ray;
-			ray.Origin = objectPos;
-			ray.Direction = toCenter / distToCenter; // normalize direction
+			// The camera is offset by worldTranslation from the nodes
+			Vector3 nodesOffset = isCamera ? worldTranslation : Vector3(0.0, 0.0, 0.0);
+
+			// The terrain is kept in planet space, queries are moved there with where the planet is now
+			Matrix planetTransform = Matrix(physicsPlanet.Transform->GetTransformWithoutScale());
 
-			// Ray cast against the planet nodes
-			double closestT = DBL_MAX;
 			Vector3 bestHit;
-			bool hitFound = false;
-			for (auto& rootNode : planet.PlanetNodesWorldSpace) {
+			if (planet.TerrainData.HeightRanges)
+			{
+				// The height map itself is marched below the object, whatever LOD the planet is drawn with
+				Matrix inverseTransform = Matrix::Inverse(planetTransform);
 
-				if (rootNode == NULL)
-					continue;
+				Vector3 origin = inverseTransform * (objectPos - nodesOffset);
+				double originDistance = origin.Length();
 
-				double t;
-				Vector3 hp;
-				if (RaycastPlanetNode(ray, rootNode, worldTranslation, isCamera, t, hp)) {
-					if (!hitFound || t < closestT) {
-						hitFound = true;
-						closestT = t;
-						bestHit = hp;
+				TerrainRaycastHit hit;
+				if (!PlanetSystem::RaycastTerrain(planet, physicsPlanet.TerrainDetail, origin, -origin / originDistance, originDistance, hit))
+					return;
+
+				// Below the terrain the hit is the origin itself, the surface is straight above it
+				Vector3 surfacePoint = hit.Distance > 0.0 ? hit.Point : origin * ((originDistance - hit.Altitude) / originDistance);
+				bestHit = planetTransform * surfacePoint + nodesOffset;
+			}
+			else
+			{
+				// Create a ray from object to planet center, moved into planet space once instead of moving the nodes out of it
+				PlanetNodeView nodeView = PlanetSystem::GetNodeView(planet, planetTransform);
+				if (nodeView.Empty())
+					return;
+
+				Ray ray;
+				ray.Origin = nodeView.ToPlanetSpace(objectPos - nodesOffset);
+				ray.Direction = nodeView.ToPlanetSpaceDirection(toCenter / distToCenter); // normalize direction
+
+				// Ray cast against the planet nodes
+				double closestT = DBL_MAX;
+				bool hitFound = false;
+				const PlanetNodePool& baseNodes = nodeView.GetBaseNodes();
+				for (uint32_t rootNode : baseNodes.Roots) {
+					double t;
+					Vector3 hp;
+					if (RaycastPlanetNode(ray, nodeView, baseNodes, rootNode, t, hp)) {
+						if (!hitFound || t < closestT) {
+							hitFound = true;
+							closestT = t;
+							bestHit = hp;
+						}
 					}
 				}
-			}
 
-			if (!hitFound)
-			{
-				// No intersection found, object is above no actual mesh intersection
-				// Approximate altitude by planet radius (no local terrain detail)
-				return;
+				if (!hitFound)
+				{
+					// No intersection found, object is above no actual mesh intersection
+					// Approximate altitude by planet radius (no local terrain detail)
+					return;
+				}
+
+				bestHit = nodeView.ToWorldSpace(bestHit) + nodesOffset;
 			}
 
 			// We have a hit point on the planet surface mesh
@@ -802,7 +831,7 @@ namespace Toast {
 			terrainCollision.Depth = penetration;
 			rigidBody.Altitude = -terrainCollision.Depth;
 
-			//TOAST_CORE_CRITICAL("Altitude: %lf, number of nodes: %d ", rigidBody.Altitude, planet.PlanetNodesWorldSpace.size());
+			//TOAST_CORE_CRITICAL("Altitude: %lf", rigidBody.Altitude);
 
 			terrainCollision.Normal = Vector3::Normalize(bestHit - planetCenter);
 
@@ -817,68 +846,120 @@ namespace Toast {
 				ResolveTerrainCollision(terrainCollision);
 		}
 
-		static void CheckTerrainBroadPhase(Ref<PlanetNode>& node, Entity* planetEntity, Entity* objectEntity, double dt_sub, const Bounds& objectBounds)
+		// objectBounds are in planet space
+		static void CheckTerrainBroadPhase(const PlanetNodeView& view, const PlanetNodePool& nodes, uint32_t nodeIndex, PhysicsBody& body, double dt_sub, const Bounds& objectBounds)
 		{
+			const PlanetNodePool& pool = view.Resolve(nodes, nodeIndex);
+			const PlanetNode& node = pool[nodeIndex];
+
 			// Broad phase intersection test
-			if (!node->NodeBounds.Intersects(objectBounds))
+			if (!node.NodeBounds.Intersects(objectBounds))
 				return;
 
 			// If not a leaf, go deeper
-			//TOAST_CORE_CRITICAL("Subdivision Level: %d, Number of children: %d", node->SubdivisionLevel, node->ChildNodes.size());
-			if (!node->ChildNodes.empty()) 
+			//TOAST_CORE_CRITICAL("Subdivision Level: %d, Number of children: %d", node.SubdivisionLevel, node.ChildCount);
+			if (!node.IsLeaf()) 
 			{
-				for (auto& child : node->ChildNodes) 
-					CheckTerrainBroadPhase(child, planetEntity, objectEntity, dt_sub, objectBounds);
+				for (uint32_t child = node.FirstChild; child < node.FirstChild + node.ChildCount; child++) 
+					CheckTerrainBroadPhase(view, pool, child, body, dt_sub, objectBounds);
 			}
 			else 
 			{
 				// Leaf node: Perform narrow-phase on its triangle(s)
 				TerrainCollision terrainCollision;
-				if (TerrainCollisionCheck(node, planetEntity, objectEntity, terrainCollision, dt_sub))
+				if (TerrainCollisionCheck(view.ToWorldSpace(node), body, terrainCollision, dt_sub))
 					ResolveTerrainCollision(terrainCollision);
 			}
 		}
 
-		static void CheckPlanetCollisions(Entity planetEntity, Entity objectEntity, Vector3& worldTranslation, bool isCamera, double dt_sub) {
-			auto& planet = planetEntity.GetComponent<PlanetComponent>();
-
+		static void CheckPlanetCollisions(const PhysicsPlanet& planet, PhysicsBody& body, Vector3& worldTranslation, double dt_sub) {
 			//TOAST_CORE_CRITICAL("NEW PLANET CHECK");
 
-			Ref<Shape> collider;
-			bool reqAltitude = false;
-			if (objectEntity.HasComponent<SphereColliderComponent>())
-			{
-				collider = objectEntity.GetComponent<SphereColliderComponent>().Collider;
-				reqAltitude = objectEntity.GetComponent<SphereColliderComponent>().ReqAltitude;
-			}
-			else if (objectEntity.HasComponent<BoxColliderComponent>())
-			{
-				collider = objectEntity.GetComponent<BoxColliderComponent>().Collider;
-				reqAltitude = objectEntity.GetComponent<BoxColliderComponent>().ReqAltitude;
-			}
-
-			if (!collider)
+			if (!body.Collider)
 				return;
 
-			Vector3 objectPos = objectEntity.GetComponent<TransformComponent>().Translation;
+			Vector3 objectPos = body.Transform->Translation;
 
-			Vector3 objectLinearVel = objectEntity.GetComponent<RigidBodyComponent>().LinearVelocity;
+			Vector3 objectLinearVel = body.RigidBody->LinearVelocity;
 
 			// Get object bounds
 			Bounds objectBounds;
-			objectBounds = collider->GetBounds();
+			objectBounds = body.Collider->GetBounds();
 			objectBounds = objectBounds + objectPos;
 			objectBounds.Expand(objectPos + objectLinearVel * dt_sub);
 
 			// Traverse the planets root nodes
-			if (!reqAltitude)
+			if (!body.ReqAltitude)
 			{
-				int i = 0;
-				for (auto& rootNode : planet.PlanetNodesWorldSpace)
-					CheckTerrainBroadPhase(rootNode, &planetEntity, &objectEntity, dt_sub, objectBounds);
+				PlanetNodeView nodeView = PlanetSystem::GetNodeView(*planet.Planet, Matrix(planet.Transform->GetTransformWithoutScale()));
+				if (nodeView.Empty())
+					return;
+
+				Bounds objectBoundsPlanetSpace = nodeView.ToPlanetSpace(objectBounds);
+
+				const PlanetNodePool& baseNodes = nodeView.GetBaseNodes();
+				for (uint32_t rootNode : baseNodes.Roots)
+					CheckTerrainBroadPhase(nodeView, baseNodes, rootNode, body, dt_sub, objectBoundsPlanetSpace);
 			}
 			else 
-				UpdateSphereAltitudeAndCollision(&planetEntity, &objectEntity, worldTranslation, isCamera, dt_sub);
+				UpdateSphereAltitudeAndCollision(planet, body, worldTranslation, dt_sub);
+		}
+
+		// Planet whose surface is closest to the object, the only one its altitude is measured against
+		static const PhysicsPlanet* GetNearestPlanet(const std::vector<PhysicsPlanet>& planets, const TransformComponent& transform, Vector3& worldTranslation, bool isCamera)
+		{
+			Vector3 objectPos = transform.Translation;
+
+			const PhysicsPlanet* nearest = nullptr;
+			double nearestDistance = DBL_MAX;
+			for (const PhysicsPlanet& physicsPlanet : planets)
+			{
+				const PlanetComponent& planet = *physicsPlanet.Planet;
+
+				Vector3 planetCenter = Vector3(planet.PlanetData.planetCenter.x, planet.PlanetData.planetCenter.y, planet.PlanetData.planetCenter.z);
+				if (isCamera)
+					planetCenter += worldTranslation;
+
+				double distance = (planetCenter - objectPos).Length() - planet.PlanetData.radius;
+				if (distance < nearestDistance)
+				{
+					nearestDistance = distance;
+					nearest = &physicsPlanet;
+				}
+			}
+
+			return nearest;
+		}
+
+		// Only writes the components of the body itself, bodies that aren't planets can be stepped at the same time
+		static void StepBody(PhysicsBody& body, const std::vector<PhysicsPlanet>& planets, Vector3& worldTranslation, double dt, double dt_sub, uint32_t numSubSteps)
+		{
+			auto& rbc = *body.RigidBody;
+
+			for (int i = 0; i < numSubSteps; ++i)
+			{
+				// Gravity of every planet adds up
+				if (!rbc.IsStatic)
+				{
+					for (const PhysicsPlanet& planet : planets)
+					{
+						Vector3 impulseGravity = Gravity(planet, body, dt_sub);
+						ApplyLinearImpulse(rbc, impulseGravity);
+					}
+				}
+
+				// Terrain collision check, the altitude ray only goes to the nearest planet
+				if (body.NearestPlanet)
+					CheckPlanetCollisions(*body.NearestPlanet, body, worldTranslation, dt_sub);
+				else
+				{
+					for (const PhysicsPlanet& planet : planets)
+						CheckPlanetCollisions(planet, body, worldTranslation, dt_sub);
+				}
+
+				// Do not let the camera be effected by gravity for example
+				UpdateBody(body, dt);
+			}
 		}
 
 		static void Update(entt::registry* registry, Scene* scene, double dt, double slowmotion, uint32_t numSubSteps)
@@ -896,12 +977,25 @@ namespace Toast {
 			Vector3 worldTranslation;
 			bool isCamera = false;
 
-			auto planetView = registry->view<PlanetComponent>();
-			if (planetView.size() > 0)
+			// Every component the bodies read is resolved here, on the calling thread. Optional components are looked up
+			// with HasComponent, which creates their pools, so nothing touches the registry once the bodies are stepped
+			static thread_local std::vector<PhysicsPlanet> sPlanets;
+			sPlanets.clear();
+
+			auto planetView = registry->view<TransformComponent, PlanetComponent>();
+			for (auto entity : planetView)
 			{
-				Entity planetEntity = { planetView[0], scene };
-				TerrainColliderComponent& tcc = planetEntity.GetComponent<TerrainColliderComponent>();
+				Entity planetEntity = { entity, scene };
+				auto [tc, pc] = planetView.get<TransformComponent, PlanetComponent>(entity);
+
+				PhysicsPlanet& planet = sPlanets.emplace_back();
+				planet.Planet = &pc;
+				planet.Transform = &tc;
+				planet.TerrainDetail = planetEntity.HasComponent<TerrainDetailComponent>() ? &planetEntity.GetComponent<TerrainDetailComponent>() : nullptr;
+			}
 
+			if (!sPlanets.empty())
+			{
 				// Find Camera to get worldTranslation
 				for (auto entity : view)
 				{
@@ -915,16 +1009,23 @@ namespace Toast {
 					}
 				}
 
+				// Gather, in view order. Inertia tensors are updated here since colliders can be shared between bodies
+				static thread_local std::vector<PhysicsBody> sBodies;
+				sBodies.clear();
+
 				for (auto entity : view)
 				{
 					Entity objectEntity = { entity, scene };
 					auto [tc, rbc] = view.get<TransformComponent, RigidBodyComponent>(entity);
 
+					SphereColliderComponent* sphereCollider = objectEntity.HasComponent<SphereColliderComponent>() ? &objectEntity.GetComponent<SphereColliderComponent>() : nullptr;
+					BoxColliderComponent* boxCollider = objectEntity.HasComponent<BoxColliderComponent>() ? &objectEntity.GetComponent<BoxColliderComponent>() : nullptr;
+
 					Ref<Shape> collider;
-					if(objectEntity.HasComponent<SphereColliderComponent>())
-						collider = objectEntity.GetComponent<SphereColliderComponent>().Collider;
-					if (objectEntity.HasComponent<BoxColliderComponent>())
-						collider = objectEntity.GetComponent<BoxColliderComponent>().Collider;
+					if (sphereCollider)
+						collider = sphereCollider->Collider;
+					if (boxCollider)
+						collider = boxCollider->Collider;
 
 					if (objectEntity.HasComponent<CameraComponent>())
 						isCamera = true;
@@ -944,22 +1045,69 @@ namespace Toast {
 							collider->SetIsDirty(false);
 						}
 
-						for (int i = 0; i < numSubSteps; ++i)
+						PhysicsBody& body = sBodies.emplace_back();
+						body.Transform = &tc;
+						body.RigidBody = &rbc;
+						body.SphereCollider = sphereCollider;
+						body.BoxCollider = boxCollider;
+						if (sphereCollider)
 						{
-							// Gravity
-							if (!rbc.IsStatic)
-							{
-								Vector3 impulseGravity = Gravity(planetEntity, objectEntity, dt_sub);
-								ApplyLinearImpulse(rbc, impulseGravity);
-							}
+							body.Collider = sphereCollider->Collider;
+							body.ReqAltitude = sphereCollider->ReqAltitude;
+						}
+						else
+						{
+							body.Collider = boxCollider->Collider;
+							body.ReqAltitude = boxCollider->ReqAltitude;
+						}
+						body.NearestPlanet = body.ReqAltitude ? GetNearestPlanet(sPlanets, tc, worldTranslation, isCamera) : nullptr;
+						body.IsCamera = isCamera;
+						body.IsPlanet = objectEntity.HasComponent<PlanetComponent>();
+					}
+				}
 
-							// Terrain collision check
-							CheckPlanetCollisions(planetEntity, objectEntity, worldTranslation, isCamera, dt_sub);
+				// Integrate and collide. Every body reads the planets and writes only its own components, so the bodies
+				// between two planet bodies get the same results in any order and on any thread as stepped one by one
+				size_t first = 0;
+				while (first < sBodies.size())
+				{
+					size_t last = first;
+					while (last < sBodies.size() && !sBodies[last].IsPlanet)
+						last++;
 
-							// Do not let the camera be effected by gravity for example
-							UpdateBody(objectEntity, dt);
-						}
+					if (last - first < PHYSICS_MIN_PARALLEL_BODIES)
+					{
+						for (size_t i = first; i < last; i++)
+							StepBody(sBodies[i], sPlanets, worldTranslation, dt, dt_sub, numSubSteps);
+					}
+					else
+					{
+						std::atomic<size_t> nextBody{ first };
+						auto worker = [&]()
+						{
+							size_t bodyIndex;
+							while ((bodyIndex = nextBody.fetch_add(1)) < last)
+								StepBody(sBodies[bodyIndex], sPlanets, worldTranslation, dt, dt_sub, numSubSteps);
+						};
+
+						// The calling thread works on the bodies as well, the pool is shared with the planet builds
+						WorkerPool& pool = WorkerPool::Get();
+						pool.Run(worker, (uint32_t)(std::min)((size_t)pool.GetThreadCount(), last - first - 1));
 					}
+
+					// The planet body after the run, stepped once everything before it in view order is done
+					if (last < sBodies.size())
+						StepBody(sBodies[last], sPlanets, worldTranslation, dt, dt_sub, numSubSteps);
+
+					first = last + 1;
+				}
+
+				// Every body is done, the tiles the ray casts didn't touch lately can be unmapped
+				for (const PhysicsPlanet& planet : sPlanets)
+				{
+					const TerrainData& terrainData = planet.Planet->TerrainData;
+					if (terrainData.PhysicsTiles)
+						terrainData.PhysicsTiles->Trim();
 				}
 
 				// This will be used later for when collision is added between entities. Right now Toast Physics only work with
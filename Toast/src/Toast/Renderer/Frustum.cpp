@@ -1,8 +1,13 @@
 #include "tpch.h"
 #include "Frustum.h"
 
+#include <emmintrin.h>
+
 namespace Toast {
 
+	// Like the triangle tests, spheres only just outside of a plane are kept
+	static const double SPHERE_CULL_TOLERANCE = 0.01;
+
 	void Frustum::Invalidate(float aspectRatio, float FOV, float nearClip, float farClip)
 	{
 		Vector3 right = { 1.0, 0.0, 0.0 };
@@ -105,7 +110,7 @@ namespace Toast {
 	VolumeTri Frustum::ContainsTriangle(Vector3 p1, Vector3 p2, Vector3 p3)
 	{
 		VolumeTri ret = VolumeTri::CONTAINS;
-		for (auto plane : mPlanetCheckPlanes)
+		for (const auto& plane : mPlanetCheckPlanes)
 		{
 			uint8_t rejects = 0;
 
@@ -140,7 +145,7 @@ namespace Toast {
 		
 		VolumeTri ret = VolumeTri::CONTAINS;
 
-		for (auto plane : mPlanetCheckPlanes)
+		for (const auto& plane : mPlanetCheckPlanes)
 		{
 			uint8_t rejects = 0;
 
@@ -182,6 +187,66 @@ namespace Toast {
 		return ret;
 	}
 
+	bool Frustum::ContainsSphere(const Vector3& center, double radius, bool planetSpace) const
+	{
+		const std::vector<Plane>& planes = planetSpace ? mPlanetCheckPlanes : mPlanes;
+		for (const auto& plane : planes)
+		{
+			if (Vector3::Dot(plane.Normal, center) - plane.D + radius < -SPHERE_CULL_TOLERANCE)
+				return false;
+		}
+
+		return true;
+	}
+
+	void Frustum::CullSpheres(const BoundingSphereBatch& spheres, std::vector<uint8_t>& visible, bool planetSpace) const
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		const std::vector<Plane>& planes = planetSpace ? mPlanetCheckPlanes : mPlanes;
+		size_t count = spheres.Size();
+		visible.resize(count);
+
+		// Every plane is splatted once, the spheres are then tested two at a time against all of them
+		TOAST_CORE_ASSERT(planes.size() <= 6, "Frustum has more planes than CullSpheres can test!");
+		__m128d normalX[6], normalY[6], normalZ[6], limit[6];
+		size_t planeCount = planes.size();
+		for (size_t p = 0; p < planeCount; p++)
+		{
+			normalX[p] = _mm_set1_pd(planes[p].Normal.x);
+			normalY[p] = _mm_set1_pd(planes[p].Normal.y);
+			normalZ[p] = _mm_set1_pd(planes[p].Normal.z);
+			limit[p] = _mm_set1_pd(planes[p].D - SPHERE_CULL_TOLERANCE);
+		}
+
+		size_t i = 0;
+		for (; i + 2 <= count; i += 2)
+		{
+			__m128d x = _mm_loadu_pd(&spheres.CenterX[i]);
+			__m128d y = _mm_loadu_pd(&spheres.CenterY[i]);
+			__m128d z = _mm_loadu_pd(&spheres.CenterZ[i]);
+			__m128d r = _mm_loadu_pd(&spheres.Radius[i]);
+
+			// dot(n, c) + r >= D - tolerance for every plane
+			__m128d inside = _mm_castsi128_pd(_mm_set1_epi32(-1));
+			for (size_t p = 0; p < planeCount; p++)
+			{
+				__m128d distance = _mm_add_pd(_mm_add_pd(_mm_mul_pd(normalX[p], x), _mm_mul_pd(normalY[p], y)), _mm_add_pd(_mm_mul_pd(normalZ[p], z), r));
+				inside = _mm_and_pd(inside, _mm_cmpge_pd(distance, limit[p]));
+			}
+
+			int mask = _mm_movemask_pd(inside);
+			visible[i] = (uint8_t)(mask & 1);
+			visible[i + 1] = (uint8_t)((mask >> 1) & 1);
+		}
+
+		for (; i < count; i++)
+		{
+			Vector3 center = { spheres.CenterX[i], spheres.CenterY[i], spheres.CenterZ[i] };
+			visible[i] = ContainsSphere(center, spheres.Radius[i], planetSpace) ? 1 : 0;
+		}
+	}
+
 	void Frustum::ToString()
 	{
 		TOAST_CORE_INFO("Frustum planet planes!");
@@ -29,6 +29,33 @@ enum class VolumeTri
 
 namespace Toast {
 
+	// Bounding spheres with one array per component, so the frustum tests a register full of them against a plane at once
+	struct BoundingSphereBatch
+	{
+		std::vector<double> CenterX;
+		std::vector<double> CenterY;
+		std::vector<double> CenterZ;
+		std::vector<double> Radius;
+
+		size_t Size() const { return Radius.size(); }
+
+		void Clear()
+		{
+			CenterX.clear();
+			CenterY.clear();
+			CenterZ.clear();
+			Radius.clear();
+		}
+
+		void Add(const Vector3& center, double radius)
+		{
+			CenterX.push_back(center.x);
+			CenterY.push_back(center.y);
+			CenterZ.push_back(center.z);
+			Radius.push_back(radius);
+		}
+	};
+
 	class Frustum
 	{
 	public:
@@ -43,6 +70,11 @@ namespace Toast {
 		VolumeTri ContainsTriangle(Vector3 p1, Vector3 p2, Vector3 p3);
 		VolumeTri ContainsTriangleVolume(Vector3 p1, Vector3 p2, Vector3 p3, double heightRange);
 
+		// planetSpace tests against the planes Update(transform, planetTransform) moved into planet space
+		bool ContainsSphere(const Vector3& center, double radius, bool planetSpace = false) const;
+		// visible[i] is 0 when sphere i is completely outside one of the planes, 1 otherwise
+		void CullSpheres(const BoundingSphereBatch& spheres, std::vector<uint8_t>& visible, bool planetSpace = false) const;
+
 		void ToString();
 	public:
 		Vector3 mCenterNear;
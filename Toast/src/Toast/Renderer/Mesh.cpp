@@ -2,6 +2,9 @@
 #define CGLTF_IMPLEMENTATION
 #include "Mesh.h"
 
+#include "Toast/Renderer/MeshOptimizer.h"
+#include "Toast/Renderer/RenderCommand.h"
+
 #include <filesystem>
 #include <math.h>
 
@@ -39,6 +42,33 @@ namespace Toast {
 		}
 	}
 
+	// Exporters keep the modelling order, every submesh is reordered for the vertex cache and the vertex fetch on its own
+	static void OptimizeSubmeshes(LODGroup& lod)
+	{
+		std::vector<uint32_t> remap;
+		for (auto& submesh : lod.Submeshes)
+		{
+			if (submesh.IndexCount == 0 || submesh.VertexCount == 0)
+				continue;
+
+			uint32_t* indices = &lod.Indices[submesh.BaseIndex];
+			for (uint32_t i = 0; i < submesh.IndexCount; i++)
+				indices[i] -= submesh.BaseVertex;
+
+			VertexCacheStats before = MeshOptimizer::AnalyzeVertexCache(indices, submesh.IndexCount, submesh.VertexCount);
+
+			MeshOptimizer::OptimizeVertexCache(indices, submesh.IndexCount, submesh.VertexCount);
+			MeshOptimizer::OptimizeVertexFetch(indices, submesh.IndexCount, submesh.VertexCount, remap);
+			MeshOptimizer::RemapVertices(&lod.Vertices[submesh.BaseVertex], submesh.VertexCount, remap);
+
+			VertexCacheStats after = MeshOptimizer::AnalyzeVertexCache(indices, submesh.IndexCount, submesh.VertexCount);
+			TOAST_CORE_INFO("Mesh '%s' ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", submesh.MeshName.c_str(), before.ACMR, after.ACMR, before.ATVR, after.ATVR);
+
+			for (uint32_t i = 0; i < submesh.IndexCount; i++)
+				indices[i] += submesh.BaseVertex;
+		}
+	}
+
 	Mesh::Mesh()
 	{
 		mLODGroups.emplace_back(CreateRef<LODGroup>());
@@ -91,6 +121,8 @@ namespace Toast {
 				LoadMeshWithLODs(data);
 			}
 
+			UpdateBoundingSphere();
+
 			cgltf_free(data);
 		}
 	}
@@ -113,6 +145,35 @@ namespace Toast {
 
 		mLODGroups[0]->VBuffer = CreateRef<VertexBuffer>(&mLODGroups[0]->Vertices[0], (sizeof(Vertex) * (uint32_t)mLODGroups[0]->Vertices.size()), (uint32_t)mLODGroups[0]->Vertices.size(), 0);
 		mLODGroups[0]->IBuffer = CreateRef<IndexBuffer>(&mLODGroups[0]->Indices[0], (uint32_t)mLODGroups[0]->Indices.size());
+
+		UpdateBoundingSphere();
+	}
+
+	void Mesh::UpdateBoundingSphere()
+	{
+		DirectX::XMFLOAT3 mins = { FLT_MAX, FLT_MAX, FLT_MAX };
+		DirectX::XMFLOAT3 maxs = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		bool empty = true;
+		for (auto& lod : mLODGroups)
+		{
+			for (auto& vertex : lod->Vertices)
+			{
+				mins = { (std::min)(mins.x, vertex.Position.x), (std::min)(mins.y, vertex.Position.y), (std::min)(mins.z, vertex.Position.z) };
+				maxs = { (std::max)(maxs.x, vertex.Position.x), (std::max)(maxs.y, vertex.Position.y), (std::max)(maxs.z, vertex.Position.z) };
+				empty = false;
+			}
+		}
+
+		if (empty)
+		{
+			mBoundingRadius = -1.0;
+			return;
+		}
+
+		// Around the box of the vertices, not the tightest sphere but cheap and never smaller than the mesh
+		mBoundingCenter = { ((double)mins.x + (double)maxs.x) * 0.5, ((double)mins.y + (double)maxs.y) * 0.5, ((double)mins.z + (double)maxs.z) * 0.5 };
+		Vector3 halfExtent = { ((double)maxs.x - (double)mins.x) * 0.5, ((double)maxs.y - (double)mins.y) * 0.5, ((double)maxs.z - (double)mins.z) * 0.5 };
+		mBoundingRadius = halfExtent.Length();
 	}
 
 	void Mesh::LoadMesh(cgltf_data* data)
@@ -307,6 +368,8 @@ namespace Toast {
 			}
 
 		}
+
+		OptimizeSubmeshes(*mLODGroups[0]);
 			
 		mLODGroups[0]->VBuffer = CreateRef<VertexBuffer>(mLODGroups[0]->Vertices.data(), (sizeof(Vertex) * (uint32_t)mLODGroups[0]->Vertices.size()), (uint32_t)mLODGroups[0]->Vertices.size(), 0);
 
@@ -398,6 +461,8 @@ namespace Toast {
 					}
 				}
 
+				OptimizeSubmeshes(*currentLOD);
+
 				currentLOD->VBuffer = CreateRef<VertexBuffer>(currentLOD->Vertices.data(), (sizeof(Vertex) * (uint32_t)currentLOD->Vertices.size()), (uint32_t)currentLOD->Vertices.size(), 0);
 
 				if (mInstanced && mMaxNrOfInstanceObjects > 0)
@@ -497,10 +562,10 @@ namespace Toast {
 
 	void Mesh::InvalidatePlanet()
 	{
-		if(mLODGroups[mActiveLODGroup]->Vertices.size() > 0)
+		if(mPlanetVertices.size() > 0)
 		{
 			mLODGroups[mActiveLODGroup]->VBuffer = nullptr;
-			mLODGroups[mActiveLODGroup]->VBuffer = CreateRef<VertexBuffer>(&mLODGroups[0]->Vertices[0], (sizeof(Vertex) * (uint32_t)mLODGroups[0]->Vertices.size()), (uint32_t)mLODGroups[0]->Vertices.size(), 0);
+			mLODGroups[mActiveLODGroup]->VBuffer = CreateRef<VertexBuffer>(&mPlanetVertices[0], (sizeof(PlanetVertex) * (uint32_t)mPlanetVertices.size()), (uint32_t)mPlanetVertices.size(), 0);
 
 			mLODGroups[mActiveLODGroup]->IBuffer = nullptr;
 			mLODGroups[mActiveLODGroup]->IBuffer = CreateRef<IndexBuffer>(&mLODGroups[0]->Indices[0], (uint32_t)mLODGroups[0]->Indices.size());
@@ -516,6 +581,65 @@ namespace Toast {
 		}
 	}
 
+	void Mesh::UpdatePlanetVertices(uint32_t offset, uint32_t count)
+	{
+		if (count == 0 || !mLODGroups[mActiveLODGroup]->VBuffer)
+			return;
+
+		mLODGroups[mActiveLODGroup]->VBuffer->SetSubData(&mPlanetVertices[offset], sizeof(PlanetVertex) * offset, sizeof(PlanetVertex) * count);
+	}
+
+	void Mesh::UpdatePlanetIndices(uint32_t offset, uint32_t count)
+	{
+		if (count == 0 || !mLODGroups[mActiveLODGroup]->IBuffer)
+			return;
+
+		mLODGroups[mActiveLODGroup]->IBuffer->SetSubData(&mLODGroups[0]->Indices[offset], sizeof(uint32_t) * offset, sizeof(uint32_t) * count);
+	}
+
+	void Mesh::UpdatePlanetFrames(const std::vector<PlanetVertexFrame>& frames)
+	{
+		if (frames.empty())
+			return;
+
+		RendererAPI* API = RenderCommand::sRendererAPI.get();
+
+		if (frames.size() > mPlanetFrameCapacity)
+		{
+			mPlanetFrameCapacity = (std::max)((uint32_t)frames.size(), mPlanetFrameCapacity * 3 / 2);
+
+			D3D11_BUFFER_DESC bufferDesc = {};
+			bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+			bufferDesc.ByteWidth = sizeof(PlanetVertexFrame) * mPlanetFrameCapacity;
+			bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+			bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+			bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+			bufferDesc.StructureByteStride = sizeof(PlanetVertexFrame);
+
+			mPlanetFrameBuffer = nullptr;
+			mPlanetFrameSRV = nullptr;
+			API->GetDevice()->CreateBuffer(&bufferDesc, nullptr, &mPlanetFrameBuffer);
+
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+			srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+			srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+			srvDesc.Buffer.NumElements = mPlanetFrameCapacity;
+
+			API->GetDevice()->CreateShaderResourceView(mPlanetFrameBuffer.Get(), &srvDesc, &mPlanetFrameSRV);
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mappedResource;
+		API->GetDeviceContext()->Map(mPlanetFrameBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+		memcpy(mappedResource.pData, frames.data(), sizeof(PlanetVertexFrame) * frames.size());
+		API->GetDeviceContext()->Unmap(mPlanetFrameBuffer.Get(), 0);
+	}
+
+	void Mesh::BindPlanetFrames()
+	{
+		if (mPlanetFrameSRV)
+			RenderCommand::SetShaderResource(D3D11_VERTEX_SHADER, 0, mPlanetFrameSRV);
+	}
+
 	void Mesh::OnUpdate(Timestep ts)
 	{
 		if (mHasLODs)
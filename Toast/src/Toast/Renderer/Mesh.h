@@ -6,6 +6,7 @@
 #include "Toast/Renderer/Shader.h"
 #include "Toast/Renderer/Material.h"
 #include "Toast/Renderer/Formats.h"
+#include "Toast/Renderer/PlanetVertex.h"
 
 #include "Toast/Core/Math/Math.h"
 
@@ -15,12 +16,26 @@
 
 namespace Toast {
 
+	class TiledHeightmap;
+	class TerrainHeightPyramid;
+
 	struct TerrainData
 	{
 		size_t RowPitch;
 		size_t Width;
 		size_t Height;
-		std::vector<double> HeightData;
+		// Raw 16 bit texels, the height in meters is HeightData * HeightScale + HeightOffset
+		std::vector<uint16_t> HeightData;
+		double HeightScale = 1.0;
+		double HeightOffset = 0.0;
+
+		// When set the texels are streamed from the tiled file instead of HeightData
+		Ref<TiledHeightmap> Tiles;
+		// Second mapping of the same file for the physics, only trimmed between physics updates
+		Ref<TiledHeightmap> PhysicsTiles;
+
+		// Min and max texel quadtree for the terrain ray casts, see PlanetSystem::RaycastTerrain
+		Ref<TerrainHeightPyramid> HeightRanges;
 	};
 
 	struct Face
@@ -191,11 +206,12 @@ namespace Toast {
 		uint32_t FindPosition(float animationTime, const std::string& animationName);
 		DirectX::XMVECTOR InterpolateTranslation(float animationTime, const std::string& animationName);
 	public:
-		uint32_t BaseVertex;
-		uint32_t BaseIndex;
+		uint32_t BaseVertex = 0;
+		uint32_t BaseIndex = 0;
 		std::string MaterialName;
-		uint32_t IndexCount;
-		uint32_t VertexCount;
+		// Stays 0 for primitives without indices
+		uint32_t IndexCount = 0;
+		uint32_t VertexCount = 0;
 
 		DirectX::XMMATRIX Transform = DirectX::XMMatrixIdentity();
 		DirectX::XMFLOAT3 Translation = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
@@ -252,6 +268,13 @@ namespace Toast {
 
 		void OnUpdate(Timestep ts);
 		void InvalidatePlanet();
+		// Uploads count vertices or indices starting at offset from the CPU copy into the existing planet buffers
+		void UpdatePlanetVertices(uint32_t offset, uint32_t count);
+		void UpdatePlanetIndices(uint32_t offset, uint32_t count);
+		// Writes the frames the planet vertices are decoded with, the buffer is recreated when it has to grow
+		void UpdatePlanetFrames(const std::vector<PlanetVertexFrame>& frames);
+		// Binds the frames to the vertex shader slot the planet shaders read them from
+		void BindPlanetFrames();
 
 		const std::string& GetFilePath() const { return mFilePath; }
 
@@ -276,7 +299,12 @@ namespace Toast {
 		bool IsInstanced() const { return mInstanced; }
 		uint32_t GetNumberOfInstances(size_t LODGroupIndex) const { return mLODGroups[LODGroupIndex]->NumberOfInstances; }
 		void SetInstanceData(const void* data, uint32_t size, uint32_t numberOfInstances);
+
+		// Mesh space sphere around the vertices of all LOD groups, the radius is negative if the mesh has no vertices
+		const Vector3& GetBoundingCenter() const { return mBoundingCenter; }
+		double GetBoundingRadius() const { return mBoundingRadius; }
 	private:
+		void UpdateBoundingSphere();
 		std::string mFilePath = "";
 
 		bool mHasLODs = false;
@@ -285,10 +313,19 @@ namespace Toast {
 		std::vector<Ref<LODGroup>> mLODGroups;
 		size_t mActiveLODGroup = 0;
 
+		// Planet meshes draw compact vertices instead of the LOD group vertices, decoded with the frames in the planet shaders
+		std::vector<PlanetVertex> mPlanetVertices;
+		Microsoft::WRL::ComPtr<ID3D11Buffer> mPlanetFrameBuffer;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mPlanetFrameSRV;
+		uint32_t mPlanetFrameCapacity = 0;
+
 		Vector3 mColorOverride;
 		uint32_t mMaxNrOfInstanceObjects = 0;
 		bool mInstanced = false;
 
+		Vector3 mBoundingCenter;
+		double mBoundingRadius = -1.0;
+
 		std::unordered_map<std::string, Ref<Material>> mMaterials;
 
 		DirectX::XMMATRIX mTransform = DirectX::XMMatrixIdentity();
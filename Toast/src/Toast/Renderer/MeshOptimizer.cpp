@@ -0,0 +1,248 @@
+#include "tpch.h"
+
+#include "MeshOptimizer.h"
+
+namespace Toast {
+
+	// Scoring constants from the paper
+	static constexpr float CACHE_DECAY_POWER = 1.5f;
+	static constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+	static constexpr float VALENCE_BOOST_SCALE = 2.0f;
+	static constexpr float VALENCE_BOOST_POWER = 0.5f;
+	// Vertices used by more live triangles than this all get the same boost
+	static constexpr uint32_t MAX_VALENCE = 32;
+
+	struct VertexScoreTables
+	{
+		float Cache[MeshOptimizer::CACHE_SIZE];
+		float Valence[MAX_VALENCE];
+
+		VertexScoreTables()
+		{
+			for (uint32_t i = 0; i < MeshOptimizer::CACHE_SIZE; i++)
+			{
+				// The last triangle's vertices get a fixed score so the next triangle doesn't just reuse the same edge
+				if (i < 3)
+					Cache[i] = LAST_TRIANGLE_SCORE;
+				else
+					Cache[i] = powf(1.0f - (float)(i - 3) / (float)(MeshOptimizer::CACHE_SIZE - 3), CACHE_DECAY_POWER);
+			}
+
+			// Vertices with few triangles left are finished first, so they don't have to be transformed again later
+			Valence[0] = 0.0f;
+			for (uint32_t i = 1; i < MAX_VALENCE; i++)
+				Valence[i] = VALENCE_BOOST_SCALE * powf((float)i, -VALENCE_BOOST_POWER);
+		}
+	};
+
+	static float GetVertexScore(int32_t cachePosition, uint32_t liveTriangles)
+	{
+		static const VertexScoreTables sTables;
+
+		if (liveTriangles == 0)
+			return -1.0f;
+
+		float score = cachePosition < 0 ? 0.0f : sTables.Cache[cachePosition];
+		return score + sTables.Valence[(std::min)(liveTriangles, MAX_VALENCE - 1)];
+	}
+
+	void MeshOptimizer::OptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount)
+	{
+		size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0 || vertexCount == 0)
+			return;
+
+		// Runs for every rebuilt planet patch, each thread keeps its lists around
+		static thread_local std::vector<uint32_t> sLiveTriangles;
+		static thread_local std::vector<uint32_t> sAdjacencyOffsets;
+		static thread_local std::vector<uint32_t> sAdjacency;
+		static thread_local std::vector<int32_t> sCachePositions;
+		static thread_local std::vector<float> sVertexScores;
+		static thread_local std::vector<float> sTriangleScores;
+		static thread_local std::vector<uint8_t> sEmitted;
+		static thread_local std::vector<uint32_t> sOutput;
+
+		// Triangles of each vertex, the live ones are kept at the front of its range
+		sLiveTriangles.assign(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			sLiveTriangles[indices[i]]++;
+
+		sAdjacencyOffsets.resize((size_t)vertexCount + 1);
+		sAdjacencyOffsets[0] = 0;
+		for (uint32_t v = 0; v < vertexCount; v++)
+			sAdjacencyOffsets[v + 1] = sAdjacencyOffsets[v] + sLiveTriangles[v];
+
+		sAdjacency.resize(sAdjacencyOffsets[vertexCount]);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			sAdjacency[sAdjacencyOffsets[indices[i]]++] = (uint32_t)(i / 3);
+
+		// Filling moved every offset to the start of the next vertex
+		for (uint32_t v = vertexCount; v > 0; v--)
+			sAdjacencyOffsets[v] = sAdjacencyOffsets[v - 1];
+		sAdjacencyOffsets[0] = 0;
+
+		sCachePositions.assign(vertexCount, -1);
+		sVertexScores.resize(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++)
+			sVertexScores[v] = GetVertexScore(-1, sLiveTriangles[v]);
+
+		int64_t bestTriangle = -1;
+		float bestScore = -FLT_MAX;
+		sTriangleScores.resize(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			sTriangleScores[t] = sVertexScores[indices[t * 3]] + sVertexScores[indices[t * 3 + 1]] + sVertexScores[indices[t * 3 + 2]];
+			if (sTriangleScores[t] > bestScore)
+			{
+				bestScore = sTriangleScores[t];
+				bestTriangle = (int64_t)t;
+			}
+		}
+
+		sEmitted.assign(triangleCount, 0);
+		sOutput.resize(triangleCount * 3);
+
+		uint32_t cache[CACHE_SIZE + 3];
+		uint32_t newCache[CACHE_SIZE + 3];
+		uint32_t cacheCount = 0;
+		size_t inputCursor = 0;
+
+		for (size_t emitted = 0; emitted < triangleCount; emitted++)
+		{
+			// Nothing in the cache has triangles left, continue with the next one in input order
+			if (bestTriangle < 0)
+			{
+				while (sEmitted[inputCursor])
+					inputCursor++;
+
+				bestTriangle = (int64_t)inputCursor;
+			}
+
+			uint32_t triangle = (uint32_t)bestTriangle;
+			const uint32_t* corners = &indices[(size_t)triangle * 3];
+			sOutput[emitted * 3] = corners[0];
+			sOutput[emitted * 3 + 1] = corners[1];
+			sOutput[emitted * 3 + 2] = corners[2];
+			sEmitted[triangle] = 1;
+
+			// The triangle's vertices move to the front of the cache, a degenerate triangle lists one of them twice
+			uint32_t newCount = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t v = corners[k];
+
+				uint32_t* triangles = &sAdjacency[sAdjacencyOffsets[v]];
+				for (uint32_t j = 0; j < sLiveTriangles[v]; j++)
+				{
+					if (triangles[j] == triangle)
+					{
+						triangles[j] = triangles[sLiveTriangles[v] - 1];
+						sLiveTriangles[v]--;
+						break;
+					}
+				}
+
+				if (std::find(newCache, newCache + newCount, v) == newCache + newCount)
+					newCache[newCount++] = v;
+			}
+
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				uint32_t v = cache[i];
+				if (v != corners[0] && v != corners[1] && v != corners[2])
+					newCache[newCount++] = v;
+			}
+
+			// Vertices past CACHE_SIZE fell out of the cache
+			for (uint32_t i = 0; i < newCount; i++)
+			{
+				uint32_t v = newCache[i];
+				sCachePositions[v] = i < CACHE_SIZE ? (int32_t)i : -1;
+
+				float score = GetVertexScore(sCachePositions[v], sLiveTriangles[v]);
+				float delta = score - sVertexScores[v];
+				sVertexScores[v] = score;
+
+				const uint32_t* triangles = &sAdjacency[sAdjacencyOffsets[v]];
+				for (uint32_t j = 0; j < sLiveTriangles[v]; j++)
+					sTriangleScores[triangles[j]] += delta;
+			}
+
+			cacheCount = (std::min)(newCount, CACHE_SIZE);
+			std::copy(newCache, newCache + cacheCount, cache);
+
+			// Only triangles touching the cache changed score, the best of them goes next
+			bestTriangle = -1;
+			bestScore = -FLT_MAX;
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				uint32_t v = cache[i];
+				const uint32_t* triangles = &sAdjacency[sAdjacencyOffsets[v]];
+				for (uint32_t j = 0; j < sLiveTriangles[v]; j++)
+				{
+					if (sTriangleScores[triangles[j]] > bestScore)
+					{
+						bestScore = sTriangleScores[triangles[j]];
+						bestTriangle = triangles[j];
+					}
+				}
+			}
+		}
+
+		std::copy(sOutput.begin(), sOutput.end(), indices);
+	}
+
+	void MeshOptimizer::OptimizeVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount, std::vector<uint32_t>& remap)
+	{
+		remap.assign(vertexCount, UINT32_MAX);
+
+		uint32_t next = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			uint32_t& index = remap[indices[i]];
+			if (index == UINT32_MAX)
+				index = next++;
+
+			indices[i] = index;
+		}
+
+		for (uint32_t v = 0; v < vertexCount; v++)
+		{
+			if (remap[v] == UINT32_MAX)
+				remap[v] = next++;
+		}
+	}
+
+	VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+	{
+		VertexCacheStats stats;
+		stats.Triangles = (uint32_t)(indexCount / 3);
+
+		// A vertex is still cached if fewer than cacheSize misses happened since it was loaded, hits don't move it in a FIFO
+		std::vector<uint32_t> loadedAt(vertexCount, 0);
+		std::vector<uint8_t> referenced(vertexCount, 0);
+		uint32_t timestamp = cacheSize + 1;
+
+		for (size_t i = 0; i < (size_t)stats.Triangles * 3; i++)
+		{
+			uint32_t v = indices[i];
+			if (timestamp - loadedAt[v] > cacheSize)
+			{
+				loadedAt[v] = timestamp++;
+				stats.Misses++;
+			}
+
+			if (!referenced[v])
+			{
+				referenced[v] = 1;
+				stats.Vertices++;
+			}
+		}
+
+		stats.ACMR = stats.Triangles > 0 ? (double)stats.Misses / (double)stats.Triangles : 0.0;
+		stats.ATVR = stats.Vertices > 0 ? (double)stats.Misses / (double)stats.Vertices : 0.0;
+
+		return stats;
+	}
+
+}
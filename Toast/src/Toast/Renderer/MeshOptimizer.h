@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Toast {
+
+	// Post transform cache numbers of an index list, misses are counted on a FIFO cache
+	struct VertexCacheStats
+	{
+		uint32_t Triangles = 0;
+		uint32_t Vertices = 0;
+		uint32_t Misses = 0;
+		// Average cache miss ratio, transformed vertices per triangle. 0.5 is the best a large regular grid gets, 3 is no reuse at all
+		double ACMR = 0.0;
+		// Average transform to vertex ratio, 1 means every referenced vertex is transformed once
+		double ATVR = 0.0;
+	};
+
+	// Reorders triangle lists for the GPU, works on indices in [0, vertexCount). Triangles keep their winding
+	class MeshOptimizer
+	{
+	public:
+		// Size of the cache the triangle order is tuned for
+		static constexpr uint32_t CACHE_SIZE = 32;
+		// Size of the cache AnalyzeVertexCache simulates if nothing else is asked for, close to what current GPUs reuse
+		static constexpr uint32_t ANALYZE_CACHE_SIZE = 16;
+	public:
+		// Greedy triangle order after Forsyth's "Linear-Speed Vertex Cache Optimisation", triangles reusing the most recently
+		// transformed vertices go first
+		static void OptimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+		// Renumbers the vertices in the order the indices first use them so the vertex fetch walks the buffer forward.
+		// remap[old] is the new index, unreferenced vertices are moved to the end. Apply it to the vertices with RemapVertices
+		static void OptimizeVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount, std::vector<uint32_t>& remap);
+
+		template<typename T>
+		static void RemapVertices(T* vertices, uint32_t vertexCount, const std::vector<uint32_t>& remap)
+		{
+			// Called for every rebuilt planet patch, each thread keeps its copy around
+			static thread_local std::vector<T> sScratch;
+			sScratch.assign(vertices, vertices + vertexCount);
+
+			for (uint32_t i = 0; i < vertexCount; i++)
+				vertices[remap[i]] = sScratch[i];
+		}
+
+		static VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = ANALYZE_CACHE_SIZE);
+	};
+
+}
@@ -0,0 +1,209 @@
+#include "tpch.h"
+
+#include "PlanetBaseCache.h"
+
+#include "Toast/Renderer/TiledHeightmap.h"
+
+#include <fstream>
+#include <unordered_map>
+
+#define PLANET_BASE_CACHE_VERSION 1
+
+namespace Toast {
+
+	// Roots are followed by the vertices and nodes, which need 8 byte alignment
+	static uint64_t GetVerticesOffset(uint32_t rootCount)
+	{
+		return (sizeof(PlanetBaseCache::Header) + rootCount * sizeof(uint32_t) + 7) / 8 * 8;
+	}
+
+	uint64_t PlanetBaseCache::HashHeightmap(const TerrainData& terrainData, uint32_t mip)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		// FNV-1a over the texels in row order
+		uint64_t hash = 0xCBF29CE484222325ull;
+		auto add = [&hash](uint16_t texel)
+		{
+			hash = (hash ^ (texel & 0xFF)) * 0x100000001B3ull;
+			hash = (hash ^ (texel >> 8)) * 0x100000001B3ull;
+		};
+
+		if (terrainData.Tiles)
+		{
+			const TiledHeightmap& tiles = *terrainData.Tiles;
+			for (uint32_t y = 0; y < tiles.GetHeight(mip); y++)
+			{
+				for (uint32_t x = 0; x < tiles.GetWidth(mip); x++)
+					add(tiles.GetTexel(mip, x, y));
+			}
+		}
+		else
+		{
+			for (size_t y = 0; y < terrainData.Height; y++)
+			{
+				for (size_t x = 0; x < terrainData.Width; x++)
+					add(terrainData.HeightData[y * (terrainData.RowPitch / 2) + x]);
+			}
+		}
+
+		return hash;
+	}
+
+	bool PlanetBaseCache::Load(const std::string& path, const Key& key, PlanetNodePool& nodes)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		HANDLE mapping = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= (LONGLONG)sizeof(Header) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		const uint8_t* data = mapping ? reinterpret_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+
+		bool valid = data != nullptr;
+		if (valid)
+		{
+			const Header* header = reinterpret_cast<const Header*>(data);
+
+			uint64_t verticesOffset = GetVerticesOffset(header->RootCount);
+			uint64_t nodesOffset = verticesOffset + (uint64_t)header->VertexCount * sizeof(BakedVertex);
+			uint64_t size = nodesOffset + (uint64_t)header->NodeCount * sizeof(BakedNode);
+
+			valid = memcmp(header->Magic, "TBPC", 4) == 0 && header->Version == PLANET_BASE_CACHE_VERSION && header->CacheKey == key && size == (uint64_t)fileSize.QuadPart;
+			if (valid)
+			{
+				const uint32_t* roots = reinterpret_cast<const uint32_t*>(data + sizeof(Header));
+				const BakedVertex* vertices = reinterpret_cast<const BakedVertex*>(data + verticesOffset);
+				const BakedNode* bakedNodes = reinterpret_cast<const BakedNode*>(data + nodesOffset);
+
+				nodes.Reset();
+				nodes.Reserve(header->NodeCount);
+				nodes.Allocate(header->NodeCount);
+
+				// A file of the right size can still be broken, every index is checked before it's followed
+				for (uint32_t i = 0; i < header->NodeCount; i++)
+				{
+					const BakedNode& bakedNode = bakedNodes[i];
+					PlanetNode& node = nodes[i];
+
+					valid = (bakedNode.ChildCount == 0 || (uint64_t)bakedNode.FirstChild + bakedNode.ChildCount <= header->NodeCount)
+						&& bakedNode.Vertices[0] < header->VertexCount && bakedNode.Vertices[1] < header->VertexCount && bakedNode.Vertices[2] < header->VertexCount;
+					if (!valid)
+						break;
+
+					CPUVertex* corners[3] = { &node.A, &node.B, &node.C };
+					for (int j = 0; j < 3; j++)
+					{
+
+						const BakedVertex& vertex = vertices[bakedNode.Vertices[j]];
+						corners[j]->Position = Vector3(vertex.Position[0], vertex.Position[1], vertex.Position[2]);
+						corners[j]->UV.x = vertex.UV[0];
+						corners[j]->UV.y = vertex.UV[1];
+						corners[j]->Id = vertex.Id;
+					}
+
+					node.FirstChild = bakedNode.FirstChild;
+					node.ChildCount = bakedNode.ChildCount;
+					node.SubdivisionLevel = bakedNode.SubdivisionLevel;
+					node.NodeBounds.mins = Vector3(bakedNode.BoundsMin[0], bakedNode.BoundsMin[1], bakedNode.BoundsMin[2]);
+					node.NodeBounds.maxs = Vector3(bakedNode.BoundsMax[0], bakedNode.BoundsMax[1], bakedNode.BoundsMax[2]);
+				}
+
+				for (uint32_t i = 0; i < header->RootCount && valid; i++)
+					valid = roots[i] < header->NodeCount;
+
+				if (valid)
+					nodes.Roots.assign(roots, roots + header->RootCount);
+				else
+				{
+					TOAST_CORE_WARN("Base planet cache %s is broken, it's built again", path.c_str());
+					nodes.Reset();
+				}
+			}
+		}
+
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+
+		return valid;
+	}
+
+	bool PlanetBaseCache::Save(const std::string& path, const Key& key, const PlanetNodePool& nodes)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		Header header;
+		memcpy(header.Magic, "TBPC", 4);
+		header.Version = PLANET_BASE_CACHE_VERSION;
+		header.CacheKey = key;
+		header.RootCount = (uint32_t)nodes.Roots.size();
+		header.VertexCount = 0;
+		header.NodeCount = nodes.Size();
+		header.Padding = 0;
+
+		std::vector<BakedVertex> vertices;
+		std::vector<BakedNode> bakedNodes(nodes.Size());
+		std::unordered_map<uint64_t, uint32_t> vertexIndices;
+		vertexIndices.reserve(nodes.Size());
+
+		for (uint32_t i = 0; i < nodes.Size(); i++)
+		{
+			const PlanetNode& node = nodes[i];
+			BakedNode& bakedNode = bakedNodes[i];
+
+			const CPUVertex* corners[3] = { &node.A, &node.B, &node.C };
+			for (int j = 0; j < 3; j++)
+			{
+				auto [it, inserted] = vertexIndices.try_emplace(corners[j]->Id, (uint32_t)vertices.size());
+				if (inserted)
+				{
+					const CPUVertex& corner = *corners[j];
+					vertices.push_back({ { corner.Position.x, corner.Position.y, corner.Position.z }, { corner.UV.x, corner.UV.y }, corner.Id });
+				}
+
+				bakedNode.Vertices[j] = it->second;
+			}
+
+			bakedNode.FirstChild = node.FirstChild;
+			bakedNode.ChildCount = node.ChildCount;
+			bakedNode.SubdivisionLevel = node.SubdivisionLevel;
+			bakedNode.Padding = 0;
+			bakedNode.BoundsMin[0] = node.NodeBounds.mins.x;
+			bakedNode.BoundsMin[1] = node.NodeBounds.mins.y;
+			bakedNode.BoundsMin[2] = node.NodeBounds.mins.z;
+			bakedNode.BoundsMax[0] = node.NodeBounds.maxs.x;
+			bakedNode.BoundsMax[1] = node.NodeBounds.maxs.y;
+			bakedNode.BoundsMax[2] = node.NodeBounds.maxs.z;
+		}
+
+		header.VertexCount = (uint32_t)vertices.size();
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			TOAST_CORE_WARN("Unable to create base planet cache %s", path.c_str());
+			return false;
+		}
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		file.write(reinterpret_cast<const char*>(nodes.Roots.data()), (std::streamsize)(nodes.Roots.size() * sizeof(uint32_t)));
+
+		file.seekp((std::streamoff)GetVerticesOffset(header.RootCount));
+		file.write(reinterpret_cast<const char*>(vertices.data()), (std::streamsize)(vertices.size() * sizeof(BakedVertex)));
+		file.write(reinterpret_cast<const char*>(bakedNodes.data()), (std::streamsize)(bakedNodes.size() * sizeof(BakedNode)));
+
+		if (!file)
+		{
+			TOAST_CORE_WARN("Failed writing base planet cache %s", path.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Toast/Renderer/Mesh.h"
+#include "Toast/Renderer/PlanetNode.h"
+
+#include <string>
+
+namespace Toast {
+
+	// Baked base planet tree stored next to the height map, so loading a scene doesn't subdivide and sample the whole
+	// tree again. The file is memory mapped and copied straight into the node pool
+	class PlanetBaseCache
+	{
+	public:
+		// Everything the baked tree depends on, a file with another key is rebuilt
+		struct Key
+		{
+			uint64_t HeightmapHash = 0;
+			uint64_t Width = 0;
+			uint64_t Height = 0;
+			double Radius = 0.0;
+			double HeightScale = 0.0;
+			double HeightOffset = 0.0;
+			uint32_t Subdivisions = 0;
+			uint32_t Padding = 0;
+
+			bool operator==(const Key& other) const
+			{
+				return HeightmapHash == other.HeightmapHash && Width == other.Width && Height == other.Height && Radius == other.Radius
+					&& HeightScale == other.HeightScale && HeightOffset == other.HeightOffset && Subdivisions == other.Subdivisions;
+			}
+		};
+
+		struct Header
+		{
+			char Magic[4];
+			uint32_t Version;
+			Key CacheKey;
+			uint32_t RootCount;
+			uint32_t VertexCount;
+			uint32_t NodeCount;
+			uint32_t Padding;
+		};
+
+		// Corners are shared between the nodes that use them
+		struct BakedVertex
+		{
+			double Position[3];
+			double UV[2];
+			uint64_t Id;
+		};
+
+		struct BakedNode
+		{
+			uint32_t Vertices[3];
+			uint32_t FirstChild;
+			uint16_t ChildCount;
+			int16_t SubdivisionLevel;
+			uint32_t Padding;
+			double BoundsMin[3];
+			double BoundsMax[3];
+		};
+	public:
+		static std::string GetCachePath(const std::string& heightmapPath) { return heightmapPath + ".planet"; }
+
+		// Hash of every texel of the mip, the base planet doesn't sample anything finer
+		static uint64_t HashHeightmap(const TerrainData& terrainData, uint32_t mip);
+
+		// False if the file is missing, was baked with another key or has indices out of range. nodes is left untouched
+		// in the first two cases and empty in the last
+		static bool Load(const std::string& path, const Key& key, PlanetNodePool& nodes);
+		static bool Save(const std::string& path, const Key& key, const PlanetNodePool& nodes);
+	};
+
+}
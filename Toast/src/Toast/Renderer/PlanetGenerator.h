@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Toast/Core/Math/Math.h"
+
+#include "Toast/Renderer/PlanetMidpointCache.h"
+#include "Toast/Renderer/PlanetNode.h"
+#include "Toast/Renderer/PlanetPatchCache.h"
+
+#include "Toast/Scene/Components.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
+namespace Toast {
+
+	// A base tree subtree traversed by one worker
+	struct PlanetTraversalJob
+	{
+		uint32_t BaseNode;
+	};
+
+	// Everything the patches depend on besides the camera position. The patches are in planet space so moving the
+	// planet keeps them
+	struct PlanetPatchSettings
+	{
+		// Not compared, a different LOD only changes split decisions so the patches are re-evaluated instead of dropped
+		double LODErrorScale = 0.0;
+		int16_t Subdivisions = 0;
+		bool SmoothShading = false;
+		bool AnalyticNormals = false;
+		double Radius = 0.0;
+		bool HasTerrainDetail = false;
+		TerrainDetailComponent TerrainDetail;
+
+		bool operator==(const PlanetPatchSettings& other) const;
+	};
+
+	// Generation state of one planet, owned by its PlanetComponent so several planets can be generated at the same time.
+	// Only PlanetSystem works with it
+	class PlanetGenerator
+	{
+	public:
+		PlanetGenerator() = default;
+		PlanetGenerator(const PlanetGenerator&) = delete;
+		PlanetGenerator& operator=(const PlanetGenerator&) = delete;
+	public:
+		std::mutex PlanetDataMutex;
+		std::mutex TerrainCollidersMutex;
+		std::future<void> GenerationFuture;
+		std::atomic<bool> NewPlanetReady{ false };
+		std::atomic<bool> PlanetGenerationOngoing{ false };
+		std::atomic<bool> GenerationCancelled{ false };
+		// The look-ahead pass runs after the build is handed over and is cancelled on its own, see GeneratePlanet
+		std::atomic<bool> PrefetchOngoing{ false };
+		std::atomic<bool> PrefetchCancelled{ false };
+		// Set by the generation job when it dropped its build, read once its future is ready
+		bool LastBuildCancelled = false;
+
+		PlanetNodePool BasePlanetNodes;
+
+		std::vector<PlanetTraversalJob> TraversalJobs;
+		PlanetPatchCache PatchCache;
+		PlanetMidpointCache MidpointCache;
+		PlanetPatchSettings PatchSettings;
+		std::vector<PlanetBuildOutput> JobOutputs;
+
+		// Patches of the fixed LOD distant planets are drawn with, keyed by their base node at PLANET_JOB_SUBDIVISION.
+		// Built for the current PatchSettings
+		std::unordered_map<uint32_t, Ref<PlanetPatchGeometry>> FixedLODPatches;
+
+		// Camera of the build in flight in planet space, and how many builds in a row were cancelled before it
+		Vector3 GenerationCameraPos;
+		uint32_t GenerationRestarts = 0;
+
+		// Patch roots around the predicted camera position, nearest first, split after the visible patches are done
+		std::vector<uint32_t> PrefetchPatches;
+		// Planet space camera of the previous RegeneratePlanet call, for the velocity of cameras without a rigid body
+		Vector3 LastCameraPos;
+		Vector3 CameraVelocity;
+		std::chrono::steady_clock::time_point LastCameraTime;
+	};
+
+}
@@ -0,0 +1,80 @@
+#include "tpch.h"
+
+#include "PlanetMidpointCache.h"
+
+namespace Toast {
+
+	uint64_t PlanetMidpointCache::GetMidpointId(uint64_t a, uint64_t b)
+	{
+		if (a > b)
+			std::swap(a, b);
+
+		// splitmix64 finalizer over both ids
+		uint64_t x = a * 0x9E3779B97F4A7C15ull ^ (b + 0x632BE59BD9B4E019ull + (a << 6) + (a >> 2));
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		x = x ^ (x >> 31);
+
+		// 0 is never used as an id so it can mean "no id"
+		return x ? x : 1;
+	}
+
+	bool PlanetMidpointCache::Find(uint64_t a, uint64_t b, CPUVertex& midpoint)
+	{
+		EdgeKey key = MakeKey(a, b);
+		Shard& shard = GetShard(key);
+
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+
+		auto it = shard.Current.find(key);
+		if (it == shard.Current.end())
+		{
+			auto previous = shard.Previous.find(key);
+			if (previous == shard.Previous.end())
+			{
+				mMisses.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			// Still in use, moved into the current generation so it survives the next rollover
+			it = shard.Current.emplace(key, previous->second).first;
+			shard.Previous.erase(previous);
+		}
+
+		midpoint.Position = it->second.Position;
+		midpoint.UV = it->second.UV;
+		midpoint.Id = GetMidpointId(a, b);
+
+		mHits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	void PlanetMidpointCache::Insert(uint64_t a, uint64_t b, const CPUVertex& midpoint)
+	{
+		EdgeKey key = MakeKey(a, b);
+		Shard& shard = GetShard(key);
+
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+
+		if (shard.Current.size() >= PLANET_MIDPOINT_CACHE_CAPACITY / PLANET_MIDPOINT_CACHE_SHARDS)
+		{
+			shard.Previous = std::move(shard.Current);
+			shard.Current.clear();
+		}
+
+		shard.Current.emplace(key, Midpoint{ midpoint.Position, midpoint.UV });
+	}
+
+	void PlanetMidpointCache::Clear()
+	{
+		for (auto& shard : mShards)
+		{
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+			shard.Current.clear();
+			shard.Previous.clear();
+		}
+
+		ResetCounters();
+	}
+
+}
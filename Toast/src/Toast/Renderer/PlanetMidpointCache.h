@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Toast/Renderer/PlanetNode.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#define PLANET_MIDPOINT_CACHE_SHARDS 64
+// Entries kept per generation of the cache, a shard starts a new generation when it's full and drops the one before
+#define PLANET_MIDPOINT_CACHE_CAPACITY (1 << 19)
+
+namespace Toast {
+
+	// Displaced edge midpoints keyed by the ids of the two edge vertices, shared by all traversal jobs and kept between
+	// generations so an edge is only displaced once no matter how many faces or frames split it
+	class PlanetMidpointCache
+	{
+	public:
+		PlanetMidpointCache() = default;
+
+		// Stable id of the midpoint between two vertices, independent of the order they're given in
+		static uint64_t GetMidpointId(uint64_t a, uint64_t b);
+
+		// Safe to call from several threads
+		bool Find(uint64_t a, uint64_t b, CPUVertex& midpoint);
+		void Insert(uint64_t a, uint64_t b, const CPUVertex& midpoint);
+
+		void Clear();
+
+		uint64_t GetHits() const { return mHits.load(std::memory_order_relaxed); }
+		uint64_t GetMisses() const { return mMisses.load(std::memory_order_relaxed); }
+		void ResetCounters() { mHits = 0; mMisses = 0; }
+	private:
+		struct EdgeKey
+		{
+			uint64_t A, B;
+
+			bool operator==(const EdgeKey& other) const { return A == other.A && B == other.B; }
+		};
+
+		struct EdgeKeyHasher
+		{
+			size_t operator()(const EdgeKey& key) const { return (size_t)GetMidpointId(key.A, key.B); }
+		};
+
+		struct Midpoint
+		{
+			Vector3 Position;
+			Vector2 UV;
+		};
+
+		struct Shard
+		{
+			std::mutex Mutex;
+			std::unordered_map<EdgeKey, Midpoint, EdgeKeyHasher> Current;
+			std::unordered_map<EdgeKey, Midpoint, EdgeKeyHasher> Previous;
+		};
+
+		static EdgeKey MakeKey(uint64_t a, uint64_t b) { return a < b ? EdgeKey{ a, b } : EdgeKey{ b, a }; }
+		// High bits pick the shard, the maps inside the shard bucket on the low bits
+		Shard& GetShard(const EdgeKey& key) { return mShards[(GetMidpointId(key.A, key.B) >> 32) % PLANET_MIDPOINT_CACHE_SHARDS]; }
+	private:
+		Shard mShards[PLANET_MIDPOINT_CACHE_SHARDS];
+
+		std::atomic<uint64_t> mHits{ 0 };
+		std::atomic<uint64_t> mMisses{ 0 };
+	};
+
+}
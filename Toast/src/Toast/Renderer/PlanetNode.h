@@ -0,0 +1,209 @@
+#pragma once
+
+#include "Toast/Core/Math/Math.h"
+
+#include "Toast/Physics/Bounds.h"
+
+#include <vector>
+
+#define PLANET_NODE_NONE UINT32_MAX
+
+namespace Toast {
+
+	struct CPUVertex
+	{
+		Vector3 Position;
+		Vector3 Normal;
+		Vector2 UV;
+		// Stable across generations, base planet corners are numbered and every midpoint gets PlanetMidpointCache::GetMidpointId
+		uint64_t Id = 0;
+
+		CPUVertex() = default;
+		CPUVertex(const Vector3& position, const Vector3& normal, const Vector2& uv)
+			: Position(position), Normal(normal), UV(uv) {}
+		CPUVertex(Vector3 pos)
+			: Position(pos) {}
+
+		// Copy constructor
+		CPUVertex(const CPUVertex& other)
+			: Position(other.Position), Normal(other.Normal), UV(other.UV), Id(other.Id) {}
+
+		// Optional: Assignment operator
+		CPUVertex& operator=(const CPUVertex& other)
+		{
+			if (this != &other) // Check for self-assignment
+			{
+				Position = other.Position;
+				Normal = other.Normal;
+				UV = other.UV;
+				Id = other.Id;
+			}
+			return *this;
+		}
+	};
+
+	// Nodes live in a PlanetNodePool, children are stored next to each other and referenced by the index of the first one
+	struct PlanetNode
+	{
+		CPUVertex A, B, C;  // The three vertices of the triangle
+		uint32_t FirstChild = PLANET_NODE_NONE;
+		uint16_t ChildCount = 0;
+		int16_t SubdivisionLevel = 0;
+		Bounds NodeBounds;
+
+		PlanetNode() = default;
+		PlanetNode(const CPUVertex& v0, const CPUVertex& v1, const CPUVertex& v2, const int16_t level, Matrix transform = Matrix::Identity())
+		{
+			A = v0;
+			B = v1;
+			C = v2;
+
+			A.Position = transform * A.Position;
+			B.Position = transform * B.Position;
+			C.Position = transform * C.Position;
+
+			SubdivisionLevel = level;
+
+			ComputeBoundsFromTriangle();
+		}
+
+		bool IsLeaf() const { return ChildCount == 0; }
+
+		void ComputeBoundsFromTriangle()
+		{
+			NodeBounds.mins = {
+				(std::min)({A.Position.x, B.Position.x, C.Position.x}),
+				(std::min)({A.Position.y, B.Position.y, C.Position.y}),
+				(std::min)({A.Position.z, B.Position.z, C.Position.z})
+			};
+			NodeBounds.maxs = {
+				(std::max)({A.Position.x, B.Position.x, C.Position.x}),
+				(std::max)({A.Position.y, B.Position.y, C.Position.y}),
+				(std::max)({A.Position.z, B.Position.z, C.Position.z})
+			};
+		}
+	};
+
+	// Contiguous node storage, Reset() only rewinds the cursor so the memory is reused by the next build
+	class PlanetNodePool
+	{
+	public:
+		PlanetNodePool() = default;
+
+		// Returns the index of the first of count adjacent nodes, references into the pool are invalid after this call
+		uint32_t Allocate(uint32_t count)
+		{
+			uint32_t first = mCursor;
+			mCursor += count;
+
+			if (mCursor > mNodes.size())
+				mNodes.resize((std::max)((size_t)mCursor, mNodes.size() * 2));
+
+			for (uint32_t i = first; i < mCursor; i++)
+				mNodes[i] = PlanetNode();
+
+			return first;
+		}
+
+		// Allocates count children for the node and returns the index of the first one
+		uint32_t AllocateChildren(uint32_t parent, uint32_t count)
+		{
+			uint32_t first;
+			if (count == 4 && !mFreeBlocks.empty())
+			{
+				first = mFreeBlocks.back();
+				mFreeBlocks.pop_back();
+
+				for (uint32_t i = first; i < first + count; i++)
+					mNodes[i] = PlanetNode();
+			}
+			else
+				first = Allocate(count);
+
+			mNodes[parent].FirstChild = first;
+			mNodes[parent].ChildCount = (uint16_t)count;
+
+			return first;
+		}
+
+		// Appends all nodes of the other pool, returns the offset that was added to its indices
+		uint32_t Append(const PlanetNodePool& other)
+		{
+			uint32_t offset = Allocate(other.mCursor);
+			for (uint32_t i = 0; i < other.mCursor; i++)
+			{
+				PlanetNode& node = mNodes[offset + i];
+				node = other.mNodes[i];
+				if (node.FirstChild != PLANET_NODE_NONE)
+					node.FirstChild += offset;
+			}
+
+			for (uint32_t root : other.Roots)
+				Roots.emplace_back(root + offset);
+
+			return offset;
+		}
+
+		// Gives the children of the node and everything below them back to the pool, blocks of four are reused by AllocateChildren
+		void FreeChildren(uint32_t parent)
+		{
+			uint32_t first = mNodes[parent].FirstChild;
+			uint32_t count = mNodes[parent].ChildCount;
+
+			mNodes[parent].FirstChild = PLANET_NODE_NONE;
+			mNodes[parent].ChildCount = 0;
+
+			for (uint32_t i = first; i < first + count; i++)
+				FreeChildren(i);
+
+			if (count == 4)
+				mFreeBlocks.emplace_back(first);
+		}
+
+		void Reserve(size_t count) { if (count > mNodes.size()) mNodes.resize(count); }
+		void Reset() { mCursor = 0; Roots.clear(); mFreeBlocks.clear(); }
+
+		void UpdateBoundsFromChildren(uint32_t index)
+		{
+			PlanetNode& node = mNodes[index];
+
+			// If no children, bounds are already computed from the triangle
+			if (node.IsLeaf()) return;
+
+			// Start with a large inverted bounding box
+			Bounds childBounds;
+			childBounds.mins = { DBL_MAX, DBL_MAX, DBL_MAX };
+			childBounds.maxs = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+
+			for (uint32_t i = node.FirstChild; i < node.FirstChild + node.ChildCount; i++)
+			{
+				const Bounds& bounds = mNodes[i].NodeBounds;
+
+				childBounds.mins.x = (std::min)(childBounds.mins.x, bounds.mins.x);
+				childBounds.mins.y = (std::min)(childBounds.mins.y, bounds.mins.y);
+				childBounds.mins.z = (std::min)(childBounds.mins.z, bounds.mins.z);
+
+				childBounds.maxs.x = (std::max)(childBounds.maxs.x, bounds.maxs.x);
+				childBounds.maxs.y = (std::max)(childBounds.maxs.y, bounds.maxs.y);
+				childBounds.maxs.z = (std::max)(childBounds.maxs.z, bounds.maxs.z);
+			}
+
+			node.NodeBounds = childBounds;
+		}
+
+		PlanetNode& operator[](uint32_t index) { return mNodes[index]; }
+		const PlanetNode& operator[](uint32_t index) const { return mNodes[index]; }
+
+		uint32_t Size() const { return mCursor; }
+		bool Empty() const { return mCursor == 0; }
+
+	public:
+		std::vector<uint32_t> Roots;
+
+	private:
+		std::vector<PlanetNode> mNodes;
+		std::vector<uint32_t> mFreeBlocks;
+		uint32_t mCursor = 0;
+	};
+
+}
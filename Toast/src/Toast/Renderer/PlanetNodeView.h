@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Toast/Renderer/PlanetNode.h"
+#include "Toast/Renderer/PlanetPatchCache.h"
+
+namespace Toast {
+
+	// What physics sees of the last applied build: the base planet tree with the visible patch trees below its leaves,
+	// all in planet space. Queries are moved into planet space once instead of copying the nodes into world space
+	class PlanetNodeView
+	{
+	public:
+		// baseNodes is nullptr for planets that were never generated
+		PlanetNodeView(const PlanetNodePool* baseNodes, const PlanetMeshLayout& layout, const Matrix& planetTransform)
+			: mBaseNodes(baseNodes), mLayout(&layout), mTransform(planetTransform), mInverseTransform(Matrix::Inverse(planetTransform)) {}
+
+		const PlanetNodePool& GetBaseNodes() const { return *mBaseNodes; }
+		// Nothing to collide with until the first build is applied
+		bool Empty() const { return !mBaseNodes || mLayout->GetVertexCount() == 0; }
+
+		// Base tree leaves are patch roots, a visible patch continues at the root of its own tree. Its bounds include
+		// the terrain below the base triangle
+		const PlanetNodePool& Resolve(const PlanetNodePool& nodes, uint32_t& nodeIndex) const
+		{
+			if (&nodes != mBaseNodes || !nodes[nodeIndex].IsLeaf())
+				return nodes;
+
+			const PlanetPatchGeometry* patch = mLayout->Find(nodeIndex);
+			if (!patch || patch->Nodes.Empty())
+				return nodes;
+
+			nodeIndex = 0;
+			return patch->Nodes;
+		}
+
+		Vector3 ToPlanetSpace(const Vector3& position) const
+		{
+			Matrix inverse = mInverseTransform;
+			return inverse * position;
+		}
+
+		Vector3 ToPlanetSpaceDirection(const Vector3& direction) const
+		{
+			Matrix inverse = mInverseTransform;
+			return Vector3::Normalize(inverse * direction - inverse * Vector3(0.0, 0.0, 0.0));
+		}
+
+		// Box around the transformed corners
+		Bounds ToPlanetSpace(const Bounds& bounds) const
+		{
+			Bounds planetBounds;
+			for (int i = 0; i < 8; i++)
+			{
+				Vector3 corner = ToPlanetSpace(Vector3(i & 1 ? bounds.maxs.x : bounds.mins.x, i & 2 ? bounds.maxs.y : bounds.mins.y, i & 4 ? bounds.maxs.z : bounds.mins.z));
+				if (i == 0)
+					planetBounds.mins = planetBounds.maxs = corner;
+				else
+					planetBounds.Expand(corner);
+			}
+
+			return planetBounds;
+		}
+
+		Vector3 ToWorldSpace(const Vector3& position) const
+		{
+			Matrix transform = mTransform;
+			return transform * position;
+		}
+
+		// Leaves that reach the narrow phase are the only nodes ever transformed
+		PlanetNode ToWorldSpace(const PlanetNode& node) const
+		{
+			return PlanetNode(node.A, node.B, node.C, node.SubdivisionLevel, mTransform);
+		}
+	private:
+		const PlanetNodePool* mBaseNodes;
+		const PlanetMeshLayout* mLayout;
+		Matrix mTransform;
+		Matrix mInverseTransform;
+	};
+
+}
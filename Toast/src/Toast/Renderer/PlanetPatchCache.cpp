@@ -0,0 +1,289 @@
+#include "tpch.h"
+
+#include "PlanetPatchCache.h"
+
+// Once the buffers have more holes than this on top of the live geometry they're packed again
+#define PLANET_LAYOUT_COMPACT_SLACK 65536
+
+namespace Toast {
+
+	void PlanetPatchCache::Reset(size_t keyCount)
+	{
+		mPatches.clear();
+		mPatches.resize(keyCount);
+		mResident.clear();
+	}
+
+	void PlanetPatchCache::Clear()
+	{
+		for (auto& patch : mPatches)
+			patch.reset();
+
+		mResident.clear();
+	}
+
+	void PlanetPatchCache::Invalidate()
+	{
+		for (auto& patch : mPatches)
+		{
+			if (patch)
+				patch->StableDistance = -1.0;
+		}
+	}
+
+	PlanetPatch& PlanetPatchCache::Acquire(uint32_t key)
+	{
+		Scope<PlanetPatch>& patch = mPatches[key];
+		if (!patch)
+			patch = CreateScope<PlanetPatch>();
+
+		patch->LastUsed = mGeneration;
+
+		return *patch;
+	}
+
+	void PlanetPatchCache::BeginGeneration()
+	{
+		mGeneration++;
+	}
+
+	void PlanetPatchCache::EndGeneration(const std::vector<Ref<PlanetPatchGeometry>>& usedPatches, uint32_t patchesRebuilt)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		for (auto& geometry : usedPatches)
+		{
+			// Fixed LOD geometry of distant planets isn't cached here
+			if (!mPatches[geometry->Key] || mPatches[geometry->Key]->Geometry != geometry)
+				continue;
+
+			PlanetPatch& patch = *mPatches[geometry->Key];
+			if (!patch.Resident)
+			{
+				patch.Resident = true;
+				mResident.emplace_back(geometry->Key);
+			}
+		}
+
+		uint32_t evicted = 0;
+		if (mResident.size() > mCapacity)
+		{
+			size_t excess = mResident.size() - mCapacity;
+
+			// Moves the least recently used patches to the front
+			std::nth_element(mResident.begin(), mResident.begin() + excess, mResident.end(), [&](uint32_t a, uint32_t b) { return mPatches[a]->LastUsed < mPatches[b]->LastUsed; });
+
+			// Patches used this generation are kept even if that means going above the capacity
+			size_t kept = 0;
+			for (size_t i = 0; i < excess; i++)
+			{
+				uint32_t key = mResident[i];
+				if (mPatches[key]->LastUsed == mGeneration)
+					mResident[kept++] = key;
+				else
+				{
+					mPatches[key].reset();
+					evicted++;
+				}
+			}
+
+			mResident.erase(mResident.begin() + kept, mResident.begin() + excess);
+		}
+
+		mStats.PatchesVisible = (uint32_t)usedPatches.size();
+		mStats.PatchesRebuilt = patchesRebuilt;
+		mStats.PatchesEvicted = evicted;
+		mStats.PatchesCached = (uint32_t)mResident.size();
+	}
+
+	bool PlanetMeshLayout::Update(const std::vector<Ref<PlanetPatchGeometry>>& patches, std::vector<PlanetVertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		mDirtyVertices.clear();
+		mDirtyIndices.clear();
+		mPatchesPlaced = 0;
+
+		for (auto& [key, entry] : mEntries)
+			entry.Seen = false;
+
+		// Patches that didn't change keep their ranges
+		for (auto& geometry : patches)
+		{
+			auto it = mEntries.find(geometry->Key);
+			if (it != mEntries.end() && it->second.Geometry == geometry)
+				it->second.Seen = true;
+		}
+
+		// Ranges of patches that are gone or changed are given back, their triangles are made degenerate so they don't draw anything
+		for (auto it = mEntries.begin(); it != mEntries.end();)
+		{
+			Entry& entry = it->second;
+			if (entry.Seen)
+			{
+				++it;
+				continue;
+			}
+
+			std::fill(indices.begin() + entry.Indices.Offset, indices.begin() + entry.Indices.Offset + entry.Indices.Count, 0u);
+			mDirtyIndices.emplace_back(entry.Indices);
+
+			Free(mFreeVertices, mVertexHighWater, entry.Vertices);
+			Free(mFreeIndices, mIndexHighWater, entry.Indices);
+
+			mLiveVertices -= entry.Vertices.Count;
+			mLiveIndices -= entry.Indices.Count;
+
+			mFreeFrames.push_back(entry.Frame);
+
+			it = mEntries.erase(it);
+		}
+
+		bool fullUpload = false;
+
+		// Too many holes, everything is placed again from the start
+		if (mVertexHighWater > 2 * mLiveVertices + PLANET_LAYOUT_COMPACT_SLACK || mIndexHighWater > 2 * mLiveIndices + PLANET_LAYOUT_COMPACT_SLACK)
+		{
+			Clear();
+			fullUpload = true;
+		}
+
+		for (auto& geometry : patches)
+		{
+			if (mEntries.find(geometry->Key) != mEntries.end())
+				continue;
+
+			Place(geometry);
+
+			// The buffers have to be recreated when they grow
+			if (mVertexHighWater > vertices.size())
+			{
+				vertices.resize((std::max)((size_t)mVertexHighWater, vertices.size() * 3 / 2));
+				fullUpload = true;
+			}
+			if (mIndexHighWater > indices.size())
+			{
+				indices.resize((std::max)((size_t)mIndexHighWater, indices.size() * 3 / 2), 0u);
+				fullUpload = true;
+			}
+
+			const Entry& entry = mEntries[geometry->Key];
+			for (uint32_t i = 0; i < entry.Vertices.Count; i++)
+			{
+				PlanetVertex& vertex = vertices[entry.Vertices.Offset + i];
+				vertex = geometry->Vertices[i];
+				vertex.Frame = entry.Frame;
+			}
+			for (uint32_t i = 0; i < entry.Indices.Count; i++)
+				indices[entry.Indices.Offset + i] = entry.Vertices.Offset + geometry->Indices[i];
+
+			mDirtyVertices.emplace_back(entry.Vertices);
+			mDirtyIndices.emplace_back(entry.Indices);
+		}
+
+		if (fullUpload)
+		{
+			std::fill(indices.begin() + mIndexHighWater, indices.end(), 0u);
+
+			mDirtyVertices.clear();
+			mDirtyIndices.clear();
+		}
+
+		return fullUpload;
+	}
+
+	void PlanetMeshLayout::Clear()
+	{
+		mEntries.clear();
+		mFreeVertices.clear();
+		mFreeIndices.clear();
+		mVertexHighWater = mIndexHighWater = 0;
+		mLiveVertices = mLiveIndices = 0;
+		mFrames.clear();
+		mFreeFrames.clear();
+	}
+
+	void PlanetMeshLayout::Place(const Ref<PlanetPatchGeometry>& geometry)
+	{
+		Entry& entry = mEntries[geometry->Key];
+		entry.Geometry = geometry;
+		entry.Vertices = Allocate(mFreeVertices, mVertexHighWater, (uint32_t)geometry->Vertices.size());
+		entry.Indices = Allocate(mFreeIndices, mIndexHighWater, (uint32_t)geometry->Indices.size());
+		entry.Seen = true;
+
+		if (!mFreeFrames.empty())
+		{
+			entry.Frame = mFreeFrames.back();
+			mFreeFrames.pop_back();
+		}
+		else
+		{
+			entry.Frame = (uint32_t)mFrames.size();
+			mFrames.emplace_back();
+		}
+		mFrames[entry.Frame] = geometry->Frame;
+
+		mLiveVertices += entry.Vertices.Count;
+		mLiveIndices += entry.Indices.Count;
+		mPatchesPlaced++;
+	}
+
+	PlanetMeshLayout::Range PlanetMeshLayout::Allocate(std::vector<Range>& freeRanges, uint32_t& highWater, uint32_t count)
+	{
+		Range range;
+		range.Count = count;
+
+		if (count == 0)
+			return range;
+
+		// First fit, the free ranges are sorted by offset
+		for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it)
+		{
+			if (it->Count >= count)
+			{
+				range.Offset = it->Offset;
+
+				it->Offset += count;
+				it->Count -= count;
+				if (it->Count == 0)
+					freeRanges.erase(it);
+
+				return range;
+			}
+		}
+
+		range.Offset = highWater;
+		highWater += count;
+
+		return range;
+	}
+
+	void PlanetMeshLayout::Free(std::vector<Range>& freeRanges, uint32_t& highWater, Range range)
+	{
+		if (range.Count == 0)
+			return;
+
+		auto it = std::lower_bound(freeRanges.begin(), freeRanges.end(), range.Offset, [](const Range& r, uint32_t offset) { return r.Offset < offset; });
+		it = freeRanges.insert(it, range);
+
+		// Merge with the neighbours
+		if (it + 1 != freeRanges.end() && it->Offset + it->Count == (it + 1)->Offset)
+		{
+			it->Count += (it + 1)->Count;
+			freeRanges.erase(it + 1);
+		}
+		if (it != freeRanges.begin() && (it - 1)->Offset + (it - 1)->Count == it->Offset)
+		{
+			(it - 1)->Count += it->Count;
+			freeRanges.erase(it);
+		}
+
+		// A free range at the end just lowers the high water mark
+		if (!freeRanges.empty() && freeRanges.back().Offset + freeRanges.back().Count == highWater)
+		{
+			highWater = freeRanges.back().Offset;
+			freeRanges.pop_back();
+		}
+	}
+
+}
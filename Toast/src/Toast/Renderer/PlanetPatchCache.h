@@ -0,0 +1,181 @@
+#pragma once
+
+#include "Toast/Renderer/Mesh.h"
+#include "Toast/Renderer/PlanetNode.h"
+#include "Toast/Renderer/PlanetVertex.h"
+#include "Toast/Renderer/PlanetVertexMap.h"
+
+#include <unordered_map>
+
+#define PLANET_PATCH_CACHE_CAPACITY 8192
+
+namespace Toast {
+
+	// CPU geometry of one patch, never changed after it's built so the render thread can upload it while the next generation runs
+	struct PlanetPatchGeometry
+	{
+		uint32_t Key = 0;
+		uint64_t Version = 0;
+
+		// Quantized in Frame, planet space like the nodes
+		std::vector<PlanetVertex> Vertices;
+		std::vector<uint32_t> Indices;
+		PlanetVertexFrame Frame;
+
+		// Planet space copy of the patch tree for physics, node 0 is the base node
+		PlanetNodePool Nodes;
+	};
+
+	// Patches visited by one traversal job, or a whole generation once the jobs are merged. The PlanetComponent keeps one
+	// as its back buffer, filled by the generation job and swapped in by the render thread
+	struct PlanetBuildOutput
+	{
+		std::vector<Ref<PlanetPatchGeometry>> Patches;
+		uint32_t PatchesRebuilt = 0;
+		// Triangle budget scale the generation was started with
+		double LODBudgetScale = 1.0;
+
+		void Clear()
+		{
+			Patches.clear();
+			PatchesRebuilt = 0;
+		}
+	};
+
+	// Persistent LOD tree below one base planet node at BASE_PLANET_SUBDIVISIONS, kept between generations
+	struct PlanetPatch
+	{
+		// Planet space, node 0 is the base node
+		PlanetNodePool Nodes;
+
+		Ref<PlanetPatchGeometry> Geometry;
+		PlanetVertexMap VertexMap;
+
+		// How far the camera can move away from CameraPos before a split, merge or crack decision in the patch changes
+		Vector3 CameraPos;
+		double StableDistance = -1.0;
+
+		uint64_t LastUsed = 0;
+		bool Resident = false;
+	};
+
+	struct PlanetPatchStats
+	{
+		// Last generation
+		uint32_t PatchesVisible = 0;
+		uint32_t PatchesRebuilt = 0;
+		uint32_t PatchesEvicted = 0;
+		uint32_t PatchesCached = 0;
+		uint32_t PrefetchSplits = 0;
+
+		// Last upload to the GPU
+		uint32_t PatchesUploaded = 0;
+		uint32_t VerticesUploaded = 0;
+		uint32_t IndicesUploaded = 0;
+		bool FullUpload = false;
+	};
+
+	// Patches keyed by their base node index, the least recently used ones are dropped when there are more than the capacity
+	class PlanetPatchCache
+	{
+	public:
+		PlanetPatchCache() = default;
+
+		// Drops all patches and makes room for keys up to keyCount
+		void Reset(size_t keyCount);
+		void Clear();
+		// Keeps the patches but makes every one of them re-evaluate its split decisions the next time it's visited
+		void Invalidate();
+
+		void SetCapacity(size_t capacity) { mCapacity = capacity; }
+		size_t GetCapacity() const { return mCapacity; }
+
+		// Safe to call from several threads as long as they use different keys
+		PlanetPatch& Acquire(uint32_t key);
+
+		void BeginGeneration();
+		// Called when all jobs are done with the keys of the patches that were used this generation
+		void EndGeneration(const std::vector<Ref<PlanetPatchGeometry>>& usedPatches, uint32_t patchesRebuilt);
+
+		const PlanetPatchStats& GetStats() const { return mStats; }
+		PlanetPatchStats& GetStats() { return mStats; }
+	private:
+		std::vector<Scope<PlanetPatch>> mPatches;
+		std::vector<uint32_t> mResident;
+
+		uint64_t mGeneration = 0;
+		size_t mCapacity = PLANET_PATCH_CACHE_CAPACITY;
+
+		PlanetPatchStats mStats;
+	};
+
+	// Keeps every visible patch in its own range of the planet vertex and index buffers so only changed patches are uploaded
+	class PlanetMeshLayout
+	{
+	public:
+		struct Range
+		{
+			uint32_t Offset = 0;
+			uint32_t Count = 0;
+		};
+	public:
+		PlanetMeshLayout() = default;
+
+		// Lays out the patches in vertices and indices, returns true if the buffers were reallocated and everything has to be uploaded
+		bool Update(const std::vector<Ref<PlanetPatchGeometry>>& patches, std::vector<PlanetVertex>& vertices, std::vector<uint32_t>& indices);
+		void Clear();
+
+		// Frames of the placed patches indexed by PlanetVertex::Frame, the shaders decode the positions with them
+		const std::vector<PlanetVertexFrame>& GetFrames() const { return mFrames; }
+
+		const std::vector<Range>& GetDirtyVertexRanges() const { return mDirtyVertices; }
+		const std::vector<Range>& GetDirtyIndexRanges() const { return mDirtyIndices; }
+
+		uint32_t GetVertexCount() const { return mLiveVertices; }
+		uint32_t GetIndexCount() const { return mLiveIndices; }
+		uint32_t GetPatchesPlaced() const { return mPatchesPlaced; }
+
+		// Geometry placed for the patch, nullptr if it wasn't visible in the last update
+		const PlanetPatchGeometry* Find(uint32_t key) const
+		{
+			auto it = mEntries.find(key);
+			return it != mEntries.end() ? it->second.Geometry.get() : nullptr;
+		}
+
+		template<typename Func>
+		void ForEachPatch(Func&& func) const
+		{
+			for (auto& [key, entry] : mEntries)
+				func(entry.Geometry);
+		}
+	private:
+		struct Entry
+		{
+			Ref<PlanetPatchGeometry> Geometry;
+			Range Vertices;
+			Range Indices;
+			uint32_t Frame = 0;
+			bool Seen = false;
+		};
+
+		static Range Allocate(std::vector<Range>& freeRanges, uint32_t& highWater, uint32_t count);
+		static void Free(std::vector<Range>& freeRanges, uint32_t& highWater, Range range);
+
+		void Place(const Ref<PlanetPatchGeometry>& geometry);
+	private:
+		std::unordered_map<uint32_t, Entry> mEntries;
+
+		std::vector<Range> mFreeVertices, mFreeIndices;
+		uint32_t mVertexHighWater = 0, mIndexHighWater = 0;
+
+		std::vector<Range> mDirtyVertices, mDirtyIndices;
+
+		// Slots of removed patches are reused so the frame buffer only grows with the number of visible patches
+		std::vector<PlanetVertexFrame> mFrames;
+		std::vector<uint32_t> mFreeFrames;
+
+		uint32_t mLiveVertices = 0, mLiveIndices = 0;
+		uint32_t mPatchesPlaced = 0;
+	};
+
+}
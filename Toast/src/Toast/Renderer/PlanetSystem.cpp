@@ -1,22 +1,76 @@
 #include "tpch.h"
 
 #include "PlanetSystem.h"
+#include "Toast/Core/WorkerPool.h"
 
+#include "Toast/Renderer/MeshOptimizer.h"
+#include "Toast/Renderer/PlanetBaseCache.h"
+#include "Toast/Renderer/TerrainHeightPyramid.h"
 #include "Toast/Scene/Components.h"
 
 #include <chrono>
+#include <emmintrin.h>
 
 #define BASE_PLANET_SUBDIVISIONS 7
 
+// Base tree level where the traversal is split into jobs, 20 * 4^3 = 1280 jobs keeps the workers busy even when
+// most of the detail is concentrated under a single icosahedron face
+#define PLANET_JOB_SUBDIVISION 3
+
+// Cells a terrain ray cast may visit before it gives up, a ray usually needs a few per pyramid level
+#define TERRAIN_RAYCAST_MAX_STEPS 1024
+// Past a cell boundary the ray moves on by this much so the next cell is the one it enters, in meters
+#define TERRAIN_RAYCAST_MIN_STEP 0.001
+#define TERRAIN_RAYCAST_BISECTIONS 32
+
+// A split node is merged again first when its furthest vertex is this much further away than the split distance
+#define PLANET_LOD_HYSTERESIS 1.1
+
+// Terrain detail finer than a node is assumed to deviate from it by this fraction of its edge length
+#define PLANET_LOD_EDGE_ERROR 0.01
+
+// Edge length of an icosahedron with a circumradius of 1
+#define PLANET_ICOSAHEDRON_EDGE 1.0514622242382672
+
+// The budget controller leaves the LOD alone while the triangle count is within this fraction below the budget
+#define PLANET_BUDGET_TOLERANCE 0.1
+#define PLANET_BUDGET_MIN_SCALE (1.0 / 64.0)
+
+// A build is cancelled once the camera has moved this fraction of its altitude away from where the build started
+#define PLANET_GENERATION_RESTART_DISTANCE 0.25
+// After this many cancelled builds in a row the next one is finished no matter how far the camera moves
+#define PLANET_GENERATION_MAX_RESTARTS 4
+
+// Node splits the look-ahead pass may do per build, each one displaces up to three midpoints
+#define PLANET_PREFETCH_BUDGET 4096
+// Weight of the newest sample in the camera velocity estimate of cameras without a rigid body
+#define PLANET_VELOCITY_SMOOTHING 0.25
+// Fraction of the object activation distance the camera moves before the nearest terrain objects are picked again
+#define PLANET_OBJECT_REGATHER_DISTANCE 0.01
+// Planets further away than this many radii are drawn with a fixed LOD down to PLANET_FIXED_LOD_SUBDIVISION
+#define PLANET_FIXED_LOD_DISTANCE 20.0
+#define PLANET_FIXED_LOD_SUBDIVISION 5
+
 namespace Toast {
 
-	std::mutex PlanetSystem::planetDataMutex;
-	std::mutex PlanetSystem::terrainCollidersMutex;
-	std::future<void> PlanetSystem::generationFuture;
-	std::atomic<bool> PlanetSystem::newPlanetReady{ false };
-	std::atomic<bool> PlanetSystem::planetGenerationOngoing{ false };
+	std::atomic<uint32_t> PlanetSystem::sActiveGenerations{ 0 };
+	std::vector<std::pair<double, DirectX::XMFLOAT3>> PlanetSystem::sObjectCandidates;
 
-	std::vector<Ref<PlanetNode>> PlanetSystem::sPlanetNodes;
+	// World space error of drawing a node as a flat triangle, the sphere bulges e^2 / 8R above its edges and the
+	// terrain inside differs by up to its height range
+	static double GetGeometricError(double edgeLength, double heightRange, double radius)
+	{
+		return edgeLength * PLANET_LOD_EDGE_ERROR + heightRange * 0.5 + edgeLength * edgeLength / (8.0 * radius);
+	}
+
+	static double GetDistanceToBounds(const Bounds& bounds, const Vector3& point)
+	{
+		double x = (std::max)((std::max)(bounds.mins.x - point.x, point.x - bounds.maxs.x), 0.0);
+		double y = (std::max)((std::max)(bounds.mins.y - point.y, point.y - bounds.maxs.y), 0.0);
+		double z = (std::max)((std::max)(bounds.mins.z - point.z, point.z - bounds.maxs.z), 0.0);
+
+		return sqrt(x * x + y * y + z * z);
+	}
 
 	uint32_t PlanetSystem::HashFace(uint32_t index0, uint32_t index1, uint32_t index2)
 	{
@@ -43,6 +97,121 @@ namespace Toast {
 		return uv;
 	}
 
+	static __m128d Select(__m128d mask, __m128d a, __m128d b)
+	{
+		return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+	}
+
+	// atan(t) for |t| <= tan(pi/8) from its Taylor series up to t^25. The series alternates with shrinking terms so the
+	// error is below the first term left out, 0.4143^27 / 27 < 2e-12 rad.
+	static __m128d AtanReduced(__m128d t)
+	{
+		const double coefficients[] = {
+			1.0 / 25.0, -1.0 / 23.0, 1.0 / 21.0, -1.0 / 19.0, 1.0 / 17.0, -1.0 / 15.0, 1.0 / 13.0,
+			-1.0 / 11.0, 1.0 / 9.0, -1.0 / 7.0, 1.0 / 5.0, -1.0 / 3.0, 1.0
+		};
+
+		__m128d t2 = _mm_mul_pd(t, t);
+		__m128d result = _mm_set1_pd(coefficients[0]);
+		for (int i = 1; i < 13; i++)
+			result = _mm_add_pd(_mm_mul_pd(result, t2), _mm_set1_pd(coefficients[i]));
+
+		return _mm_mul_pd(result, t);
+	}
+
+	// Same result as atan2 within the error of AtanReduced, atan2(0, 0) returns 0 like the CRT
+	static __m128d Atan2(__m128d y, __m128d x)
+	{
+		const __m128d signMask = _mm_set1_pd(-0.0);
+		const __m128d zero = _mm_setzero_pd();
+		const __m128d one = _mm_set1_pd(1.0);
+		const __m128d tanPiDiv8 = _mm_set1_pd(0.41421356237309503);
+
+		__m128d absY = _mm_andnot_pd(signMask, y);
+		__m128d absX = _mm_andnot_pd(signMask, x);
+
+		// Reduced to [0, 1] by dividing the smaller by the larger one
+		__m128d numerator = _mm_min_pd(absY, absX);
+		__m128d denominator = _mm_max_pd(absY, absX);
+		__m128d t = _mm_div_pd(numerator, Select(_mm_cmpeq_pd(denominator, zero), one, denominator));
+
+		// And then to [-tan(pi/8), tan(pi/8)] with atan(t) = pi/4 + atan((t - 1) / (t + 1))
+		__m128d large = _mm_cmpgt_pd(t, tanPiDiv8);
+		t = Select(large, _mm_div_pd(_mm_sub_pd(t, one), _mm_add_pd(t, one)), t);
+		__m128d angle = _mm_add_pd(AtanReduced(t), _mm_and_pd(large, _mm_set1_pd(M_PI / 4.0)));
+
+		angle = Select(_mm_cmpgt_pd(absY, absX), _mm_sub_pd(_mm_set1_pd(M_PIDIV2), angle), angle);
+		angle = Select(_mm_cmplt_pd(x, zero), _mm_sub_pd(_mm_set1_pd(M_PI), angle), angle);
+
+		return _mm_or_pd(angle, _mm_and_pd(y, signMask));
+	}
+
+	void PlanetSystem::GetUVsFromDirections(const Vector3* directions, Vector2* uvs, size_t count, double width, double height)
+	{
+		const __m128d half = _mm_set1_pd(0.5);
+		const __m128d uScale = _mm_set1_pd(0.5 / M_PI * (width - 1.0));
+		const __m128d vScale = _mm_set1_pd(0.5 / M_PIDIV2 * (height - 1.0));
+		const __m128d uOffset = _mm_set1_pd(0.5 * (width - 1.0));
+		const __m128d vOffset = _mm_set1_pd(0.5 * (height - 1.0));
+
+		for (size_t i = 0; i < count; i += 2)
+		{
+			// An odd count repeats the last direction in the second lane so every UV goes through the same code
+			const Vector3& d0 = directions[i];
+			const Vector3& d1 = directions[(std::min)(i + 1, count - 1)];
+
+			__m128d x = _mm_set_pd(d1.x, d0.x);
+			__m128d y = _mm_set_pd(d1.y, d0.y);
+			__m128d z = _mm_set_pd(d1.z, d0.z);
+
+			__m128d theta = Atan2(z, x);
+			// asin(y) of a unit vector, atan2 keeps its precision near the poles
+			__m128d phi = Atan2(y, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(z, z))));
+
+			alignas(16) double u[2], v[2];
+			_mm_store_pd(u, _mm_add_pd(_mm_mul_pd(theta, uScale), uOffset));
+			_mm_store_pd(v, _mm_add_pd(_mm_mul_pd(phi, vScale), vOffset));
+
+			uvs[i] = Vector2(u[0], v[0], 0.0);
+			if (i + 1 < count)
+				uvs[i + 1] = Vector2(u[1], v[1], 0.0);
+		}
+	}
+
+	void PlanetSystem::DisplaceVertices(const Vector3* positions, size_t count, Vector3* directions, Vector2* uvs, double* heights, Vector3* displaced, const TerrainData& terrainData, double radius, uint32_t mip)
+	{
+		for (size_t i = 0; i < count; i += 2)
+		{
+			const Vector3& p0 = positions[i];
+			const Vector3& p1 = positions[(std::min)(i + 1, count - 1)];
+
+			__m128d x = _mm_set_pd(p1.x, p0.x);
+			__m128d y = _mm_set_pd(p1.y, p0.y);
+			__m128d z = _mm_set_pd(p1.z, p0.z);
+
+			__m128d length = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)), _mm_mul_pd(z, z)));
+			length = Select(_mm_cmpeq_pd(length, _mm_setzero_pd()), _mm_set1_pd(1.0), length);
+
+			alignas(16) double nx[2], ny[2], nz[2];
+			_mm_store_pd(nx, _mm_div_pd(x, length));
+			_mm_store_pd(ny, _mm_div_pd(y, length));
+			_mm_store_pd(nz, _mm_div_pd(z, length));
+
+			directions[i] = Vector3(nx[0], ny[0], nz[0]);
+			if (i + 1 < count)
+				directions[i + 1] = Vector3(nx[1], ny[1], nz[1]);
+		}
+
+		GetUVsFromDirections(directions, uvs, count, (double)terrainData.Width, (double)terrainData.Height);
+		GetHeights(uvs, heights, count, terrainData, mip);
+
+		if (displaced)
+		{
+			for (size_t i = 0; i < count; i++)
+				displaced[i] = directions[i] * (radius + heights[i]);
+		}
+	}
+
 	void PlanetSystem::GetFaceBounds(const std::initializer_list<Vector3>& vertices, Bounds& bounds)
 	{
 		// Check if the list is empty
@@ -74,389 +243,621 @@ namespace Toast {
 		}
 	}
 
-	void PlanetSystem::SubdivideBasePlanet(PlanetComponent& planet, Ref<PlanetNode>& node, double scale)
+	void PlanetSystem::SubdivideBasePlanet(PlanetComponent& planet, uint32_t nodeIndex, double scale)
 	{
-		if (node->SubdivisionLevel >= BASE_PLANET_SUBDIVISIONS)
-			return;
+		PlanetGenerator& generator = *planet.Generator;
 
-		CPUVertex A, B, C;
-		double height;
+		// Copied since allocating the children can move the node
+		PlanetNode node = generator.BasePlanetNodes[nodeIndex];
 
-		A.Position = node->B.Position + ((node->C.Position - node->B.Position) * 0.5);
-		A.UV = GetUVFromPosition(Vector3::Normalize(A.Position), (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-		height = GetHeight(A.UV, planet.TerrainData);
-		A.Position = Vector3::Normalize(A.Position) * (planet.PlanetData.radius + height);
+		if (node.SubdivisionLevel >= BASE_PLANET_SUBDIVISIONS)
+			return;
 
-		B.Position = node->C.Position + ((node->A.Position - node->C.Position) * 0.5);
-		B.UV = GetUVFromPosition(Vector3::Normalize(B.Position), (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-		height = GetHeight(B.UV, planet.TerrainData);
-		B.Position = Vector3::Normalize(B.Position) * (planet.PlanetData.radius + height);
+		CPUVertex midpoints[3];
+		const CPUVertex* starts[3] = { &node.B, &node.C, &node.A };
+		const CPUVertex* ends[3] = { &node.C, &node.A, &node.B };
+		ComputeMidpoints(starts, ends, midpoints, 3, planet, nullptr, nullptr, node.SubdivisionLevel);
 
-		C.Position = node->A.Position + ((node->B.Position - node->A.Position) * 0.5);
-		C.UV = GetUVFromPosition(Vector3::Normalize(C.Position), (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-		height = GetHeight(C.UV, planet.TerrainData);
-		C.Position = Vector3::Normalize(C.Position) * (planet.PlanetData.radius + height);
+		const CPUVertex& A = midpoints[0];
+		const CPUVertex& B = midpoints[1];
+		const CPUVertex& C = midpoints[2];
 
-		node->ChildNodes.emplace_back(CreateRef<PlanetNode>(A, B, C, node->SubdivisionLevel + 1));
-		node->ChildNodes.emplace_back(CreateRef<PlanetNode>(C, B, node->A, node->SubdivisionLevel + 1));
-		node->ChildNodes.emplace_back(CreateRef<PlanetNode>(node->B, A, C, node->SubdivisionLevel + 1));
-		node->ChildNodes.emplace_back(CreateRef<PlanetNode>(B, A, node->C, node->SubdivisionLevel + 1));
+		uint32_t firstChild = generator.BasePlanetNodes.AllocateChildren(nodeIndex, 4);
+		generator.BasePlanetNodes[firstChild] = PlanetNode(A, B, C, node.SubdivisionLevel + 1);
+		generator.BasePlanetNodes[firstChild + 1] = PlanetNode(C, B, node.A, node.SubdivisionLevel + 1);
+		generator.BasePlanetNodes[firstChild + 2] = PlanetNode(node.B, A, C, node.SubdivisionLevel + 1);
+		generator.BasePlanetNodes[firstChild + 3] = PlanetNode(B, A, node.C, node.SubdivisionLevel + 1);
 
-		for (auto& child : node->ChildNodes)
+		for (uint32_t child = firstChild; child < firstChild + 4; child++)
 		{
 			SubdivideBasePlanet(planet, child, scale);
 
-			child->UpdateBoundsFromChildren();
+			generator.BasePlanetNodes.UpdateBoundsFromChildren(child);
 		}
 
-		node->UpdateBoundsFromChildren();
+		generator.BasePlanetNodes.UpdateBoundsFromChildren(nodeIndex);
 	}
 
-	void PlanetSystem::SubdivideFace(Ref<PlanetNode>& node, CPUVertex& A, CPUVertex& B, CPUVertex& C, Vector3& cameraPosPlanetSpace, PlanetComponent& planet, const Vector3& planetCenter, Matrix& planetTransform, uint16_t subdivision, const siv::PerlinNoise& perlin, TerrainDetailComponent* terrainDetail)
+	void PlanetSystem::ComputeMidpoints(const CPUVertex* const* starts, const CPUVertex* const* ends, CPUVertex* midpoints, uint32_t count, PlanetComponent& planet, const siv::PerlinNoise* perlin, TerrainDetailComponent* terrainDetail, int16_t subdivision)
 	{
-		double height;
-		NextPlanetFace nextFace;
-		Vector2 uvCoords;
-		Bounds bounds;
+		PlanetGenerator& generator = *planet.Generator;
 
-		//double aDistance = A.Position.LengthSqrt();
-		//double bDistance = B.Position.LengthSqrt();
-		//double cDistance = C.Position.LengthSqrt();
+		TOAST_CORE_ASSERT(count <= 3, "At most three midpoints at a time!");
 
-		double aDistance = (A.Position - cameraPosPlanetSpace).LengthSqrt();
-		double bDistance = (B.Position - cameraPosPlanetSpace).LengthSqrt();
-		double cDistance = (C.Position - cameraPosPlanetSpace).LengthSqrt();
-
-		//TOAST_CORE_CRITICAL("SubdivideFace: Subdivision=%d, aDistance=%.2f, bDistance=%.2f, cDistance=%.2f",
-		//	subdivision, aDistance, bDistance, cDistance);
+		Vector3 positions[3];
+		Vector3 normals[3];
+		Vector2 uvs[3];
+		double heights[3];
+		uint32_t missing[3];
+		uint32_t missingCount = 0;
 
-		if (subdivision >= BASE_PLANET_SUBDIVISIONS + planet.Subdivisions)	
-			nextFace = NextPlanetFace::LEAF;
-		else
+		for (uint32_t i = 0; i < count; i++)
 		{
-			double threshold = planet.DistanceLUT[(uint32_t)subdivision - BASE_PLANET_SUBDIVISIONS];
-			//TOAST_CORE_CRITICAL("SubdivideFace: Threshold for subdivision %d is %.2f", subdivision, threshold);
-			if (aDistance < planet.DistanceLUT[(uint32_t)subdivision - BASE_PLANET_SUBDIVISIONS] && bDistance < planet.DistanceLUT[(uint32_t)subdivision - BASE_PLANET_SUBDIVISIONS] && cDistance < planet.DistanceLUT[(uint32_t)subdivision - BASE_PLANET_SUBDIVISIONS])
-				nextFace = NextPlanetFace::SPLIT;
-			else 
-				nextFace = NextPlanetFace::LEAF; // Add triangle due to distance
+			const CPUVertex& a = *starts[i];
+			const CPUVertex& b = *ends[i];
+
+			if (generator.MidpointCache.Find(a.Id, b.Id, midpoints[i]))
+				continue;
+
+			// Always measured from the vertex with the lower id so the midpoint doesn't depend on the direction of the edge
+			const CPUVertex& start = a.Id < b.Id ? a : b;
+			const CPUVertex& end = a.Id < b.Id ? b : a;
+
+			positions[missingCount] = start.Position + ((end.Position - start.Position) * 0.5);
+			midpoints[i].Id = PlanetMidpointCache::GetMidpointId(a.Id, b.Id);
+			missing[missingCount++] = i;
 		}
 
-		//TOAST_CORE_CRITICAL("SubdivideFace: nextFace = %s", (nextFace == NextPlanetFace::SPLIT ? "SPLIT" : "LEAF"));
+		if (missingCount == 0)
+			return;
+
+		DisplaceVertices(positions, missingCount, normals, uvs, heights, nullptr, planet.TerrainData, planet.PlanetData.radius, GetTerrainMip(planet.TerrainData, (int16_t)(subdivision + 1)));
 
-		if (nextFace == NextPlanetFace::SPLIT)
+		for (uint32_t j = 0; j < missingCount; j++)
 		{
-			CPUVertex aMid, bMid, cMid;
+			CPUVertex& v = midpoints[missing[j]];
+			v.UV = uvs[j];
+
 			double mediumTerrainDetailNoise = 0.0;
+			if (perlin && terrainDetail && subdivision > terrainDetail->SubdivisionActivation)
+				mediumTerrainDetailNoise = perlin->octave2D_01(v.UV.x * terrainDetail->Frequency, v.UV.y * terrainDetail->Frequency, terrainDetail->Octaves) * terrainDetail->Amplitude;
 
-			aMid.Position = B.Position + ((C.Position - B.Position) * 0.5);
-			bMid.Position = C.Position + ((A.Position - C.Position) * 0.5);
-			cMid.Position = A.Position + ((B.Position - A.Position) * 0.5);
+			v.Position = normals[j] * (planet.PlanetData.radius + heights[j] + mediumTerrainDetailNoise);
 
-			auto ComputeVertex = [&](CPUVertex& v) {
-				Vector3 n = Vector3::Normalize(v.Position);
-				v.UV = GetUVFromPosition(n, (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-				double mediumTerrainDetailNoise = 0.0;
-				if (terrainDetail && subdivision > terrainDetail->SubdivisionActivation) {
-					mediumTerrainDetailNoise = perlin.octave2D_01(v.UV.x * terrainDetail->Frequency, v.UV.y * terrainDetail->Frequency, terrainDetail->Octaves) * terrainDetail->Amplitude;
-				}
-				double h = GetHeight(v.UV, planet.TerrainData);
-				v.Position = n * (planet.PlanetData.radius + h + mediumTerrainDetailNoise);
-				};
+			generator.MidpointCache.Insert(starts[missing[j]]->Id, ends[missing[j]]->Id, v);
+		}
+	}
 
-			ComputeVertex(aMid);
-			ComputeVertex(bMid);
-			ComputeVertex(cMid);
+	void PlanetSystem::UpdatePatchNode(PlanetPatch& patch, uint32_t nodeIndex, PlanetComponent& planet, PlanetTraversalData& traversal, double& stableDistance)
+	{
+		PlanetNodePool& nodes = patch.Nodes;
 
-			// Create child nodes for the four new faces
-			node->ChildNodes.clear();
-			node->ChildNodes.reserve(4);
+		Vector3& cameraPosPlanetSpace = traversal.CameraPosPlanetSpace;
+		TerrainDetailComponent* terrainDetail = traversal.TerrainDetail;
 
-			// For each of the four subdivided triangles, create a new node
-			// Triangle 1: aMid, bMid, cMid
-			{
-				Ref<PlanetNode> child = CreateRef<PlanetNode>(aMid, bMid, cMid, (uint16_t)(subdivision + 1), planetTransform);
-				SubdivideFace(child, aMid, bMid, cMid, cameraPosPlanetSpace, planet, planetCenter, planetTransform, subdivision + 1, perlin, terrainDetail);
-				node->ChildNodes.emplace_back(child);
-			}
+		// Copied since allocating children can move the node
+		CPUVertex A = nodes[nodeIndex].A, B = nodes[nodeIndex].B, C = nodes[nodeIndex].C;
+		uint16_t subdivision = (uint16_t)nodes[nodeIndex].SubdivisionLevel;
+		bool isSplit = !nodes[nodeIndex].IsLeaf();
 
-			// Triangle 2: cMid, bMid, A
-			{
-				Ref<PlanetNode> child = CreateRef<PlanetNode>(cMid, bMid, A, (uint16_t)(subdivision + 1), planetTransform);
-				SubdivideFace(child, cMid, bMid, A, cameraPosPlanetSpace, planet, planetCenter, planetTransform, subdivision + 1, perlin, terrainDetail);
-				node->ChildNodes.emplace_back(child);
-			}
+		double aDistance = (A.Position - cameraPosPlanetSpace).LengthSqrt();
+		double bDistance = (B.Position - cameraPosPlanetSpace).LengthSqrt();
+		double cDistance = (C.Position - cameraPosPlanetSpace).LengthSqrt();
 
-			// Triangle 3: B, aMid, cMid
+		if (subdivision >= BASE_PLANET_SUBDIVISIONS + planet.Subdivisions)
+		{
+			if (isSplit)
+				nodes.FreeChildren(nodeIndex);
+
+			return;
+		}
+
+		double threshold = GetNodeSplitDistance(A, B, C, traversal);
+		double furthestDistance = (std::max)(aDistance, (std::max)(bDistance, cDistance));
+
+		// Split nodes are only merged again once the camera is clearly outside the split distance
+		double splitThreshold = isSplit ? threshold * PLANET_LOD_HYSTERESIS * PLANET_LOD_HYSTERESIS : threshold;
+		bool split = furthestDistance < splitThreshold;
+
+		// Distances to the camera change at most as much as the camera moves
+		stableDistance = (std::min)(stableDistance, std::abs(sqrt(furthestDistance) - sqrt(splitThreshold)));
+
+		if (split)
+		{
+			if (!isSplit)
 			{
-				Ref<PlanetNode> child = CreateRef<PlanetNode>(B, aMid, cMid, (uint16_t)(subdivision + 1), planetTransform);
-				SubdivideFace(child, B, aMid, cMid, cameraPosPlanetSpace, planet, planetCenter, planetTransform, subdivision + 1, perlin, terrainDetail);
-				node->ChildNodes.emplace_back(child);
+				CPUVertex midpoints[3];
+				const CPUVertex* starts[3] = { &B, &C, &A };
+				const CPUVertex* ends[3] = { &C, &A, &B };
+				ComputeMidpoints(starts, ends, midpoints, 3, planet, traversal.Perlin, terrainDetail, (int16_t)subdivision);
+
+				const CPUVertex& aMid = midpoints[0];
+				const CPUVertex& bMid = midpoints[1];
+				const CPUVertex& cMid = midpoints[2];
+
+				// Create child nodes for the four new faces
+				uint32_t firstChild = nodes.AllocateChildren(nodeIndex, 4);
+				nodes[firstChild] = PlanetNode(aMid, bMid, cMid, (uint16_t)(subdivision + 1));
+				nodes[firstChild + 1] = PlanetNode(cMid, bMid, A, (uint16_t)(subdivision + 1));
+				nodes[firstChild + 2] = PlanetNode(B, aMid, cMid, (uint16_t)(subdivision + 1));
+				nodes[firstChild + 3] = PlanetNode(bMid, aMid, C, (uint16_t)(subdivision + 1));
 			}
 
-			// Triangle 4: bMid, aMid, C
+			uint32_t firstChild = nodes[nodeIndex].FirstChild;
+			for (uint32_t child = firstChild; child < firstChild + 4; child++)
+				UpdatePatchNode(patch, child, planet, traversal, stableDistance);
+		}
+		else
+		{
+			if (isSplit)
+				nodes.FreeChildren(nodeIndex);
+
+			// The crack triangle decision and its vertex order depend on the camera as well
+			double closestDistance = (std::min)(aDistance, (std::min)(bDistance, cDistance));
+			double secondClosestDistance = aDistance + bDistance + cDistance - closestDistance - furthestDistance;
+
+			stableDistance = (std::min)(stableDistance, std::abs(sqrt(closestDistance) - sqrt(threshold)));
+			stableDistance = (std::min)(stableDistance, std::abs(sqrt(secondClosestDistance) - sqrt(threshold)));
+
+			if (closestDistance < threshold && secondClosestDistance < threshold)
 			{
-				Ref<PlanetNode> child = CreateRef<PlanetNode>(bMid, aMid, C, (uint16_t)(subdivision + 1), planetTransform);
-				SubdivideFace(child, bMid, aMid, C, cameraPosPlanetSpace, planet, planetCenter, planetTransform, subdivision + 1, perlin, terrainDetail);
-				node->ChildNodes.emplace_back(child);
+				stableDistance = (std::min)(stableDistance, (sqrt(secondClosestDistance) - sqrt(closestDistance)) * 0.5);
+				stableDistance = (std::min)(stableDistance, (sqrt(furthestDistance) - sqrt(secondClosestDistance)) * 0.5);
 			}
+		}
+	}
+
+	PlanetVertexFrame PlanetSystem::GetPatchFrame(const PlanetNode& baseNode, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		// Any vertex below the base triangle is within the height range of the terrain and the bulge of the sphere over
+		// the triangle, edge^2 / radius is well above that bulge
+		double edgeLength = sqrt((std::max)((baseNode.A.Position - baseNode.B.Position).LengthSqrt(), (std::max)((baseNode.B.Position - baseNode.C.Position).LengthSqrt(), (baseNode.C.Position - baseNode.A.Position).LengthSqrt())));
+		double margin = planet.TerrainData.HeightScale * MAX_INT_VALUE + edgeLength * edgeLength / traversal.Radius;
+		if (traversal.TerrainDetail)
+			margin += traversal.TerrainDetail->Amplitude;
+
+		Vector3 mins = baseNode.A.Position, maxs = baseNode.A.Position;
+		for (const CPUVertex* corner : { &baseNode.B, &baseNode.C })
+		{
+			mins = Vector3((std::min)(mins.x, corner->Position.x), (std::min)(mins.y, corner->Position.y), (std::min)(mins.z, corner->Position.z));
+			maxs = Vector3((std::max)(maxs.x, corner->Position.x), (std::max)(maxs.y, corner->Position.y), (std::max)(maxs.z, corner->Position.z));
+		}
+		mins = mins - Vector3(margin, margin, margin);
+		maxs = maxs + Vector3(margin, margin, margin);
+
+		// Planet space like the vertices, the planet transform is applied by the shaders
+		return PlanetVertexCodec::CreateFrame(mins, maxs);
+	}
 
-			// After all children are subdivided
-			node->UpdateBoundsFromChildren();
+	void PlanetSystem::EmitPatchNode(PlanetPatch& patch, std::vector<Vertex>& vertices, uint32_t nodeIndex, uint32_t geometryIndex, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		const PlanetNode& node = patch.Nodes[nodeIndex];
+		PlanetNodePool& geometryNodes = patch.Geometry->Nodes;
+
+		geometryNodes[geometryIndex] = PlanetNode(node.A, node.B, node.C, node.SubdivisionLevel);
+
+		if (!node.IsLeaf())
+		{
+			uint32_t firstChild = geometryNodes.AllocateChildren(geometryIndex, node.ChildCount);
+			for (uint32_t i = 0; i < node.ChildCount; i++)
+				EmitPatchNode(patch, vertices, node.FirstChild + i, firstChild + i, planet, traversal);
+
+			geometryNodes.UpdateBoundsFromChildren(geometryIndex);
 		}
 		else
+			EmitPatchLeaf(patch, vertices, node.A, node.B, node.C, planet, traversal, (uint16_t)node.SubdivisionLevel);
+	}
+
+	double PlanetSystem::GetNodeSplitDistance(const CPUVertex& A, const CPUVertex& B, const CPUVertex& C, const PlanetTraversalData& traversal)
+	{
+		double edgeLength = sqrt((std::max)((A.Position - B.Position).LengthSqrt(), (std::max)((B.Position - C.Position).LengthSqrt(), (C.Position - A.Position).LengthSqrt())));
+
+		double aHeight = A.Position.Length();
+		double bHeight = B.Position.Length();
+		double cHeight = C.Position.Length();
+		double heightRange = (std::max)(aHeight, (std::max)(bHeight, cHeight)) - (std::min)(aHeight, (std::min)(bHeight, cHeight));
+
+		double distance = GetGeometricError(edgeLength, heightRange, traversal.Radius) * traversal.LODErrorScale;
+		return distance * distance;
+	}
+
+	// Planet space normal of the height map surface at position, uv is where position samples the height map
+	static Vector3 GetHeightMapNormal(const Vector3& position, const Vector2& uv, const TerrainData& terrainData, const siv::PerlinNoise* perlin, const TerrainDetailComponent* terrainDetail, uint32_t mip)
+	{
+		double width = (double)terrainData.Width - 1.0;
+		double height = (double)terrainData.Height - 1.0;
+		// One texel of the mip the normals are sampled from, in texels of the full resolution map
+		double step = (double)(1u << mip);
+
+		auto sampleHeight = [&](double u, double v) {
+			// Around the planet u wraps, at the poles v stops
+			if (u < 0.0)
+				u += width;
+			else if (u >= width)
+				u -= width;
+			v = (std::min)((std::max)(v, 0.0), height);
+
+			double sample = PlanetSystem::GetHeight(Vector2(u, v), terrainData, mip);
+			if (perlin && terrainDetail)
+				sample += perlin->octave2D_01(u * terrainDetail->Frequency, v * terrainDetail->Frequency, terrainDetail->Octaves) * terrainDetail->Amplitude;
+
+			return sample;
+		};
+
+		// Central differences in texels, turned into slopes per radian of longitude and latitude
+		double dHdU = (sampleHeight(uv.x + step, uv.y) - sampleHeight(uv.x - step, uv.y)) / (2.0 * step);
+		double dHdV = (sampleHeight(uv.x, uv.y + step) - sampleHeight(uv.x, uv.y - step)) / (2.0 * step);
+		double dHdTheta = dHdU * width / (2.0 * M_PI);
+		double dHdPhi = dHdV * height / M_PI;
+
+		double r = position.Length();
+		Vector3 direction = position / r;
+		double cosPhi = sqrt((std::max)(1.0 - direction.y * direction.y, 0.0));
+
+		// Longitude is undefined at the poles, the sphere normal is used there
+		Vector3 normal = direction;
+		if (cosPhi > 1e-9)
 		{
-			//TOAST_CORE_CRITICAL("SubdivideFace: LEAF branch - adding vertices for subdivision %d", subdivision);
+			// Unit tangents along increasing longitude and latitude, the surface tilts against its slope along each of them
+			Vector3 tangentTheta(-direction.z / cosPhi, 0.0, direction.x / cosPhi);
+			Vector3 tangentPhi(-direction.y * direction.x / cosPhi, cosPhi, -direction.y * direction.z / cosPhi);
 
-			bool crackTriangle = false;
-			CPUVertex closestVertex, furthestVertex, middleVertex;
+			normal = Vector3::Normalize(direction - tangentTheta * (dHdTheta / (r * cosPhi)) - tangentPhi * (dHdPhi / r));
+		}
 
-			double closestDistance = (std::min)(aDistance, (std::min)(bDistance, cDistance));
-			double furthestDistance = (std::max)(aDistance, (std::max)(bDistance, cDistance));
-			double secondClosestDistance;
+		return normal;
+	}
 
-			if (closestDistance == aDistance)
-				closestVertex = A;
-			else if (closestDistance == bDistance)
-				closestVertex = B;
-			else
-				closestVertex = C;
+	Vector3 PlanetSystem::GetAnalyticNormal(const CPUVertex& vertex, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		return GetHeightMapNormal(vertex.Position, vertex.UV, planet.TerrainData, traversal.Perlin, traversal.TerrainDetail, traversal.NormalMip);
+	}
 
-			if (furthestDistance == aDistance)
-				furthestVertex = A;
-			else if (furthestDistance == bDistance)
-				furthestVertex = B;
-			else
-				furthestVertex = C;
+	void PlanetSystem::EmitPatchLeaf(PlanetPatch& patch, std::vector<Vertex>& vertices, const CPUVertex& A, const CPUVertex& B, const CPUVertex& C, PlanetComponent& planet, PlanetTraversalData& traversal, uint16_t subdivision)
+	{
+		Vector3& cameraPosPlanetSpace = traversal.CameraPosPlanetSpace;
+		TerrainDetailComponent* terrainDetail = traversal.TerrainDetail;
 
-			if (closestDistance == aDistance)
-				secondClosestDistance = (furthestDistance == bDistance) ? cDistance : bDistance;
-			else if (closestDistance == bDistance)
-				secondClosestDistance = (furthestDistance == aDistance) ? cDistance : aDistance;
-			else
-				secondClosestDistance = (furthestDistance == aDistance) ? bDistance : aDistance;
+		double aDistance = (A.Position - cameraPosPlanetSpace).LengthSqrt();
+		double bDistance = (B.Position - cameraPosPlanetSpace).LengthSqrt();
+		double cDistance = (C.Position - cameraPosPlanetSpace).LengthSqrt();
 
-			// Identify middle vertex based on distances
-			if ((closestDistance != aDistance) && (furthestDistance != aDistance))
-				middleVertex = A;
-			else if ((closestDistance != bDistance) && (furthestDistance != bDistance))
-				middleVertex = B;
-			else
-				middleVertex = C;
+		bool crackTriangle = false;
+		CPUVertex closestVertex, furthestVertex, middleVertex;
 
-			if(subdivision < (planet.Subdivisions + BASE_PLANET_SUBDIVISIONS))
-			{
-				if (closestDistance < planet.DistanceLUT[(uint32_t)subdivision - BASE_PLANET_SUBDIVISIONS] && secondClosestDistance < planet.DistanceLUT[(uint32_t)subdivision - BASE_PLANET_SUBDIVISIONS])
-					crackTriangle = true;
-			}
+		double closestDistance = (std::min)(aDistance, (std::min)(bDistance, cDistance));
+		double furthestDistance = (std::max)(aDistance, (std::max)(bDistance, cDistance));
+		double secondClosestDistance;
+
+		if (closestDistance == aDistance)
+			closestVertex = A;
+		else if (closestDistance == bDistance)
+			closestVertex = B;
+		else
+			closestVertex = C;
+
+		if (furthestDistance == aDistance)
+			furthestVertex = A;
+		else if (furthestDistance == bDistance)
+			furthestVertex = B;
+		else
+			furthestVertex = C;
+
+		if (closestDistance == aDistance)
+			secondClosestDistance = (furthestDistance == bDistance) ? cDistance : bDistance;
+		else if (closestDistance == bDistance)
+			secondClosestDistance = (furthestDistance == aDistance) ? cDistance : aDistance;
+		else
+			secondClosestDistance = (furthestDistance == aDistance) ? bDistance : aDistance;
+
+		// Identify middle vertex based on distances
+		if ((closestDistance != aDistance) && (furthestDistance != aDistance))
+			middleVertex = A;
+		else if ((closestDistance != bDistance) && (furthestDistance != bDistance))
+			middleVertex = B;
+		else
+			middleVertex = C;
 
-			// Function to add or retrieve a vertex
-			auto addVertex = [&](const CPUVertex& cpuVertex, const Vector3& transformedPos) -> size_t {
-				// Create a Vertex instance
-				Vertex v;
-				v.Position = { (float)transformedPos.x, (float)transformedPos.y, (float)transformedPos.z };
+		if(subdivision < (planet.Subdivisions + BASE_PLANET_SUBDIVISIONS))
+		{
+			// The neighbour along the closest edge is split if that edge is within the split distance
+			double splitDistance = GetNodeSplitDistance(A, B, C, traversal);
+			if (closestDistance < splitDistance && secondClosestDistance < splitDistance)
+				crackTriangle = true;
+		}
+
+		// Function to add or retrieve a vertex, vertices are shared by their stable id. Patches are kept in planet space
+		auto addVertex = [&](const CPUVertex& cpuVertex, const Vector3& position) -> size_t {
+			uint64_t key = cpuVertex.Id ? cpuVertex.Id : PlanetVertexMap::GetPositionKey(cpuVertex.Position);
+
+			bool inserted;
+			uint32_t index = patch.VertexMap.FindOrInsert(key, (uint32_t)vertices.size(), inserted);
+			if (inserted) 
+			{
+				// Normal starts at zero, we'll accumulate face normals
+				Vertex& v = vertices.emplace_back();
+				v.Position = { (float)position.x, (float)position.y, (float)position.z };
 				v.Texcoord = { (float)cpuVertex.UV.x, (float)cpuVertex.UV.y };
-				// Initialize normal to zero; we'll accumulate face normals
-				v.Normal = { 0.0f, 0.0f, 0.0f };
-				v.Tangent = { 0.0f, 0.0f, 0.0f, 0.0f };
-				v.Color = { 0.0f, 0.0f, 0.0f };
-
-				// Try to insert the vertex into the map
-				auto result = planet.VertexMap.emplace(v, planet.BuildVertices.size());
-				if (result.second) {
-					// Vertex was not in the map; add it to the vertex list
-					planet.BuildVertices.emplace_back(v);
+
+				if (traversal.AnalyticNormals)
+				{
+					Vector3 normal = GetAnalyticNormal(cpuVertex, planet, traversal);
+					v.Normal = { (float)normal.x, (float)normal.y, (float)normal.z };
 				}
-				// Return the index of the vertex
-				return result.first->second;
-				};
+			}
+
+			return index;
+			};
+
+		// Face normals are summed per shared vertex and normalized once the patch is emitted
+		auto accumulateNormal = [&](size_t index, const Vector3& normal) {
+			if (traversal.AnalyticNormals)
+				return;
+
+			vertices[index].Normal.x += (float)normal.x;
+			vertices[index].Normal.y += (float)normal.y;
+			vertices[index].Normal.z += (float)normal.z;
+			};
+
+		// Flat shaded vertices take the face normal unless the normals come from the height map
+		auto vertexNormal = [&](const CPUVertex& cpuVertex, const Vector3& faceNormal) {
+			return traversal.AnalyticNormals ? GetAnalyticNormal(cpuVertex, planet, traversal) : faceNormal;
+			};
+
+		if (!crackTriangle)
+		{
+			Vector3 vecA = A.Position;
+			Vector3 vecB = B.Position;
+			Vector3 vecC = C.Position;
 
-			if (!crackTriangle)
+			Vector3 normal = Vector3::Normalize(Vector3::Cross(vecB - vecA, vecC - vecA));
+
+			if (planet.PlanetData.smoothShading)
+			{
+				// Add or retrieve vertices
+				size_t indexA = addVertex(A, vecA);
+				size_t indexB = addVertex(B, vecB);
+				size_t indexC = addVertex(C, vecC);
+
+				accumulateNormal(indexA, normal);
+				accumulateNormal(indexB, normal);
+				accumulateNormal(indexC, normal);
+
+				// Add indices
+				patch.Geometry->Indices.emplace_back(indexA);
+				patch.Geometry->Indices.emplace_back(indexB);
+				patch.Geometry->Indices.emplace_back(indexC);
+			}
+			else 
 			{
-				Vector3 vecA = planetTransform * A.Position;
-				Vector3 vecB = planetTransform * B.Position;
-				Vector3 vecC = planetTransform * C.Position;
+				Vertex vertexA = Vertex(vecA, A.UV, vertexNormal(A, normal));
+				vertices.emplace_back(vertexA);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
 
-				Vector3 normal = Vector3::Normalize(Vector3::Cross(vecB - vecA, vecC - vecA));
+				Vertex vertexB = Vertex(vecB, B.UV, vertexNormal(B, normal));
+				vertices.emplace_back(vertexB);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
 
-				if (planet.PlanetData.smoothShading)
-				{
-					// Add or retrieve vertices
-					size_t indexA = addVertex(A, vecA);
-					size_t indexB = addVertex(B, vecB);
-					size_t indexC = addVertex(C, vecC);
-
-					// Accumulate normals
-					planet.BuildVertices[indexA].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexA].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexA].Normal.z += (float)normal.z;
-
-					planet.BuildVertices[indexB].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexB].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexB].Normal.z += (float)normal.z;
-
-					planet.BuildVertices[indexC].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexC].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexC].Normal.z += (float)normal.z;
-
-					// Add indices
-					planet.BuildIndices.emplace_back(indexA);
-					planet.BuildIndices.emplace_back(indexB);
-					planet.BuildIndices.emplace_back(indexC);
-				}
-				else 
-				{
-					Vertex vertexA = Vertex(vecA, A.UV, normal);
-					planet.BuildVertices.emplace_back(vertexA);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
+				Vertex vertexC = Vertex(vecC, C.UV, vertexNormal(C, normal));
+				vertices.emplace_back(vertexC);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
+			}
 
-					Vertex vertexB = Vertex(vecB, B.UV, normal);
-					planet.BuildVertices.emplace_back(vertexB);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
+			// Chunks are used by the physics engine
+			//AssignFaceToChunk(vecA, vecB, vecC, planet.TerrainChunks, planetCenter);
+		}
+		else
+		{
+			// The new vertex is the same midpoint the finer neighbour created when it split this edge
+			CPUVertex additionalVertex;
+			const CPUVertex* start = &closestVertex;
+			const CPUVertex* end = &middleVertex;
+			ComputeMidpoints(&start, &end, &additionalVertex, 1, planet, traversal.Perlin, terrainDetail, (int16_t)subdivision);
 
-					Vertex vertexC = Vertex(vecC, C.UV, normal);
-					planet.BuildVertices.emplace_back(vertexC);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
-				}
+			Vector3 additionalVertexPos = additionalVertex.Position;
+			Vector3 closestVertexPos = closestVertex.Position;
+			Vector3 middleVertexPos = middleVertex.Position;
+			Vector3 furthestVertexPos = furthestVertex.Position;
 
-				node->ComputeBoundsFromTriangle();
+			// First triangle
+			Vector3 normal = Vector3::Normalize(Vector3::Cross(additionalVertexPos - closestVertexPos, additionalVertexPos - furthestVertexPos));
 
-				// Chunks are used by the physics engine
-				//AssignFaceToChunk(vecA, vecB, vecC, planet.TerrainChunks, planetCenter);
+			if (normal.y < 0.0)
+				normal = normal * -1.0;
+
+			if (planet.PlanetData.smoothShading)
+			{
+				// Add or retrieve vertices
+				size_t indexA = addVertex(additionalVertex, additionalVertexPos);
+				size_t indexB = addVertex(closestVertex, closestVertexPos);
+				size_t indexC = addVertex(furthestVertex, furthestVertexPos);
+
+				accumulateNormal(indexA, normal);
+				accumulateNormal(indexB, normal);
+				accumulateNormal(indexC, normal);
+
+				// Add indices
+				patch.Geometry->Indices.emplace_back(indexA);
+				patch.Geometry->Indices.emplace_back(indexB);
+				patch.Geometry->Indices.emplace_back(indexC);
 			}
 			else
 			{
-				double mediumTerrainDetailNoise = 0.0;
-				// Calculate new vertex	
-				CPUVertex additionalVertex;
-				additionalVertex.Position = (closestVertex.Position + middleVertex.Position) * 0.5;
-				Vector3 additionalVertexNormalized = Vector3::Normalize(additionalVertex.Position);
-				additionalVertex.UV = GetUVFromPosition(additionalVertexNormalized, (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-				if(terrainDetail && subdivision > terrainDetail->SubdivisionActivation)
-					mediumTerrainDetailNoise = perlin.octave2D_01(additionalVertex.UV.x * terrainDetail->Frequency, additionalVertex.UV.y * terrainDetail->Frequency, terrainDetail->Octaves) * terrainDetail->Amplitude;
-				double height = GetHeight(additionalVertex.UV, planet.TerrainData);
-				additionalVertex.Position = additionalVertexNormalized * (planet.PlanetData.radius + height + mediumTerrainDetailNoise);
-
-				Vector3 additionalVertexPos = planetTransform * additionalVertex.Position;
-				Vector3 closestVertexPos = planetTransform * closestVertex.Position;
-				Vector3 middleVertexPos = planetTransform * middleVertex.Position;
-				Vector3 furthestVertexPos = planetTransform * furthestVertex.Position;
-
-				// First triangle
-				Vector3 normal = Vector3::Normalize(Vector3::Cross(additionalVertexPos - closestVertexPos, additionalVertexPos - furthestVertexPos));
-
-				if (normal.y < 0.0)
-					normal = normal * -1.0;
-
-				if (planet.PlanetData.smoothShading)
-				{
-					// Add or retrieve vertices
-					size_t indexA = addVertex(A, additionalVertexPos);
-					size_t indexB = addVertex(B, closestVertexPos);
-					size_t indexC = addVertex(C, furthestVertexPos);
-
-					// Accumulate normals
-					planet.BuildVertices[indexA].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexA].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexA].Normal.z += (float)normal.z;
-
-					planet.BuildVertices[indexB].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexB].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexB].Normal.z += (float)normal.z;
-
-					planet.BuildVertices[indexC].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexC].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexC].Normal.z += (float)normal.z;
-
-					// Add indices
-					planet.BuildIndices.emplace_back(indexA);
-					planet.BuildIndices.emplace_back(indexB);
-					planet.BuildIndices.emplace_back(indexC);
-				}
-				else
-				{
-					Vertex vertexA = Vertex(additionalVertexPos, additionalVertex.UV, normal);
-					planet.BuildVertices.emplace_back(vertexA);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
+				Vertex vertexA = Vertex(additionalVertexPos, additionalVertex.UV, vertexNormal(additionalVertex, normal));
+				vertices.emplace_back(vertexA);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
 
-					Vertex vertexB = Vertex(closestVertexPos, closestVertex.UV, normal);
-					planet.BuildVertices.emplace_back(vertexB);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
+				Vertex vertexB = Vertex(closestVertexPos, closestVertex.UV, vertexNormal(closestVertex, normal));
+				vertices.emplace_back(vertexB);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
 
-					Vertex vertexC = Vertex(furthestVertexPos, furthestVertex.UV, normal);
-					planet.BuildVertices.emplace_back(vertexC);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
-				}
+				Vertex vertexC = Vertex(furthestVertexPos, furthestVertex.UV, vertexNormal(furthestVertex, normal));
+				vertices.emplace_back(vertexC);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
+			}
 
-				Ref<PlanetNode> child1 = CreateRef<PlanetNode>(A, B, C, subdivision + 1);
-				node->ChildNodes.push_back(child1);
+			//AssignFaceToChunk(additionalVertexPos, closestVertexPos, furthestVertexPos, planet.TerrainChunks, planetCenter);
+
+			// Second triangle
+			normal = Vector3::Normalize(Vector3::Cross(additionalVertexPos - furthestVertexPos, additionalVertexPos - middleVertexPos));
+			if (normal.y < 0.0)
+				normal = normal * -1.0;
+
+			if (planet.PlanetData.smoothShading)
+			{
+				// Add or retrieve vertices
+				size_t indexA = addVertex(additionalVertex, additionalVertexPos);
+				size_t indexB = addVertex(furthestVertex, furthestVertexPos);
+				size_t indexC = addVertex(middleVertex, middleVertexPos);
+
+				accumulateNormal(indexA, normal);
+				accumulateNormal(indexB, normal);
+				accumulateNormal(indexC, normal);
+
+				// Add indices
+				patch.Geometry->Indices.emplace_back(indexA);
+				patch.Geometry->Indices.emplace_back(indexB);
+				patch.Geometry->Indices.emplace_back(indexC);
+			}
+			else
+			{
+				Vertex vertexD = Vertex(additionalVertexPos, additionalVertex.UV, vertexNormal(additionalVertex, normal));
+				vertexD.Color = { 1.0f, 0.0f, 0.0f };
+				vertices.emplace_back(vertexD);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
+
+				Vertex vertexF = Vertex(furthestVertexPos, furthestVertex.UV, vertexNormal(furthestVertex, normal));
+				vertices.emplace_back(vertexF);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
+
+				Vertex vertexE = Vertex(middleVertexPos, middleVertex.UV, vertexNormal(middleVertex, normal));
+				vertices.emplace_back(vertexE);
+				patch.Geometry->Indices.emplace_back(vertices.size() - 1);
+			}
 
-				//AssignFaceToChunk(additionalVertexPos, closestVertexPos, furthestVertexPos, planet.TerrainChunks, planetCenter);
+			//TOAST_CORE_CRITICAL("Planet vertices count after adding face: %zu", vertices.size());
 
-				// Second triangle
-				normal = Vector3::Normalize(Vector3::Cross(additionalVertexPos - furthestVertexPos, additionalVertexPos - middleVertexPos));
-				if (normal.y < 0.0)
-					normal = normal * -1.0;
+			//AssignFaceToChunk(additionalVertexPos, furthestVertexPos, middleVertexPos, planet.TerrainChunks, planetCenter);
+		}
+	}
 
-				if (planet.PlanetData.smoothShading)
-				{
-					// Add or retrieve vertices
-					size_t indexA = addVertex(A, additionalVertexPos);
-					size_t indexB = addVertex(B, furthestVertexPos);
-					size_t indexC = addVertex(C, middleVertexPos);
-
-					// Accumulate normals
-					planet.BuildVertices[indexA].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexA].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexA].Normal.z += (float)normal.z;
-
-					planet.BuildVertices[indexB].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexB].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexB].Normal.z += (float)normal.z;
-
-					planet.BuildVertices[indexC].Normal.x += (float)normal.x;
-					planet.BuildVertices[indexC].Normal.y += (float)normal.y;
-					planet.BuildVertices[indexC].Normal.z += (float)normal.z;
-
-					// Add indices
-					planet.BuildIndices.emplace_back(indexA);
-					planet.BuildIndices.emplace_back(indexB);
-					planet.BuildIndices.emplace_back(indexC);
-				}
-				else
+	void PlanetSystem::UpdatePatch(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal, PlanetBuildOutput& output)
+	{
+		PlanetGenerator& generator = *planet.Generator;
+
+		PlanetPatch& patch = generator.PatchCache.Acquire(baseIndex);
+		if (patch.Nodes.Empty())
+		{
+			const PlanetNode& baseNode = generator.BasePlanetNodes[baseIndex];
+
+			uint32_t root = patch.Nodes.Allocate(1);
+			patch.Nodes[root] = PlanetNode(baseNode.A, baseNode.B, baseNode.C, baseNode.SubdivisionLevel);
+		}
+
+		// Nothing in the patch can change until the camera has moved further than the smallest decision margin
+		if (patch.StableDistance < 0.0 || (traversal.CameraPosPlanetSpace - patch.CameraPos).Length() >= patch.StableDistance)
+		{
+			TOAST_PROFILE_SCOPE("Updating planet patch");
+
+			patch.CameraPos = traversal.CameraPosPlanetSpace;
+			patch.StableDistance = DBL_MAX;
+			UpdatePatchNode(patch, 0, planet, traversal, patch.StableDistance);
+
+			// Full precision vertices are only kept while the patch is emitted, each worker reuses its own list
+			static thread_local std::vector<Vertex> sPatchVertices;
+
+			// The old geometry might still be uploaded by the render thread so a new one is built
+			uint64_t version = patch.Geometry ? patch.Geometry->Version + 1 : 0;
+			size_t previousVertexCount = patch.Geometry ? patch.Geometry->Vertices.size() : 0;
+			size_t previousIndexCount = patch.Geometry ? patch.Geometry->Indices.size() : 0;
+			size_t previousNodeCount = patch.Geometry ? patch.Geometry->Nodes.Size() : 0;
+			patch.Geometry = CreateRef<PlanetPatchGeometry>();
+			patch.Geometry->Key = baseIndex;
+			patch.Geometry->Version = version;
+			patch.Geometry->Frame = GetPatchFrame(patch.Nodes[0], planet, traversal);
+
+			// Sized from the last build of the patch so neither the map nor the lists grow while emitting
+			sPatchVertices.clear();
+			sPatchVertices.reserve(previousVertexCount);
+			patch.Geometry->Indices.reserve(previousIndexCount);
+			patch.Geometry->Nodes.Reserve(previousNodeCount);
+			patch.VertexMap.Clear();
+			if (planet.PlanetData.smoothShading)
+				patch.VertexMap.Reserve(previousVertexCount);
+
+			EmitPatchNode(patch, sPatchVertices, 0, patch.Geometry->Nodes.Allocate(1), planet, traversal);
+
+			// Height map normals are unit length already
+			if (!traversal.AnalyticNormals)
+			{
+				for (auto& vertex : sPatchVertices)
 				{
-					Vertex vertexD = Vertex(additionalVertexPos, additionalVertex.UV, normal);
-					vertexD.Color = { 1.0f, 0.0f, 0.0f };
-					planet.BuildVertices.emplace_back(vertexD);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
-
-					Vertex vertexF = Vertex(furthestVertexPos, furthestVertex.UV, normal);
-					planet.BuildVertices.emplace_back(vertexF);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
-
-					Vertex vertexE = Vertex(middleVertexPos, middleVertex.UV, normal);
-					planet.BuildVertices.emplace_back(vertexE);
-					planet.BuildIndices.emplace_back(planet.BuildVertices.size() - 1);
+					Vector3 normal(vertex.Normal.x, vertex.Normal.y, vertex.Normal.z);
+					normal = Vector3::Normalize(normal);
+					vertex.Normal = { (float)normal.x, (float)normal.y, (float)normal.z };
 				}
+			}
 
-				Ref<PlanetNode> child2 = CreateRef<PlanetNode>(A, B, C, subdivision + 1);
-				node->ChildNodes.push_back(child2);
-
-				//TOAST_CORE_CRITICAL("Planet vertices count after adding face: %zu", planet.BuildVertices.size());
+			// The traversal emits the triangles depth first, flat shaded patches share no vertices so there's nothing to reuse
+			if (planet.PlanetData.smoothShading)
+			{
+				static thread_local std::vector<uint32_t> sRemap;
 
-				//AssignFaceToChunk(additionalVertexPos, furthestVertexPos, middleVertexPos, planet.TerrainChunks, planetCenter);
+				std::vector<uint32_t>& indices = patch.Geometry->Indices;
+				MeshOptimizer::OptimizeVertexCache(indices.data(), indices.size(), (uint32_t)sPatchVertices.size());
+				MeshOptimizer::OptimizeVertexFetch(indices.data(), indices.size(), (uint32_t)sPatchVertices.size(), sRemap);
+				MeshOptimizer::RemapVertices(sPatchVertices.data(), (uint32_t)sPatchVertices.size(), sRemap);
 			}
-		
-			return;
+
+			PlanetVertexCodec::Encode(sPatchVertices, patch.Geometry->Frame, patch.Geometry->Vertices);
+
+			output.PatchesRebuilt++;
 		}
+
+		output.Patches.emplace_back(patch.Geometry);
 	}
 
-	void PlanetSystem::CalculateBasePlanet(PlanetComponent& planet, double scale)
+	void PlanetSystem::CalculateBasePlanet(PlanetComponent& planet, double scale, const std::string& heightmapPath)
 	{
 		TOAST_PROFILE_FUNCTION();
 
+		PlanetGenerator& generator = GetGenerator(planet);
+
+		// The generation and prefetch workers walk the node pools and tiles rebuilt below, a build made for the old
+		// base planet is dropped as well
+		Shutdown(planet);
+		generator.NewPlanetReady.store(false);
+
 		auto start = std::chrono::high_resolution_clock::now();
 
+		// Midpoints computed for the previous base planet could have used another height map or radius
+		generator.MidpointCache.Clear();
+
+		// The baked tree only depends on the texels the base levels sample and on the altitude range and radius
+		std::string cachePath;
+		PlanetBaseCache::Key cacheKey;
+		if (!heightmapPath.empty())
+		{
+			cachePath = PlanetBaseCache::GetCachePath(heightmapPath);
+			cacheKey.HeightmapHash = PlanetBaseCache::HashHeightmap(planet.TerrainData, GetTerrainMip(planet.TerrainData, BASE_PLANET_SUBDIVISIONS));
+			cacheKey.Width = planet.TerrainData.Width;
+			cacheKey.Height = planet.TerrainData.Height;
+			cacheKey.Radius = planet.PlanetData.radius;
+			cacheKey.HeightScale = planet.TerrainData.HeightScale;
+			cacheKey.HeightOffset = planet.TerrainData.HeightOffset;
+			cacheKey.Subdivisions = BASE_PLANET_SUBDIVISIONS;
+
+			if (PlanetBaseCache::Load(cachePath, cacheKey, generator.BasePlanetNodes))
+			{
+				generator.PatchCache.Reset(generator.BasePlanetNodes.Size());
+
+				auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+				TOAST_CORE_INFO("Base planet loaded from %s with %d number of planet nodes, time: %dms", cachePath.c_str(), generator.BasePlanetNodes.Size(), (int)duration.count());
+
+				return;
+			}
+		}
+
 		double ratio = ((1.0 + sqrt(5.0)) / 2.0);
 
 		std::vector<Vector3> initialVertices;
@@ -504,7 +905,15 @@ namespace Toast {
 						2, 4, 11
 		};
 
-		sPlanetNodes.clear();
+		// 20 root faces, each a full quadtree down to BASE_PLANET_SUBDIVISIONS
+		uint32_t nodesPerRoot = 0;
+		for (int level = 0; level <= BASE_PLANET_SUBDIVISIONS; level++)
+			nodesPerRoot += 1 << (2 * level);
+
+		generator.BasePlanetNodes.Reset();
+		generator.BasePlanetNodes.Reserve((size_t)nodesPerRoot * 20);
+
+		uint32_t rootMip = GetTerrainMip(planet.TerrainData, 0);
 
 		for (int i = 0; i < initialIndices.size() - 2; i += 3)
 		{
@@ -513,170 +922,579 @@ namespace Toast {
 
 			CPUVertex A, B, C;
 			A.Position = initialVertices[initialIndices[i]];
+			A.Id = initialIndices[i] + 1;
 			A.UV = GetUVFromPosition(Vector3::Normalize(A.Position), (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-			height = GetHeight(A.UV, planet.TerrainData);
+			height = GetHeight(A.UV, planet.TerrainData, rootMip);
 			A.Position = Vector3::Normalize(A.Position) * (planet.PlanetData.radius + height);
 			
 			B.Position = initialVertices[initialIndices[i + 1]];
+			B.Id = initialIndices[i + 1] + 1;
 			B.UV = GetUVFromPosition(Vector3::Normalize(B.Position), (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-			height = GetHeight(B.UV, planet.TerrainData);
+			height = GetHeight(B.UV, planet.TerrainData, rootMip);
 			B.Position = Vector3::Normalize(B.Position) * (planet.PlanetData.radius + height);
 
 			C.Position = initialVertices[initialIndices[i + 2]];
+			C.Id = initialIndices[i + 2] + 1;
 			C.UV = GetUVFromPosition(Vector3::Normalize(C.Position), (double)planet.TerrainData.Width, (double)planet.TerrainData.Height);
-			height = GetHeight(C.UV, planet.TerrainData);
+			height = GetHeight(C.UV, planet.TerrainData, rootMip);
 			C.Position = Vector3::Normalize(C.Position) * (planet.PlanetData.radius + height);
 
-			Ref<PlanetNode> rootNode = CreateRef<PlanetNode>(A, B, C, 0);
+			uint32_t rootNode = generator.BasePlanetNodes.Allocate(1);
+			generator.BasePlanetNodes[rootNode] = PlanetNode(A, B, C, 0);
 			SubdivideBasePlanet(planet, rootNode, scale);
 
-			rootNode->UpdateBoundsFromChildren();
+			generator.BasePlanetNodes.UpdateBoundsFromChildren(rootNode);
 
-			sPlanetNodes.emplace_back(rootNode);
+			generator.BasePlanetNodes.Roots.emplace_back(rootNode);
 		}
 
+		if (!cachePath.empty())
+			PlanetBaseCache::Save(cachePath, cacheKey, generator.BasePlanetNodes);
+
+		// The patches are indexed by their base node so they can't outlive the base planet
+		generator.PatchCache.Reset(generator.BasePlanetNodes.Size());
+
 		// Stop timing
 		auto end = std::chrono::high_resolution_clock::now();
 
 		// Calculate the duration
 		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
 
-		TOAST_CORE_INFO("Base planet created with %d number of planet nodes, time: %dms", sPlanetNodes.size(), duration);
+		TOAST_CORE_INFO("Base planet created with %d number of planet nodes, time: %dms", generator.BasePlanetNodes.Size(), duration);
 	}
 
-	void PlanetSystem::DetailObjectPlacement(const PlanetComponent& planet, TerrainObjectComponent& objects, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR& camPos)
+	void PlanetSystem::ScatterObjects(const PlanetPatchGeometry& patch, const TerrainObjectComponent& objects, const siv::PerlinNoise& perlin, std::vector<DirectX::XMFLOAT3>& positions)
 	{
-		std::vector<DirectX::XMFLOAT3> objectPositions;
+		positions.clear();
 
-		Matrix planetTransform = { noScaleTransform };
-		Vector3 cameraPos = { camPos };
-
-		const siv::PerlinNoise& perlin = siv::PerlinNoise(static_cast<uint32_t>(19871102));
-
-		std::vector<Vertex> vertices = planet.RenderMesh->GetVertices();
-		std::vector<uint32_t> indices = planet.RenderMesh->GetIndices();
-		
-		if (indices.size() > 0 && vertices.size() > 0)
+		for (size_t i = 0; i + 2 < patch.Indices.size(); i += 3)
 		{
-			for (int i = 0; i < indices.size() - 2; i += 3)
-			{
-				Vector3 A = vertices[indices[i]].Position;
-				Vector3 B = vertices[indices[i + 1]].Position;
-				Vector3 C = vertices[indices[i + 2]].Position;
+			Vertex a = PlanetVertexCodec::Decode(patch.Vertices[patch.Indices[i]], patch.Frame);
+			Vertex b = PlanetVertexCodec::Decode(patch.Vertices[patch.Indices[i + 1]], patch.Frame);
+			Vertex c = PlanetVertexCodec::Decode(patch.Vertices[patch.Indices[i + 2]], patch.Frame);
 
-				double aDistance = (A - cameraPos).LengthSqrt();
-				double bDistance = (B - cameraPos).LengthSqrt();
-				double cDistance = (C - cameraPos).LengthSqrt();
+			Vector3 A = a.Position;
+			Vector3 B = b.Position;
+			Vector3 C = c.Position;
 
-				if (aDistance < planet.DistanceLUT[(uint32_t)objects.SubdivisionActivation] && bDistance < planet.DistanceLUT[(uint32_t)objects.SubdivisionActivation] && cDistance < planet.DistanceLUT[(uint32_t)objects.SubdivisionActivation])
-				{
-					Vector2 aUV = vertices[indices[i]].Texcoord;
-					Vector2 bUV = vertices[indices[i + 1]].Texcoord;
-					Vector2 cUV = vertices[indices[i + 2]].Texcoord;
+			Vector2 aUV = a.Texcoord;
+			Vector2 bUV = b.Texcoord;
+			Vector2 cUV = c.Texcoord;
 
-					Vector2 centerUV = (aUV + bUV + cUV) / 3.0;
+			Vector2 centerUV = (aUV + bUV + cUV) / 3.0;
 
-					double noiseValue = perlin.octave2D_01(centerUV.x, centerUV.y, 4);
-					int stonesInThisTriangle = static_cast<int>(std::round(static_cast<double>(objects.MaxNrOfObjectPerFace) * noiseValue));
+			double noiseValue = perlin.octave2D_01(centerUV.x, centerUV.y, 4);
+			int stonesInThisTriangle = static_cast<int>(std::round(static_cast<double>(objects.MaxNrOfObjectPerFace) * noiseValue));
 
-					if (stonesInThisTriangle > 0)
-					{
-						uint32_t seed = HashFace(indices[i], indices[i+1], indices[i+2]);
-						std::mt19937 rng(seed);
-						std::uniform_real_distribution<double> dist(0.0f, 1.0f);
-
-						for (int j = 0; j < stonesInThisTriangle; ++j) {
-							// Generate barycentric coordinates deterministically
-							double u = dist(rng);
-							double v = dist(rng);
-							if (u + v > 1.0f) {
-								u = 1.0f - u;
-								v = 1.0f - v;
-							}
-							float w = 1.0f - u - v;
-
-							// Calculate the object's local position
-							Vector3 objectPosition = A * u + B * v + C * w;
-
-							objectPositions.emplace_back(DirectX::XMFLOAT3(objectPosition.x, objectPosition.y, objectPosition.z));
-						}
+			if (stonesInThisTriangle > 0)
+			{
+				// Seeded from where the face is rather than its indices, so the objects stay put when the patch is rebuilt
+				uint64_t faceKey = PlanetVertexMap::GetPositionKey((A + B + C) / 3.0);
+				std::mt19937 rng(static_cast<uint32_t>(faceKey ^ (faceKey >> 32)));
+				std::uniform_real_distribution<double> dist(0.0f, 1.0f);
+
+				for (int j = 0; j < stonesInThisTriangle; ++j) {
+					// Generate barycentric coordinates deterministically
+					double u = dist(rng);
+					double v = dist(rng);
+					if (u + v > 1.0f) {
+						u = 1.0f - u;
+						v = 1.0f - v;
 					}
+					float w = 1.0f - u - v;
+
+					// Calculate the object's local position
+					Vector3 objectPosition = A * u + B * v + C * w;
+
+					positions.emplace_back(DirectX::XMFLOAT3(objectPosition.x, objectPosition.y, objectPosition.z));
 				}
 			}
 		}
-
-		if(objectPositions.size() > 0)
-			objects.MeshObject->SetInstanceData(&objectPositions[0], objectPositions.size() * sizeof(DirectX::XMFLOAT3), objectPositions.size());
 	}
 
-	void PlanetSystem::TraverseNode(Ref<PlanetNode>& node, PlanetComponent& planet, Vector3& cameraPosPlanetSpace, const Vector3& planetCenter, bool backfaceCull, bool frustumCullActivated, Ref<Frustum>& frustum, Matrix& planetTransform, const siv::PerlinNoise& perlin, TerrainDetailComponent* terrainDetail)
+	void PlanetSystem::DetailObjectPlacement(const PlanetComponent& planet, TerrainObjectComponent& objects, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR& camPos)
 	{
-		Vector3 center = (node->A.Position + node->B.Position + node->C.Position) / 3.0;
-		Vector3 viewVector = center - cameraPosPlanetSpace;
-		double cameraDistance = viewVector.Length();
+		TOAST_PROFILE_FUNCTION();
 
-		double dotProduct = Vector3::Dot(Vector3::Normalize(center), Vector3::Normalize(viewVector));
+		if (planet.DistanceLUT.empty() || !objects.MeshObject)
+			return;
 
-		//TOAST_CORE_CRITICAL("TraverseNode: Node subdivision=%d, cameraDistance=%.2f, dotProduct=%.2f",
-		//	node->SubdivisionLevel, cameraDistance, dotProduct);
+		Matrix planetTransform = { noScaleTransform };
+		Vector3 cameraPos = { camPos };
+		Vector3 cameraPosPlanetSpace = Matrix::Inverse(planetTransform) * cameraPos;
 
-		Ref<PlanetNode> nodeWorldSpace = CreateRef<PlanetNode>(*node);
+		size_t activationLevel = (std::min)((size_t)(std::max)(objects.SubdivisionActivation, 0), planet.DistanceLUT.size() - 1);
+		double activationDistanceSqr = planet.DistanceLUT[activationLevel];
+		double activationDistance = sqrt(activationDistanceSqr);
 
-		nodeWorldSpace->A = planetTransform * node->A.Position;
-		nodeWorldSpace->B = planetTransform * node->B.Position;
-		nodeWorldSpace->C = planetTransform * node->C.Position;
-		planet.PlanetNodesWorldSpace.emplace_back(nodeWorldSpace);
+		const siv::PerlinNoise perlin(static_cast<uint32_t>(19871102));
 
-		double backFaceCullingIgnoreDistance = 50000.0;
-		if (cameraDistance > backFaceCullingIgnoreDistance)
+		// Every visible patch within the activation distance is a cell, scattered when it comes into range or its patch is rebuilt
+		bool cellsChanged = false;
+		for (auto& [key, cell] : objects.Cells)
+			cell.Active = false;
+
+		planet.MeshLayout.ForEachPatch([&](const Ref<PlanetPatchGeometry>& patch)
 		{
-			TOAST_PROFILE_SCOPE("Backface culling test");
-			std::lock_guard<std::mutex> lock(planetDataMutex);
-			if (backfaceCull && dotProduct >= planet.FaceLevelDotLUT[(uint32_t)node->SubdivisionLevel])
-			{
-				//TOAST_CORE_CRITICAL("TraverseNode: Node culled by backface (subdivision %d, dotProduct=%.2f, threshold=%.2f)",
-					//node->SubdivisionLevel, dotProduct, planet.FaceLevelDotLUT[(uint32_t)node->SubdivisionLevel]);
+			if (patch->Nodes.Empty() || GetDistanceToBounds(patch->Nodes[0].NodeBounds, cameraPosPlanetSpace) >= activationDistance)
 				return;
-			}
-		}
-		 
-		if (frustumCullActivated)
+
+			TerrainObjectComponent::Cell& cell = objects.Cells[patch->Key];
+			cell.Active = true;
+
+			if (cell.Geometry == patch)
+				return;
+
+			cell.Geometry = patch;
+			ScatterObjects(*patch, objects, perlin, cell.Positions);
+			cellsChanged = true;
+		});
+
+		for (auto it = objects.Cells.begin(); it != objects.Cells.end();)
 		{
-			TOAST_PROFILE_SCOPE("Frustum culling test");
-			auto intersect = frustum->ContainsTriangleVolume(Vector3::Normalize(node->A.Position) * planet.PlanetData.radius, Vector3::Normalize(node->B.Position) * planet.PlanetData.radius, Vector3::Normalize(node->C.Position) * planet.PlanetData.radius, planet.HeightMultLUT[node->SubdivisionLevel]);
+			if (it->second.Active)
+			{
+				++it;
+				continue;
+			}
+
+			it = objects.Cells.erase(it);
+			cellsChanged = true;
+		}
+
+		// The instances are in world space and follow the planet whenever it moves
+		bool planetMoved = false;
+		for (int i = 0; i < 16 && !planetMoved; i++)
+			planetMoved = planetTransform.element(i / 4, i % 4) != objects.GatherPlanetTransform.element(i / 4, i % 4);
+
+		// Without changed cells the instances only have to be picked again once the camera has moved a bit
+		double regatherDistance = activationDistance * PLANET_OBJECT_REGATHER_DISTANCE;
+		if (!cellsChanged && !planetMoved && (cameraPos - objects.GatherCameraPos).LengthSqrt() < regatherDistance * regatherDistance)
+			return;
+
+		objects.GatherCameraPos = cameraPos;
+		objects.GatherPlanetTransform = planetTransform;
+
+		sObjectCandidates.clear();
+		for (auto& [key, cell] : objects.Cells)
+		{
+			for (auto& position : cell.Positions)
+			{
+				// Objects are scattered on the patches in planet space, the instances are drawn in world space
+				Vector3 worldPosition = planetTransform * Vector3(position);
+				double distance = (worldPosition - cameraPos).LengthSqrt();
+				if (distance < activationDistanceSqr)
+					sObjectCandidates.emplace_back(distance, DirectX::XMFLOAT3((float)worldPosition.x, (float)worldPosition.y, (float)worldPosition.z));
+			}
+		}
+
+		// The instance buffer holds MaxNrOfObjects, the nearest objects are kept when there are more
+		size_t budget = (size_t)(std::max)(objects.MaxNrOfObjects, 0);
+		if (sObjectCandidates.size() > budget)
+		{
+			std::nth_element(sObjectCandidates.begin(), sObjectCandidates.begin() + budget, sObjectCandidates.end(),
+				[](const auto& a, const auto& b) { return a.first < b.first; });
+			sObjectCandidates.resize(budget);
+		}
+
+		objects.Instances.clear();
+		for (auto& candidate : sObjectCandidates)
+			objects.Instances.emplace_back(candidate.second);
+
+		objects.MeshObject->SetInstanceData(objects.Instances.data(), (uint32_t)(objects.Instances.size() * sizeof(DirectX::XMFLOAT3)), (uint32_t)objects.Instances.size());
+	}
 
-			if (intersect == VolumeTri::OUTSIDE)
+	void PlanetSystem::GetNodeBoundingSphere(const PlanetNode& node, const PlanetTraversalData& traversal, Vector3& center, double& radius)
+	{
+		// The terrain of the node is within the cone over its corners and the height range of the planet. Sphere around
+		// that piece of the shell, the corners are at most cornerAngle from the axis of the cone
+		Vector3 axis = Vector3::Normalize(Vector3::Normalize(node.A.Position) + Vector3::Normalize(node.B.Position) + Vector3::Normalize(node.C.Position));
+		double cosCorner = (std::min)(Vector3::Dot(axis, Vector3::Normalize(node.A.Position)), (std::min)(Vector3::Dot(axis, Vector3::Normalize(node.B.Position)), Vector3::Dot(axis, Vector3::Normalize(node.C.Position))));
+		double sinCorner = sqrt((std::max)(1.0 - cosCorner * cosCorner, 0.0));
+
+		double bottom = (std::max)(traversal.OccluderRadius, 0.0) * cosCorner;
+		double top = (std::max)(traversal.MaxTerrainRadius, traversal.OccluderRadius);
+		center = axis * ((bottom + top) * 0.5);
+		double halfHeight = (top - bottom) * 0.5;
+		radius = sqrt(halfHeight * halfHeight + top * sinCorner * top * sinCorner);
+	}
+
+	bool PlanetSystem::IsBehindHorizon(const Vector3& center, double radius, const PlanetTraversalData& traversal)
+	{
+		double cameraDistance = traversal.CameraPosPlanetSpace.Length();
+		double occluderRadius = traversal.OccluderRadius;
+		if (cameraDistance <= occluderRadius || occluderRadius <= 0.0)
+			return false;
+
+		// Nothing below the lowest terrain is visible, so the sphere at that radius hides everything in its shadow: the
+		// cone from the camera that touches it, beyond the plane through its horizon circle
+		Vector3 cameraDirection = traversal.CameraPosPlanetSpace / cameraDistance;
+		if (Vector3::Dot(center, cameraDirection) + radius >= occluderRadius * occluderRadius / cameraDistance)
+			return false;
+
+		double sinCone = occluderRadius / cameraDistance;
+		double cosCone = sqrt(1.0 - sinCone * sinCone);
+
+		Vector3 toCenter = center - traversal.CameraPosPlanetSpace;
+		double alongAxis = -Vector3::Dot(toCenter, cameraDirection);
+		double fromAxis = sqrt((std::max)(toCenter.LengthSqrt() - alongAxis * alongAxis, 0.0));
+
+		// Distance from the sphere center to the side of the cone, positive inside
+		return alongAxis * sinCone - fromAxis * cosCone >= radius;
+	}
+
+	bool PlanetSystem::IsBackfacing(const PlanetNode* node, const PlanetTraversalData& traversal)
+	{
+		Vector3 center = (node->A.Position + node->B.Position + node->C.Position) / 3.0;
+		Vector3 viewVector = center - traversal.CameraPosPlanetSpace;
+		double cameraDistance = viewVector.Length();
+
+		double dotProduct = Vector3::Dot(Vector3::Normalize(center), Vector3::Normalize(viewVector));
+
+		//TOAST_CORE_CRITICAL("TraverseNode: Node subdivision=%d, cameraDistance=%.2f, dotProduct=%.2f",
+		//	node->SubdivisionLevel, cameraDistance, dotProduct);
+
+		double backFaceCullingIgnoreDistance = 50000.0;
+		if (cameraDistance > backFaceCullingIgnoreDistance)
+		{
+			TOAST_PROFILE_SCOPE("Backface culling test");
+			if (traversal.BackfaceCull && dotProduct >= traversal.FaceLevelDotLUT[(uint32_t)node->SubdivisionLevel])
 			{
-				//TOAST_CORE_CRITICAL("TraverseNode: Node culled by frustum (subdivision %d)", node->SubdivisionLevel);
+				//TOAST_CORE_CRITICAL("TraverseNode: Node culled by backface (subdivision %d, dotProduct=%.2f, threshold=%.2f)",
+					//node->SubdivisionLevel, dotProduct, planet.FaceLevelDotLUT[(uint32_t)node->SubdivisionLevel]);
+				return true;
+			}
+		}
+
+		return false;
+	}
 
+	bool PlanetSystem::CullNode(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		PlanetGenerator& generator = *planet.Generator;
+
+		const PlanetNode& node = generator.BasePlanetNodes[baseIndex];
+
+		if (IsBackfacing(&node, traversal))
+			return true;
+
+		Vector3 center;
+		double radius;
+		GetNodeBoundingSphere(node, traversal, center, radius);
+
+		// Close to the ground most of the planet is hidden by its own curvature, which the backface test doesn't see
+		if (traversal.BackfaceCull)
+		{
+			TOAST_PROFILE_SCOPE("Horizon culling test");
+			if (IsBehindHorizon(center, radius, traversal))
+				return true;
+		}
+
+		if (traversal.FrustumCullActivated)
+		{
+			TOAST_PROFILE_SCOPE("Frustum culling test");
+			if (!traversal.CameraFrustum->ContainsSphere(center, radius, true))
+				return true;
+		}
+
+		return false;
+	}
+
+	void PlanetSystem::CullNodes(std::vector<uint32_t>& nodes, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		PlanetGenerator& generator = *planet.Generator;
+
+		static thread_local BoundingSphereBatch sSpheres;
+		static thread_local std::vector<uint8_t> sVisible;
+
+		sSpheres.Clear();
+		size_t kept = 0;
+		for (uint32_t baseIndex : nodes)
+		{
+			const PlanetNode& node = generator.BasePlanetNodes[baseIndex];
+
+			if (IsBackfacing(&node, traversal))
+				continue;
+
+			Vector3 center;
+			double radius;
+			GetNodeBoundingSphere(node, traversal, center, radius);
+
+			if (traversal.BackfaceCull && IsBehindHorizon(center, radius, traversal))
+				continue;
+
+			nodes[kept++] = baseIndex;
+			sSpheres.Add(center, radius);
+		}
+		nodes.resize(kept);
+
+		if (!traversal.FrustumCullActivated)
+			return;
+
+		traversal.CameraFrustum->CullSpheres(sSpheres, sVisible, true);
+
+		kept = 0;
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			if (sVisible[i])
+				nodes[kept++] = nodes[i];
+		}
+		nodes.resize(kept);
+	}
+
+	void PlanetSystem::CollectTraversalJobs(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		PlanetGenerator& generator = *planet.Generator;
+
+		const PlanetNode& node = generator.BasePlanetNodes[baseIndex];
+
+		// Nodes at the job level and deeper are handed to the workers, everything above is culled here on the generation thread
+		if (node.SubdivisionLevel >= PLANET_JOB_SUBDIVISION || node.IsLeaf())
+		{
+			generator.TraversalJobs.push_back({ baseIndex });
+			return;
+		}
+
+		if (CullNode(baseIndex, planet, traversal))
+			return;
+
+		for (uint32_t i = 0; i < node.ChildCount; i++)
+			CollectTraversalJobs(node.FirstChild + i, planet, traversal);
+	}
+
+	void PlanetSystem::TraverseNode(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal, PlanetBuildOutput& output)
+	{
+		PlanetGenerator& generator = *planet.Generator;
+
+		// The subtree of the job is walked one level at a time so the nodes of a level are culled in one batch
+		static thread_local std::vector<uint32_t> sLevel;
+		static thread_local std::vector<uint32_t> sNextLevel;
+
+		sLevel.assign(1, baseIndex);
+		while (!sLevel.empty())
+		{
+			if (traversal.IsCancelled())
 				return;
+
+			CullNodes(sLevel, planet, traversal);
+
+			sNextLevel.clear();
+			for (uint32_t index : sLevel)
+			{
+				const PlanetNode& node = generator.BasePlanetNodes[index];
+
+				if (traversal.FixedLOD)
+				{
+					auto fixedPatch = generator.FixedLODPatches.find(index);
+					if (fixedPatch != generator.FixedLODPatches.end())
+					{
+						output.Patches.emplace_back(fixedPatch->second);
+						continue;
+					}
+				}
+
+				if (node.SubdivisionLevel >= BASE_PLANET_SUBDIVISIONS)
+				{
+					if (traversal.IsCancelled())
+						return;
+
+					UpdatePatch(index, planet, traversal, output);
+				}
+				else
+				{
+					for (uint32_t i = 0; i < node.ChildCount; i++)
+						sNextLevel.push_back(node.FirstChild + i);
+				}
+			}
+
+			std::swap(sLevel, sNextLevel);
+		}
+	}
+
+	void PlanetSystem::BuildFixedLODPatches(PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		PlanetGenerator& generator = *planet.Generator;
+
+		std::vector<Vertex> vertices;
+
+		// Same nodes the traversal jobs start from
+		std::vector<uint32_t> stack(generator.BasePlanetNodes.Roots.begin(), generator.BasePlanetNodes.Roots.end());
+		while (!stack.empty())
+		{
+			uint32_t baseIndex = stack.back();
+			stack.pop_back();
+
+			const PlanetNode& node = generator.BasePlanetNodes[baseIndex];
+			if (node.SubdivisionLevel < PLANET_JOB_SUBDIVISION && !node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.ChildCount; i++)
+					stack.push_back(node.FirstChild + i);
+
+				continue;
 			}
+
+			Ref<PlanetPatchGeometry> geometry = CreateRef<PlanetPatchGeometry>();
+			geometry->Key = baseIndex;
+
+			vertices.clear();
+			EmitFixedLODNode(*geometry, vertices, baseIndex, planet, traversal);
+
+			// Nothing is scattered on these patches, the frame can be fitted to the vertices
+			Vector3 mins = vertices.empty() ? Vector3(0.0, 0.0, 0.0) : Vector3(vertices[0].Position), maxs = mins;
+			for (const Vertex& vertex : vertices)
+			{
+				mins = Vector3((std::min)(mins.x, (double)vertex.Position.x), (std::min)(mins.y, (double)vertex.Position.y), (std::min)(mins.z, (double)vertex.Position.z));
+				maxs = Vector3((std::max)(maxs.x, (double)vertex.Position.x), (std::max)(maxs.y, (double)vertex.Position.y), (std::max)(maxs.z, (double)vertex.Position.z));
+			}
+
+			geometry->Frame = PlanetVertexCodec::CreateFrame(mins, maxs);
+			PlanetVertexCodec::Encode(vertices, geometry->Frame, geometry->Vertices);
+
+			generator.FixedLODPatches[baseIndex] = geometry;
 		}
+	}
 
-		//TOAST_CORE_CRITICAL("node->SubdivisionLevel going to subdivision: %d", node->SubdivisionLevel);
+	void PlanetSystem::EmitFixedLODNode(PlanetPatchGeometry& geometry, std::vector<Vertex>& vertices, uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		const PlanetNode& node = planet.Generator->BasePlanetNodes[baseIndex];
 
-		if (node->SubdivisionLevel >= BASE_PLANET_SUBDIVISIONS)
+		if (node.SubdivisionLevel < PLANET_FIXED_LOD_SUBDIVISION && !node.IsLeaf())
 		{
-			//TOAST_CORE_CRITICAL("TraverseNode: Processing face at subdivision %d", node->SubdivisionLevel);
+			for (uint32_t i = 0; i < node.ChildCount; i++)
+				EmitFixedLODNode(geometry, vertices, node.FirstChild + i, planet, traversal);
 
-			SubdivideFace(nodeWorldSpace, node->A, node->B, node->C, cameraPosPlanetSpace, planet, planetCenter, planetTransform, BASE_PLANET_SUBDIVISIONS, perlin, terrainDetail);
+			return;
 		}
-		else 
+
+		Vector3 vecA = node.A.Position;
+		Vector3 vecB = node.B.Position;
+		Vector3 vecC = node.C.Position;
+
+		Vector3 normal = Vector3::Normalize(Vector3::Cross(vecB - vecA, vecC - vecA));
+
+		// Same height map normals as the patches so nothing changes in the shading when the planet switches to them
+		bool analytic = traversal.AnalyticNormals;
+		vertices.emplace_back(Vertex(vecA, node.A.UV, analytic ? GetAnalyticNormal(node.A, planet, traversal) : normal));
+		geometry.Indices.emplace_back((uint32_t)vertices.size() - 1);
+		vertices.emplace_back(Vertex(vecB, node.B.UV, analytic ? GetAnalyticNormal(node.B, planet, traversal) : normal));
+		geometry.Indices.emplace_back((uint32_t)vertices.size() - 1);
+		vertices.emplace_back(Vertex(vecC, node.C.UV, analytic ? GetAnalyticNormal(node.C, planet, traversal) : normal));
+		geometry.Indices.emplace_back((uint32_t)vertices.size() - 1);
+	}
+
+	void PlanetSystem::CollectPrefetchPatches(uint32_t baseIndex, double relief, PlanetComponent& planet, PlanetTraversalData& traversal)
+	{
+		PlanetGenerator& generator = *planet.Generator;
+
+		const PlanetNode& node = generator.BasePlanetNodes[baseIndex];
+
+		// No node below this one can split further away than the split distance of a node with its longest edge and
+		// all of the terrain's relief inside it
+		double edgeLength = sqrt((std::max)((node.A.Position - node.B.Position).LengthSqrt(), (std::max)((node.B.Position - node.C.Position).LengthSqrt(), (node.C.Position - node.A.Position).LengthSqrt())));
+		double maxSplitDistance = GetGeometricError(edgeLength, relief, traversal.Radius) * traversal.LODErrorScale;
+
+		if (GetDistanceToBounds(node.NodeBounds, traversal.PrefetchPosPlanetSpace) - relief > maxSplitDistance)
+			return;
+
+		if (node.SubdivisionLevel >= BASE_PLANET_SUBDIVISIONS || node.IsLeaf())
 		{
-			for (auto& child : node->ChildNodes)
-				TraverseNode(child, planet, cameraPosPlanetSpace, planetCenter, backfaceCull, frustumCullActivated, frustum, planetTransform, perlin, terrainDetail);
+			generator.PrefetchPatches.push_back(baseIndex);
+			return;
 		}
+
+		for (uint32_t i = 0; i < node.ChildCount; i++)
+			CollectPrefetchPatches(node.FirstChild + i, relief, planet, traversal);
 	}
 
-	void PlanetSystem::GeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated,  PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail)
+	void PlanetSystem::PrefetchNode(const CPUVertex& A, const CPUVertex& B, const CPUVertex& C, int16_t subdivision, PlanetComponent& planet, PlanetTraversalData& traversal, std::atomic<int64_t>& budget)
+	{
+		if (subdivision >= BASE_PLANET_SUBDIVISIONS + planet.Subdivisions || traversal.IsCancelled())
+			return;
+
+		// Same split decision as UpdatePatchNode, made from the predicted camera position
+		const Vector3& predictedPos = traversal.PrefetchPosPlanetSpace;
+		double furthestDistance = (std::max)((A.Position - predictedPos).LengthSqrt(), (std::max)((B.Position - predictedPos).LengthSqrt(), (C.Position - predictedPos).LengthSqrt()));
+		if (furthestDistance >= GetNodeSplitDistance(A, B, C, traversal))
+			return;
+
+		if (budget.fetch_sub(1, std::memory_order_relaxed) <= 0)
+			return;
+
+		CPUVertex midpoints[3];
+		const CPUVertex* starts[3] = { &B, &C, &A };
+		const CPUVertex* ends[3] = { &C, &A, &B };
+		ComputeMidpoints(starts, ends, midpoints, 3, planet, traversal.Perlin, traversal.TerrainDetail, subdivision);
+
+		const CPUVertex& aMid = midpoints[0];
+		const CPUVertex& bMid = midpoints[1];
+		const CPUVertex& cMid = midpoints[2];
+
+		PrefetchNode(aMid, bMid, cMid, (int16_t)(subdivision + 1), planet, traversal, budget);
+		PrefetchNode(cMid, bMid, A, (int16_t)(subdivision + 1), planet, traversal, budget);
+		PrefetchNode(B, aMid, cMid, (int16_t)(subdivision + 1), planet, traversal, budget);
+		PrefetchNode(bMid, aMid, C, (int16_t)(subdivision + 1), planet, traversal, budget);
+	}
+
+	void PlanetSystem::MergeBuildOutputs(PlanetComponent& planet)
 	{
 		TOAST_PROFILE_FUNCTION();
 
+		PlanetGenerator& generator = *planet.Generator;
+
+		PlanetBuildOutput& build = planet.Build;
+
+		size_t totalPatches = 0;
+		for (size_t job = 0; job < generator.TraversalJobs.size(); job++)
+			totalPatches += generator.JobOutputs[job].Patches.size();
+
+		build.Patches.reserve(totalPatches);
+
+		uint32_t patchesRebuilt = 0;
+
+		// Jobs are merged in the order they were collected so the result matches a serial traversal
+		for (size_t job = 0; job < generator.TraversalJobs.size(); job++)
+		{
+			PlanetBuildOutput& output = generator.JobOutputs[job];
+
+			build.Patches.insert(build.Patches.end(), output.Patches.begin(), output.Patches.end());
+			patchesRebuilt += output.PatchesRebuilt;
+		}
+
+		build.PatchesRebuilt = patchesRebuilt;
+
+		generator.PatchCache.EndGeneration(build.Patches, patchesRebuilt);
+	}
+
+	bool PlanetPatchSettings::operator==(const PlanetPatchSettings& other) const
+	{
+		if (Subdivisions != other.Subdivisions || SmoothShading != other.SmoothShading || AnalyticNormals != other.AnalyticNormals || Radius != other.Radius)
+			return false;
+
+		if (HasTerrainDetail != other.HasTerrainDetail)
+			return false;
+
+		if (HasTerrainDetail)
+		{
+			return TerrainDetail.Seed == other.TerrainDetail.Seed && TerrainDetail.SubdivisionActivation == other.TerrainDetail.SubdivisionActivation
+				&& TerrainDetail.Octaves == other.TerrainDetail.Octaves && TerrainDetail.Frequency == other.TerrainDetail.Frequency && TerrainDetail.Amplitude == other.TerrainDetail.Amplitude;
+		}
+
+		return true;
+	}
+
+	void PlanetSystem::GeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated,  PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail, bool prefetch, Vector3 prefetchPosPlanetSpace)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		PlanetGenerator& generator = *planet.Generator;
+
 		auto start = std::chrono::high_resolution_clock::now();
 
 		//TOAST_CORE_INFO("Planet build started on planet thread");
 
-		planetGenerationOngoing.store(true);
+		generator.PlanetGenerationOngoing.store(true);
 
 		siv::PerlinNoise perlin;
 
@@ -688,24 +1506,75 @@ namespace Toast {
 		Matrix planetTransform = { noScaleTransform };
 		Vector3 cameraPos = { camPos };
 
-		Vector3 cameraPosPlanetSpace = Matrix::Inverse(planetTransform) * cameraPos;
-
-		//cameraPosPlanetSpace.ToString("Camera pos in planet space: ");
+		PlanetTraversalData traversal;
+		traversal.CameraPosPlanetSpace = Matrix::Inverse(planetTransform) * cameraPos;
+		traversal.PlanetCenter = planetCenter;
+		traversal.BackfaceCull = backfaceCull;
+		traversal.FrustumCullActivated = frustumCullActivated;
+		traversal.CameraFrustum = frustum;
+		traversal.Perlin = &perlin;
+		traversal.TerrainDetail = terrainDetail;
+		traversal.Cancelled = &generator.GenerationCancelled;
+		traversal.Prefetch = prefetch;
+		traversal.PrefetchPosPlanetSpace = prefetchPosPlanetSpace;
+
+		//traversal.CameraPosPlanetSpace.ToString("Camera pos in planet space: ");
 		
+		PlanetPatchSettings settings;
 		{
-			std::lock_guard<std::mutex> lock(planetDataMutex);
+			std::lock_guard<std::mutex> lock(generator.PlanetDataMutex);
+
+			traversal.FaceLevelDotLUT = planet.FaceLevelDotLUT;
+			traversal.LODErrorScale = planet.LODErrorScale * planet.LODBudgetScale;
+			traversal.Radius = planet.PlanetData.radius;
+			traversal.AnalyticNormals = planet.AnalyticNormals;
+			traversal.NormalMip = GetTerrainMip(planet.TerrainData, (int16_t)(planet.Subdivisions + BASE_PLANET_SUBDIVISIONS));
+
+			// Height samples are never below HeightOffset and the detail noise only adds to them
+			traversal.OccluderRadius = planet.PlanetData.radius + planet.TerrainData.HeightOffset;
+			traversal.MaxTerrainRadius = traversal.OccluderRadius + planet.TerrainData.HeightScale * MAX_INT_VALUE;
+			if (terrainDetail)
+				traversal.MaxTerrainRadius += terrainDetail->Amplitude;
+
+			// The render thread only reads the build once NewPlanetReady is set
+			planet.Build.Clear();
+			planet.Build.LODBudgetScale = planet.LODBudgetScale;
+
+			settings.LODErrorScale = traversal.LODErrorScale;
+			settings.Subdivisions = planet.Subdivisions;
+			settings.SmoothShading = planet.PlanetData.smoothShading;
+			settings.AnalyticNormals = planet.AnalyticNormals;
+			settings.Radius = planet.PlanetData.radius;
+			settings.HasTerrainDetail = terrainDetail != nullptr;
+			if (terrainDetail)
+				settings.TerrainDetail = *terrainDetail;
+
+			planet.TerrainChunks.clear();
+		}
 
-			planet.VertexMap.clear();
-			planet.BuildVertices.clear();
-			planet.BuildIndices.clear();
+		// Far away the planet only covers a few pixels, it's drawn with the fixed LOD without visiting any patches
+		traversal.FixedLOD = traversal.CameraPosPlanetSpace.Length() > traversal.Radius * PLANET_FIXED_LOD_DISTANCE;
+		if (traversal.FixedLOD)
+			traversal.Prefetch = false;
 
-			planet.PlanetNodesWorldSpace.clear();
+		// The cached patches are only valid for the settings they were built with
+		if (!(settings == generator.PatchSettings))
+		{
+			generator.PatchCache.Clear();
+			generator.MidpointCache.Clear();
+			generator.FixedLODPatches.clear();
 
-			planet.TerrainChunks.clear();
+			generator.PatchSettings = settings;
+		}
+		else if (settings.LODErrorScale != generator.PatchSettings.LODErrorScale)
+		{
+			generator.PatchCache.Invalidate();
+
+			generator.PatchSettings.LODErrorScale = settings.LODErrorScale;
 		}
 
 		{
-			std::lock_guard<std::mutex> lock(terrainCollidersMutex);
+			std::lock_guard<std::mutex> lock(generator.TerrainCollidersMutex);
 			terrainColliders.clear();
 			terrainColliderPositions.clear();
 		}
@@ -713,14 +1582,108 @@ namespace Toast {
 		{
 			TOAST_PROFILE_SCOPE("Looping through the tree structure!");
 
-			for (auto& node : sPlanetNodes) 
-				TraverseNode(node, planet, cameraPosPlanetSpace, planetCenter, backfaceCull, frustumCullActivated, frustum, planetTransform, perlin, terrainDetail);
+			generator.PatchCache.BeginGeneration();
+
+			if (traversal.FixedLOD && generator.FixedLODPatches.empty())
+				BuildFixedLODPatches(planet, traversal);
+
+			generator.TraversalJobs.clear();
+			for (uint32_t root : generator.BasePlanetNodes.Roots)
+				CollectTraversalJobs(root, planet, traversal);
+
+			// Outputs are kept between generations so their capacity is reused
+			if (generator.JobOutputs.size() < generator.TraversalJobs.size())
+				generator.JobOutputs.resize(generator.TraversalJobs.size());
+			for (auto& output : generator.JobOutputs)
+				output.Clear();
+
+			std::atomic<size_t> nextJob{ 0 };
+			auto worker = [&]()
+			{
+				size_t jobIndex;
+				while (!traversal.IsCancelled() && (jobIndex = nextJob.fetch_add(1)) < generator.TraversalJobs.size())
+				{
+					PlanetBuildOutput& output = generator.JobOutputs[jobIndex];
+					TraverseNode(generator.TraversalJobs[jobIndex].BaseNode, planet, traversal, output);
+				}
+			};
+
+			// The generation thread works on the jobs as well, planets generated at the same time share the pool
+			WorkerPool& pool = WorkerPool::Get();
+			uint32_t activeGenerations = sActiveGenerations.fetch_add(1) + 1;
+			pool.Run(worker, pool.GetThreadCount() / activeGenerations);
 
-			for (auto& vertex : planet.BuildVertices) {
-				Vector3 normal(vertex.Normal.x, vertex.Normal.y, vertex.Normal.z);
-				normal = Vector3::Normalize(normal);
-				vertex.Normal = { (float)normal.x, (float)normal.y, (float)normal.z };
+			sActiveGenerations.fetch_sub(1);
+
+			// A newer camera pose is waiting, the half finished build is dropped. The patches that were updated stay
+			// valid for the next build since they only depend on the camera through their split decisions
+			if (traversal.IsCancelled())
+			{
+				generator.LastBuildCancelled = true;
+				generator.PlanetGenerationOngoing.store(false);
+				return;
 			}
+
+			MergeBuildOutputs(planet);
+
+			if (planet.Build.Patches.empty())
+				TOAST_CORE_CRITICAL("Empty planet!!");
+
+			// The build is handed over before the look-ahead pass, it only warms the caches for the next one. From here on
+			// a cancel only stops the look-ahead, one that came in after the traversal finished didn't drop anything
+			generator.LastBuildCancelled = false;
+			generator.PrefetchCancelled.store(false);
+			generator.PrefetchOngoing.store(true);
+			generator.GenerationCancelled.store(false);
+			generator.NewPlanetReady.store(true);
+
+			traversal.Cancelled = &generator.PrefetchCancelled;
+
+			uint32_t prefetchSplits = 0;
+			if (traversal.Prefetch)
+			{
+				TOAST_PROFILE_SCOPE("Prefetching planet patches");
+
+				double relief = planet.TerrainData.HeightScale * MAX_INT_VALUE;
+				if (terrainDetail)
+					relief += terrainDetail->Amplitude;
+
+				generator.PrefetchPatches.clear();
+				for (uint32_t root : generator.BasePlanetNodes.Roots)
+					CollectPrefetchPatches(root, relief, planet, traversal);
+
+				// Nearest first so the budget is spent where the camera arrives first
+				const Vector3& predictedPos = traversal.PrefetchPosPlanetSpace;
+				std::sort(generator.PrefetchPatches.begin(), generator.PrefetchPatches.end(), [&generator, &predictedPos](uint32_t a, uint32_t b)
+				{
+					return GetDistanceToBounds(generator.BasePlanetNodes[a].NodeBounds, predictedPos) < GetDistanceToBounds(generator.BasePlanetNodes[b].NodeBounds, predictedPos);
+				});
+
+				std::atomic<size_t> nextPatch{ 0 };
+				std::atomic<int64_t> budget{ PLANET_PREFETCH_BUDGET };
+				auto prefetchWorker = [&]()
+				{
+					size_t patchIndex;
+					while (budget.load(std::memory_order_relaxed) > 0 && !traversal.IsCancelled() && (patchIndex = nextPatch.fetch_add(1)) < generator.PrefetchPatches.size())
+					{
+						const PlanetNode& node = generator.BasePlanetNodes[generator.PrefetchPatches[patchIndex]];
+						PrefetchNode(node.A, node.B, node.C, (int16_t)node.SubdivisionLevel, planet, traversal, budget);
+					}
+				};
+
+				// Fewer workers than the build so the render and main threads keep some room
+				WorkerPool& pool = WorkerPool::Get();
+				pool.Run(prefetchWorker, pool.GetThreadCount() / 2);
+
+				prefetchSplits = (uint32_t)(PLANET_PREFETCH_BUDGET - (std::max)(budget.load(), (int64_t)0));
+			}
+			generator.PatchCache.GetStats().PrefetchSplits = prefetchSplits;
+
+			generator.PrefetchOngoing.store(false);
+
+			// All workers are done so the tiles they didn't touch lately can be unmapped
+			if (planet.TerrainData.Tiles)
+				planet.TerrainData.Tiles->Trim();
 		}
 
 		//for (const auto& chunkEntry : planet.TerrainChunks)
@@ -732,7 +1695,7 @@ namespace Toast {
 		//		continue;
 
 		//	{
-		//		std::lock_guard<std::mutex> lock(terrainCollidersMutex);
+		//		std::lock_guard<std::mutex> lock(generator.TerrainCollidersMutex);
 		//		terrainColliderPositions[chunkKey].insert(terrainColliderPositions[chunkKey].end(), verticesInChunk.begin(), verticesInChunk.end());
 		//	}
 
@@ -747,11 +1710,7 @@ namespace Toast {
 		//	terrainColliders[chunkKey] = collider;
 		//}
 
-		newPlanetReady.store(true);
-		planetGenerationOngoing.store(false);
-
-		if (planet.BuildVertices.size() == 0)
-			TOAST_CORE_CRITICAL("Empty planet!!");
+		generator.PlanetGenerationOngoing.store(false);
 
 		// Stop timing
 		auto end = std::chrono::high_resolution_clock::now();
@@ -759,132 +1718,598 @@ namespace Toast {
 		// Calculate the duration
 		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
 
-		//TOAST_CORE_INFO("Planet created with %d number of vertices and %d number indices, time: %dms", planet.BuildVertices.size(), planet.BuildIndices.size(), duration.count());
+		//TOAST_CORE_INFO("Planet created with %d patches, %d rebuilt, time: %dms", planet.Build.Patches.size(), generator.PatchCache.GetStats().PatchesRebuilt, duration.count());
 
 		return;
 	}
 
-	void PlanetSystem::RegeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated, PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail)
+	void PlanetSystem::RegeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated, PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail, const Vector3* cameraVelocity)
 	{
-		if (generationFuture.valid() && generationFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		PlanetGenerator& generator = GetGenerator(planet);
+
+		Matrix inverseTransform = Matrix::Inverse(Matrix(noScaleTransform));
+		Vector3 cameraPosPlanetSpace = inverseTransform * Vector3(camPos);
+
+		// Planet space velocity of the camera, from its rigid body when it has one and from its last positions otherwise
+		auto now = std::chrono::steady_clock::now();
+		double elapsed = std::chrono::duration<double>(now - generator.LastCameraTime).count();
+		if (cameraVelocity)
+			generator.CameraVelocity = inverseTransform * (Vector3(camPos) + *cameraVelocity) - cameraPosPlanetSpace;
+		else if (elapsed > 0.0 && elapsed < 1.0)
+			generator.CameraVelocity = generator.CameraVelocity * (1.0 - PLANET_VELOCITY_SMOOTHING) + ((cameraPosPlanetSpace - generator.LastCameraPos) / elapsed) * PLANET_VELOCITY_SMOOTHING;
+		else
+			generator.CameraVelocity = Vector3(0.0, 0.0, 0.0);
+		generator.LastCameraPos = cameraPosPlanetSpace;
+		generator.LastCameraTime = now;
+
+		if (generator.GenerationFuture.valid() && generator.GenerationFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			// Latest camera wins, a build started from a camera that has moved far compared to its altitude is cancelled
+			// and the next call starts over from the new pose. Near the ground the split distance of the finest level
+			// stands in for the altitude so not every small step cancels
+			size_t finestLevel = (size_t)(std::max)(planet.Subdivisions - 1, 0);
+			double minAltitude = planet.DistanceLUT.empty() ? 0.0 : sqrt(planet.DistanceLUT[(std::min)(finestLevel, planet.DistanceLUT.size() - 1)]);
+			double altitude = (std::max)(cameraPosPlanetSpace.Length() - (double)planet.PlanetData.radius, minAltitude);
+			double moved = (cameraPosPlanetSpace - generator.GenerationCameraPos).Length();
+			if (generator.GenerationRestarts < PLANET_GENERATION_MAX_RESTARTS && moved > altitude * PLANET_GENERATION_RESTART_DISTANCE)
+			{
+				// Once the build is handed over only the look-ahead is left to stop, that doesn't count as a restart
+				if (generator.PrefetchOngoing.load())
+					generator.PrefetchCancelled.store(true);
+				else
+					generator.GenerationCancelled.store(true);
+			}
+
 			return;
+		}
 
-		if (!newPlanetReady.load() && !planetGenerationOngoing.load())
+		if (!generator.NewPlanetReady.load() && !generator.PlanetGenerationOngoing.load())
 		{
-			generationFuture = std::async(std::launch::async, &PlanetSystem::GeneratePlanet,
+			// A cancel that reached the job only after it handed its build over is stale by now
+			generator.GenerationCancelled.store(false);
+			generator.GenerationRestarts = generator.LastBuildCancelled ? generator.GenerationRestarts + 1 : 0;
+			generator.LastBuildCancelled = false;
+			generator.GenerationCameraPos = cameraPosPlanetSpace;
+
+			bool prefetch = planet.PrefetchTime > 0.0f && generator.CameraVelocity.LengthSqrt() > 0.0;
+			Vector3 prefetchPos = cameraPosPlanetSpace + generator.CameraVelocity * (double)planet.PrefetchTime;
+
+			generator.GenerationFuture = std::async(std::launch::async, &PlanetSystem::GeneratePlanet,
 				std::ref(frustum),
 				std::ref(scale),
-				std::ref(planetCenter),
-				std::ref(noScaleTransform),
+				planetCenter,
+				noScaleTransform,
 				camPos,
 				backfaceCull,
 				frustumCullActivated,
 				std::ref(planet),
 				std::ref(terrainColliders),
 				std::ref(terrainColliderPositions),
-				terrainDetail);
+				terrainDetail,
+				prefetch,
+				prefetchPos);
 		}
 
 		return;
 	}
 
-	void PlanetSystem::UpdatePlanet(Ref<Mesh>& renderPlanet, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, TerrainColliderComponent& terrainCollider)
+	void PlanetSystem::UpdatePlanet(Ref<Mesh>& renderPlanet, PlanetComponent& planet, TerrainColliderComponent& terrainCollider)
 	{
-		std::lock_guard<std::mutex> lock(planetDataMutex);
-		if (newPlanetReady.load())
+		PlanetGenerator& generator = GetGenerator(planet);
+
+		// The generation job may still run its look-ahead pass while a finished build waits here. That pass only works on
+		// the patch caches and never touches planet.Build again, so the build is read without PlanetDataMutex
+		if (generator.NewPlanetReady.load())
 		{
+			TOAST_PROFILE_FUNCTION();
+
 			{
-				std::lock_guard<std::mutex> lock(terrainCollidersMutex);
+				std::lock_guard<std::mutex> lock(generator.TerrainCollidersMutex);
 				terrainCollider.Colliders = terrainCollider.BuildColliders;
 				terrainCollider.ColliderPositions = terrainCollider.BuildColliderPositions;
 			}
 
-			renderPlanet->mLODGroups[0]->Vertices = vertices;
-			renderPlanet->mLODGroups[0]->Indices = indices;
-			renderPlanet->InvalidatePlanet();
+			auto& lod = renderPlanet->mLODGroups[0];
+			bool fullUpload = ApplyBuild(planet, renderPlanet->mPlanetVertices, lod->Indices);
+
+			PlanetPatchStats& stats = generator.PatchCache.GetStats();
+
+			if (fullUpload)
+			{
+				renderPlanet->InvalidatePlanet();
+
+				stats.VerticesUploaded = (uint32_t)renderPlanet->mPlanetVertices.size();
+				stats.IndicesUploaded = (uint32_t)lod->Indices.size();
+			}
+			else
+			{
+				// Only the ranges of patches that changed are written to the existing buffers
+				stats.VerticesUploaded = stats.IndicesUploaded = 0;
+
+				for (auto& range : planet.MeshLayout.GetDirtyVertexRanges())
+				{
+					renderPlanet->UpdatePlanetVertices(range.Offset, range.Count);
+					stats.VerticesUploaded += range.Count;
+				}
+				for (auto& range : planet.MeshLayout.GetDirtyIndexRanges())
+				{
+					renderPlanet->UpdatePlanetIndices(range.Offset, range.Count);
+					stats.IndicesUploaded += range.Count;
+				}
+			}
+
+			// One element per visible patch, small enough to be written whole
+			if (fullUpload || stats.PatchesUploaded > 0)
+				renderPlanet->UpdatePlanetFrames(planet.MeshLayout.GetFrames());
 
-			newPlanetReady.store(false);
+			generator.NewPlanetReady.store(false);
 		}
 	}
 
-	double PlanetSystem::GetHeight(Vector2 uvCoords, TerrainData& terrainData)
+	bool PlanetSystem::ApplyBuild(PlanetComponent& planet, std::vector<PlanetVertex>& vertices, std::vector<uint32_t>& indices)
 	{
-		uint32_t x1 = (uint32_t)(uvCoords.x);
-		uint32_t y1 = (uint32_t)(uvCoords.y);
+		PlanetGenerator& generator = *planet.Generator;
+
+		bool fullUpload = planet.MeshLayout.Update(planet.Build.Patches, vertices, indices);
+
+		planet.TriangleCount = planet.MeshLayout.GetIndexCount() / 3;
+		UpdateTriangleBudget(planet, planet.Build.LODBudgetScale);
+
+		PlanetPatchStats& stats = generator.PatchCache.GetStats();
+		stats.PatchesUploaded = planet.MeshLayout.GetPatchesPlaced();
+		stats.FullUpload = fullUpload;
+
+		return fullUpload;
+	}
+
+	void PlanetSystem::UpdateTriangleBudget(PlanetComponent& planet, double buildScale)
+	{
+		if (planet.TriangleBudget == 0)
+		{
+			planet.LODBudgetScale = 1.0;
+			return;
+		}
+
+		double triangles = (double)(std::max)(planet.TriangleCount, 1u);
+		double budget = (double)planet.TriangleBudget;
+
+		// Close enough below the budget, or under it at full detail
+		if (triangles <= budget && (triangles >= budget * (1.0 - PLANET_BUDGET_TOLERANCE) || buildScale >= 1.0))
+			return;
+
+		// The triangle count grows roughly with the square of the split distances, only half of that correction is applied
+		// so the count settles inside the tolerance instead of overshooting it. The step is taken from the scale the build
+		// was started with, builds still on their way don't make it correct twice
+		double target = budget * (1.0 - 0.5 * PLANET_BUDGET_TOLERANCE);
+		double step = std::clamp(pow(target / triangles, 0.25), 0.5, 2.0);
+
+		planet.LODBudgetScale = std::clamp(buildScale * step, PLANET_BUDGET_MIN_SCALE, 1.0);
+	}
+
+	void PlanetSystem::GetTexels(const TerrainData& terrainData, uint32_t mip, uint32_t x1, uint32_t y1, double& Q11, double& Q12, double& Q21, double& Q22)
+	{
+		if (terrainData.Tiles)
+		{
+			const TiledHeightmap& tiles = *terrainData.Tiles;
+
+			uint32_t width = tiles.GetWidth(mip);
+			uint32_t height = tiles.GetHeight(mip);
+
+			x1 = (std::min)(x1, width - 1);
+			y1 = (std::min)(y1, height - 1);
+
+			uint32_t x2 = x1 == (width - 1) ? 0 : x1 + 1;
+			uint32_t y2 = y1 == (height - 1) ? 0 : y1 + 1;
+
+			Q11 = static_cast<double>(tiles.GetTexel(mip, x1, y1));
+			Q12 = static_cast<double>(tiles.GetTexel(mip, x1, y2));
+			Q21 = static_cast<double>(tiles.GetTexel(mip, x2, y1));
+			Q22 = static_cast<double>(tiles.GetTexel(mip, x2, y2));
+
+			return;
+		}
 
 		uint32_t x2 = x1 == (terrainData.Width - 1) ? 0 : x1 + 1;
 		uint32_t y2 = y1 == (terrainData.Height - 1) ? 0 : y1 + 1;
 
-		double Q11 = static_cast<double>(terrainData.HeightData[y1 * (terrainData.RowPitch / 2) + x1]);
-		double Q12 = static_cast<double>(terrainData.HeightData[y2 * (terrainData.RowPitch / 2) + x1]);
-		double Q21 = static_cast<double>(terrainData.HeightData[y1 * (terrainData.RowPitch / 2) + x2]);
-		double Q22 = static_cast<double>(terrainData.HeightData[y2 * (terrainData.RowPitch / 2) + x2]);
+		Q11 = static_cast<double>(terrainData.HeightData[y1 * (terrainData.RowPitch / 2) + x1]);
+		Q12 = static_cast<double>(terrainData.HeightData[y2 * (terrainData.RowPitch / 2) + x1]);
+		Q21 = static_cast<double>(terrainData.HeightData[y1 * (terrainData.RowPitch / 2) + x2]);
+		Q22 = static_cast<double>(terrainData.HeightData[y2 * (terrainData.RowPitch / 2) + x2]);
+	}
+
+	double PlanetSystem::GetHeight(Vector2 uvCoords, const TerrainData& terrainData, uint32_t mip)
+	{
+		if (terrainData.Tiles)
+			uvCoords = uvCoords * (1.0 / (double)(1u << mip));
+		else
+			mip = 0;
+
+		uint32_t x1 = (uint32_t)(uvCoords.x);
+		uint32_t y1 = (uint32_t)(uvCoords.y);
+
+		double Q11, Q12, Q21, Q22;
+		GetTexels(terrainData, mip, x1, y1, Q11, Q12, Q21, Q22);
 
-		return Math::BilinearInterpolation(uvCoords, Q11, Q12, Q21, Q22);
+		// Interpolating the raw texels and scaling afterwards gives the same result as scaling each texel since both are linear
+		return Math::BilinearInterpolation(uvCoords, Q11, Q12, Q21, Q22) * terrainData.HeightScale + terrainData.HeightOffset;
 	}
 
-	void PlanetSystem::Shutdown()
+	void PlanetSystem::GetHeights(const Vector2* uvCoords, double* heights, size_t count, const TerrainData& terrainData, uint32_t mip)
 	{
-		if (generationFuture.valid()) {
-			generationFuture.wait();
+		if (!terrainData.Tiles)
+			mip = 0;
+
+		const __m128d one = _mm_set1_pd(1.0);
+		const __m128d mipScale = _mm_set1_pd(1.0 / (double)(1u << mip));
+		const __m128d scale = _mm_set1_pd(terrainData.HeightScale);
+		const __m128d offset = _mm_set1_pd(terrainData.HeightOffset);
+
+		// Two samples per iteration, the texel fetches are scalar since SSE2 has no gather
+		size_t i = 0;
+		for (; i + 2 <= count; i += 2)
+		{
+			__m128d u = _mm_mul_pd(_mm_set_pd(uvCoords[i + 1].x, uvCoords[i].x), mipScale);
+			__m128d v = _mm_mul_pd(_mm_set_pd(uvCoords[i + 1].y, uvCoords[i].y), mipScale);
+
+			// UVs are never negative so truncating is the same as floor
+			__m128i x1 = _mm_cvttpd_epi32(u);
+			__m128i y1 = _mm_cvttpd_epi32(v);
+
+			__m128d fracX = _mm_sub_pd(u, _mm_cvtepi32_pd(x1));
+			__m128d fracY = _mm_sub_pd(v, _mm_cvtepi32_pd(y1));
+
+			alignas(16) int32_t xs[4], ys[4];
+			_mm_store_si128((__m128i*)xs, x1);
+			_mm_store_si128((__m128i*)ys, y1);
+
+			alignas(16) double q11[2], q12[2], q21[2], q22[2];
+			for (int lane = 0; lane < 2; lane++)
+				GetTexels(terrainData, mip, (uint32_t)xs[lane], (uint32_t)ys[lane], q11[lane], q12[lane], q21[lane], q22[lane]);
+
+			__m128d Q11 = _mm_load_pd(q11);
+			__m128d Q12 = _mm_load_pd(q12);
+			__m128d Q21 = _mm_load_pd(q21);
+			__m128d Q22 = _mm_load_pd(q22);
+
+			// Same operation order as Math::BilinearInterpolation so both paths return identical heights
+			__m128d invFracX = _mm_sub_pd(one, fracX);
+			__m128d invFracY = _mm_sub_pd(one, fracY);
+			__m128d R1 = _mm_add_pd(_mm_mul_pd(Q11, invFracX), _mm_mul_pd(Q21, fracX));
+			__m128d R2 = _mm_add_pd(_mm_mul_pd(Q12, invFracX), _mm_mul_pd(Q22, fracX));
+			__m128d result = _mm_add_pd(_mm_mul_pd(R1, invFracY), _mm_mul_pd(R2, fracY));
+
+			_mm_storeu_pd(heights + i, _mm_add_pd(_mm_mul_pd(result, scale), offset));
 		}
+
+		for (; i < count; i++)
+			heights[i] = GetHeight(uvCoords[i], terrainData, mip);
 	}
 
-	void PlanetSystem::GenerateDistanceLUT(std::vector<double>& distanceLUT, float radius, float FoV, float viewportSizeX)
+	uint32_t PlanetSystem::GetTerrainMip(const TerrainData& terrainData, int16_t subdivision)
 	{
-		distanceLUT.clear();
+		if (!terrainData.Tiles)
+			return 0;
 
-		distanceLUT.emplace_back(100000.0 * 100000.0);
-		distanceLUT.emplace_back(50000.0 * 50000.0);
-		distanceLUT.emplace_back(25000.0 * 25000.0);
-		distanceLUT.emplace_back(15000.0 * 15000.0);
-		distanceLUT.emplace_back(10000.0 * 10000.0);
-		distanceLUT.emplace_back(7500.0 * 7500.0);
-		distanceLUT.emplace_back(5000.0 * 5000.0);
-		distanceLUT.emplace_back(2500.0 * 2500.0);
-		distanceLUT.emplace_back(2000.0 * 2000.0);
-		distanceLUT.emplace_back(1500.0 * 1500.0);
-		distanceLUT.emplace_back(1000.0 * 1000.0);
-		distanceLUT.emplace_back(750.0 * 750.0);
-		distanceLUT.emplace_back(500.0 * 500.0);
-		distanceLUT.emplace_back(250.0 * 250.0);
-		distanceLUT.emplace_back(150.0 * 150.0);
-		distanceLUT.emplace_back(100.0 * 100.0);
-		distanceLUT.emplace_back(75.0 * 75);
-		distanceLUT.emplace_back(50.0 * 50.0);
-		distanceLUT.emplace_back(25.0 * 25.0);
-		distanceLUT.emplace_back(15.0 * 15.0);
-		distanceLUT.emplace_back(5.0 * 5.0);
+		// An icosahedron edge spans a fifth of the height map width and is halved with every subdivision
+		double edgeTexels = (double)terrainData.Width / (5.0 * (double)(1ull << subdivision));
 
-		//double startLog = log(radius * 6.0);  // Starting log value for 1,000,000
-		//double endLog = log(radius * 0.00001475143826523086);  // Ending log value for 50
+		uint32_t mip = 0;
+		while (mip + 1 < terrainData.Tiles->GetMipCount() && edgeTexels >= 4.0)
+		{
+			edgeTexels *= 0.5;
+			mip++;
+		}
 
-		//for (int level = 0; level < 20; level++)
-		//{
-		//	// Interpolate between startLog and endLog based on current level
-		//	double t = static_cast<double>(level) / MAX_SUBDIVISION;
-		//	double currentLog = (1 - t) * startLog + t * endLog;
+		return mip;
+	}
 
-		//	// Convert the logarithmic value back to linear space
-		//	double currentDistance = exp(currentLog);
+	// Ray casts come from the physics, each thread keeps the detail noise of the last seed it was asked for
+	static const siv::PerlinNoise& GetDetailNoise(uint32_t seed)
+	{
+		static thread_local siv::PerlinNoise sNoise;
+		static thread_local uint32_t sSeed = 0;
+		static thread_local bool sSeeded = false;
 
-		//	distanceLUT.emplace_back(currentDistance);
-		//}
+		if (!sSeeded || sSeed != seed)
+		{
+			sNoise.reseed(seed);
+			sSeed = seed;
+			sSeeded = true;
+		}
 
-		//int i = 0;
-		//for (auto level : distanceLUT)
-		//{
-		//	i++;
-		//	TOAST_CORE_INFO("distanceLUT[%d]: %f", i, level);
-		//}
+		return sNoise;
+	}
+
+	// Tiled terrain is read through the mapping of the physics, the generation thread trims the planet's one while the
+	// physics runs. Nothing but the fields the sampling needs is copied into view
+	static const TerrainData& GetPhysicsTerrainData(const TerrainData& terrainData, TerrainData& view)
+	{
+		if (!terrainData.Tiles)
+			return terrainData;
+
+		view.RowPitch = terrainData.RowPitch;
+		view.Width = terrainData.Width;
+		view.Height = terrainData.Height;
+		view.HeightScale = terrainData.HeightScale;
+		view.HeightOffset = terrainData.HeightOffset;
+		view.Tiles = terrainData.PhysicsTiles;
+		view.HeightRanges = terrainData.HeightRanges;
+
+		return view;
+	}
+
+	// Radius of the terrain straight below the unit direction, uv is where the height map was sampled
+	static double GetSurfaceRadius(const Vector3& direction, const TerrainData& terrainData, double radius, const siv::PerlinNoise* perlin, const TerrainDetailComponent* terrainDetail, uint32_t mip, Vector2& uv)
+	{
+		uv = PlanetSystem::GetUVFromPosition(direction, (double)terrainData.Width, (double)terrainData.Height);
+
+		double height = PlanetSystem::GetHeight(uv, terrainData, mip);
+		if (perlin && terrainDetail)
+			height += perlin->octave2D_01(uv.x * terrainDetail->Frequency, uv.y * terrainDetail->Frequency, terrainDetail->Octaves) * terrainDetail->Amplitude;
+
+		return radius + height;
+	}
+
+	// First t after tMin where the ray crosses a side of the longitude and latitude box, or the sphere if sphereRadius is
+	// above 0. The sides are tested as whole planes and double cones, crossing them outside of the box only ends the
+	// step early
+	static double GetCellExit(const Vector3& origin, const Vector3& direction, double tMin, double theta0, double theta1, double phi0, double phi1, double sphereRadius)
+	{
+		double exit = DBL_MAX;
+		auto consider = [&](double t) {
+			if (t > tMin && t < exit)
+				exit = t;
+		};
+
+		// a * t^2 + 2 * b * t + c = 0
+		auto considerQuadratic = [&](double a, double b, double c) {
+			if (std::abs(a) < 1e-12)
+			{
+				if (b != 0.0)
+					consider(-c / (2.0 * b));
+				return;
+			}
+
+			double discriminant = b * b - a * c;
+			if (discriminant < 0.0)
+				return;
+
+			double root = sqrt(discriminant);
+			consider((-b - root) / a);
+			consider((-b + root) / a);
+		};
+
+		for (double theta : { theta0, theta1 })
+		{
+			// Longitude theta is on the plane through the poles with this normal
+			Vector3 normal(-sin(theta), 0.0, cos(theta));
+			double speed = Vector3::Dot(direction, normal);
+			if (speed != 0.0)
+				consider(-Vector3::Dot(origin, normal) / speed);
+		}
+
+		for (double phi : { phi0, phi1 })
+		{
+			if (std::abs(phi) >= M_PIDIV2 - 1e-12)
+				continue;
+
+			// Latitude phi is where y^2 = sin^2(phi) * |p|^2
+			double sin2 = sin(phi) * sin(phi);
+			considerQuadratic(direction.y * direction.y - sin2 * Vector3::Dot(direction, direction), origin.y * direction.y - sin2 * Vector3::Dot(origin, direction), origin.y * origin.y - sin2 * Vector3::Dot(origin, origin));
+		}
+
+		if (sphereRadius > 0.0)
+			considerQuadratic(Vector3::Dot(direction, direction), Vector3::Dot(origin, direction), Vector3::Dot(origin, origin) - sphereRadius * sphereRadius);
+
+		return exit;
 	}
 
-	void PlanetSystem::GenerateFaceDotLevelLUT(std::vector<double>& faceLevelDotLUT, float planetRadius, float maxHeight)
+	bool PlanetSystem::RaycastTerrain(const PlanetComponent& planet, const TerrainDetailComponent* terrainDetail, const Vector3& origin, const Vector3& direction, double maxDistance, TerrainRaycastHit& hit)
 	{
-		std::lock_guard<std::mutex> lock(planetDataMutex);
+		TOAST_PROFILE_FUNCTION();
+
+		TerrainData physicsTerrain;
+		const TerrainData& terrainData = GetPhysicsTerrainData(planet.TerrainData, physicsTerrain);
+		const TerrainHeightPyramid* pyramid = terrainData.HeightRanges.get();
+
+		double originDistance = origin.Length();
+		if (!pyramid || (planet.TerrainData.Tiles && !terrainData.Tiles) || originDistance <= 0.0)
+			return false;
+
+		const siv::PerlinNoise* perlin = terrainDetail ? &GetDetailNoise(terrainDetail->Seed) : nullptr;
+		double detailMin = terrainDetail ? (std::min)((double)terrainDetail->Amplitude, 0.0) : 0.0;
+		double detailMax = terrainDetail ? (std::max)((double)terrainDetail->Amplitude, 0.0) : 0.0;
+
+		double radius = planet.PlanetData.radius;
+		auto lowest = [&](const TerrainHeightPyramid::Range& range) { return radius + (double)range.Min * terrainData.HeightScale + terrainData.HeightOffset + detailMin; };
+		auto highest = [&](const TerrainHeightPyramid::Range& range) { return radius + (double)range.Max * terrainData.HeightScale + terrainData.HeightOffset + detailMax; };
+
+		Vector3 ray = Vector3::Normalize(direction);
+
+		// Positive above the terrain
+		auto getSurfaceDistance = [&](double t, uint32_t mip, Vector2& uv) {
+			Vector3 position = origin + ray * t;
+			double r = position.Length();
+			return r - GetSurfaceRadius(position / r, terrainData, radius, perlin, terrainDetail, mip, uv);
+		};
+
+		auto setHit = [&](double t, uint32_t mip, const Vector2& uv) {
+			hit.Distance = t;
+			hit.Point = origin + ray * t;
+			hit.Normal = GetHeightMapNormal(hit.Point, uv, terrainData, perlin, terrainDetail, mip);
+			return true;
+		};
+
+		// The altitude is always measured on the full resolution map
+		Vector2 uv;
+		hit.Altitude = getSurfaceDistance(0.0, 0, uv);
+		if (hit.Altitude <= 0.0)
+			return setHit(0.0, 0, uv);
+
+		// Only the part of the ray inside the sphere around the highest terrain can hit anything, and it can't get into
+		// the sphere around the lowest terrain without hitting it first
+		uint32_t topLevel = pyramid->GetLevelCount() - 1;
+		const TerrainHeightPyramid::Range& planetRange = pyramid->GetRange(topLevel, 0, 0);
+
+		double b = Vector3::Dot(origin, ray);
+		double outer = highest(planetRange);
+		double discriminant = b * b - (originDistance * originDistance - outer * outer);
+		if (discriminant < 0.0)
+			return false;
+
+		double tStart = (std::max)(-b - sqrt(discriminant), 0.0);
+		double tEnd = (std::min)(-b + sqrt(discriminant), maxDistance);
+
+		double inner = lowest(planetRange);
+		discriminant = b * b - (originDistance * originDistance - inner * inner);
+		if (discriminant >= 0.0 && -b - sqrt(discriminant) >= 0.0)
+			tEnd = (std::min)(tEnd, -b - sqrt(discriminant));
+
+		double width = (double)terrainData.Width - 1.0;
+		double height = (double)terrainData.Height - 1.0;
+		uint32_t cellShift = pyramid->GetCellShift();
+
+		// One texel of the full resolution map along a meridian, in meters
+		double texelLength = M_PI * radius / height;
+		uint32_t mipCount = terrainData.Tiles ? terrainData.Tiles->GetMipCount() : 1;
+
+		double t = tStart;
+		for (uint32_t step = 0; step < TERRAIN_RAYCAST_MAX_STEPS && t <= tEnd; step++)
+		{
+			Vector3 position = origin + ray * t;
+			double r = position.Length();
+
+			Vector2 texel = GetUVFromPosition(position, (double)terrainData.Width, (double)terrainData.Height);
+			uint32_t x = (uint32_t)texel.x, y = (uint32_t)texel.y;
+
+			// Coarsest cell below the ray that's lower than it, -1 if not even the finest cell is
+			int32_t level = (int32_t)topLevel;
+			for (; level >= 0; level--)
+			{
+				uint32_t shift = cellShift + (uint32_t)level;
+				if (r > highest(pyramid->GetRange((uint32_t)level, x >> shift, y >> shift)))
+					break;
+			}
+
+			uint32_t shift = cellShift + (uint32_t)(std::max)(level, 0);
+			double u0 = (double)((x >> shift) << shift), v0 = (double)((y >> shift) << shift);
+			double cellSize = (double)(1u << shift);
+
+			double theta0 = ((std::min)(u0 / width, 1.0) * 2.0 - 1.0) * M_PI;
+			double theta1 = ((std::min)((u0 + cellSize) / width, 1.0) * 2.0 - 1.0) * M_PI;
+			double phi0 = ((std::min)(v0 / height, 1.0) * 2.0 - 1.0) * M_PIDIV2;
+			double phi1 = ((std::min)((v0 + cellSize) / height, 1.0) * 2.0 - 1.0) * M_PIDIV2;
+
+			if (level >= 0)
+			{
+				// Skips to where the ray leaves the cell or comes down to its highest texel
+				double cellTop = highest(pyramid->GetRange((uint32_t)level, x >> shift, y >> shift));
+				t = GetCellExit(origin, ray, t, theta0, theta1, phi0, phi1, cellTop) + TERRAIN_RAYCAST_MIN_STEP;
+				continue;
+			}
+
+			// Down among the texels of a finest cell, the terrain is sampled along the part of the ray inside of it
+			double tCell = (std::min)(GetCellExit(origin, ray, t, theta0, theta1, phi0, phi1, 0.0), tEnd);
+			uint32_t samples = (std::min)(4u << cellShift, 64u);
+
+			// Samples several texels apart along the surface read the mip with about one texel between them, finer
+			// texels would only be skipped over
+			Vector3 up = position / r;
+			double sampleTexels = (ray - up * Vector3::Dot(ray, up)).Length() * (tCell - t) / (double)samples / texelLength;
+			uint32_t mip = 0;
+			while (mip + 1 < mipCount && sampleTexels >= (double)(2u << mip))
+				mip++;
+
+			double above = t;
+			for (uint32_t i = 1; i <= samples; i++)
+			{
+				double sampleT = t + (tCell - t) * (double)i / (double)samples;
+				if (getSurfaceDistance(sampleT, mip, uv) > 0.0)
+				{
+					above = sampleT;
+					continue;
+				}
+
+				// Between the last sample above the terrain and the first one below it
+				double below = sampleT;
+				Vector2 belowUV = uv;
+				for (int j = 0; j < TERRAIN_RAYCAST_BISECTIONS; j++)
+				{
+					double middle = (above + below) * 0.5;
+					if (getSurfaceDistance(middle, mip, uv) > 0.0)
+						above = middle;
+					else
+					{
+						below = middle;
+						belowUV = uv;
+					}
+				}
+
+				return setHit(below, mip, belowUV);
+			}
+
+			t = tCell + TERRAIN_RAYCAST_MIN_STEP;
+		}
+
+		return false;
+	}
+
+	PlanetGenerator& PlanetSystem::GetGenerator(PlanetComponent& planet)
+	{
+		if (!planet.Generator)
+			planet.Generator = CreateRef<PlanetGenerator>();
+
+		return *planet.Generator;
+	}
+
+	void PlanetSystem::Shutdown(PlanetComponent& planet)
+	{
+		if (!planet.Generator)
+			return;
+
+		PlanetGenerator& generator = *planet.Generator;
+		if (generator.GenerationFuture.valid()) {
+			generator.GenerationCancelled.store(true);
+			generator.PrefetchCancelled.store(true);
+			generator.GenerationFuture.wait();
+		}
+	}
+
+	void PlanetSystem::GenerateDistanceLUT(PlanetComponent& planet, float FoV, float viewportSizeY)
+	{
+		PlanetGenerator& generator = GetGenerator(planet);
+
+		std::lock_guard<std::mutex> lock(generator.PlanetDataMutex);
+
+		// Pixels covered by an error of 1 at a distance of 1
+		double pixelsPerRadian = (double)viewportSizeY / (2.0 * tan(DirectX::XMConvertToRadians(FoV) * 0.5));
+
+		planet.LODErrorScale = pixelsPerRadian / (double)(std::max)(planet.LODPixelError, 0.01f);
+		planet.LODFoV = FoV;
+		planet.LODViewportHeight = viewportSizeY;
+
+		// Split distances of nodes without any relief, for where only the level of a node is known
+		double radius = planet.PlanetData.radius;
+		planet.DistanceLUT.clear();
+		for (int16_t level = 0; level <= MAX_SUBDIVISION; level++)
+		{
+			double edgeLength = PLANET_ICOSAHEDRON_EDGE * radius / (double)(1ull << (level + BASE_PLANET_SUBDIVISIONS));
+			double distance = GetGeometricError(edgeLength, 0.0, radius) * planet.LODErrorScale;
+
+			planet.DistanceLUT.emplace_back(distance * distance);
+		}
+	}
+
+	void PlanetSystem::GenerateFaceDotLevelLUT(PlanetComponent& planet, float planetRadius, float maxHeight)
+	{
+		PlanetGenerator& generator = GetGenerator(planet);
+
+		std::lock_guard<std::mutex> lock(generator.PlanetDataMutex);
 
 		float cullingAngle = acos((double)planetRadius / ((double)planetRadius + (double)maxHeight));
 
+		std::vector<double>& faceLevelDotLUT = planet.FaceLevelDotLUT;
 		faceLevelDotLUT.clear();
 		faceLevelDotLUT.emplace_back(0.5 + sinf(cullingAngle));
 		double angle = acos(0.5);
@@ -4,6 +4,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
 
 #include <../vendor/directxtex/include/DirectXTex.h>
 #include "../vendor/perlin-noise/include/PerlinNoise.hpp"
@@ -13,7 +14,13 @@
 
 #include "Toast/Renderer/Frustum.h"
 #include "Toast/Renderer/Mesh.h"
+#include "Toast/Renderer/PlanetGenerator.h"
+#include "Toast/Renderer/PlanetMidpointCache.h"
+#include "Toast/Renderer/PlanetNode.h"
+#include "Toast/Renderer/PlanetNodeView.h"
+#include "Toast/Renderer/PlanetPatchCache.h"
 #include "Toast/Renderer/RenderCommand.h"
+#include "Toast/Renderer/TiledHeightmap.h"
 
 #include "Toast/Scene/Components.h"
 
@@ -29,116 +36,57 @@
 
 namespace Toast {
 
-	struct CPUVertex
+	// Everything a traversal job needs that stays constant during one planet generation
+	struct PlanetTraversalData
 	{
-		Vector3 Position;
-		Vector3 Normal;
-		Vector2 UV;
-
-		CPUVertex() = default;
-		CPUVertex(const Vector3& position, const Vector3& normal, const Vector2& uv)
-			: Position(position), Normal(normal), UV(uv) {}
-		CPUVertex(Vector3 pos)
-			: Position(pos) {}
-
-		// Copy constructor
-		CPUVertex(const CPUVertex& other)
-			: Position(other.Position), Normal(other.Normal), UV(other.UV) {}
-
-		// Optional: Assignment operator
-		CPUVertex& operator=(const CPUVertex& other)
-		{
-			if (this != &other) // Check for self-assignment
-			{
-				Position = other.Position;
-				Normal = other.Normal;
-				UV = other.UV;
-			}
-			return *this;
-		}
+		Vector3 CameraPosPlanetSpace;
+		Vector3 PlanetCenter;
+		bool BackfaceCull = true;
+		bool FrustumCullActivated = true;
+		Ref<Frustum> CameraFrustum;
+		const siv::PerlinNoise* Perlin = nullptr;
+		TerrainDetailComponent* TerrainDetail = nullptr;
+
+		// Snapshot taken under planetDataMutex so the jobs can read it without locking
+		std::vector<double> FaceLevelDotLUT;
+		double LODErrorScale = 0.0;
+		double Radius = 0.0;
+
+		// Set when a newer camera pose has made the build pointless, checked before every patch
+		const std::atomic<bool>* Cancelled = nullptr;
+
+		// Where the camera is expected to be PlanetComponent::PrefetchTime from now
+		bool Prefetch = false;
+		Vector3 PrefetchPosPlanetSpace;
+
+		// Far away planets skip the patches and are drawn with FixedLODPatches
+		bool FixedLOD = false;
+
+		// See PlanetComponent::AnalyticNormals, sampled from the mip of the finest level the planet splits to
+		bool AnalyticNormals = false;
+		uint32_t NormalMip = 0;
+
+		// Radius of the lowest and the highest terrain the planet can have, for the horizon culling
+		double OccluderRadius = 0.0;
+		double MaxTerrainRadius = 0.0;
+
+		bool IsCancelled() const { return Cancelled && Cancelled->load(std::memory_order_relaxed); }
 	};
 
-	struct PlanetNode
+	// Result of PlanetSystem::RaycastTerrain, in planet space
+	struct TerrainRaycastHit
 	{
-		CPUVertex A, B, C;  // The three vertices of the triangle
-		std::vector<Ref<PlanetNode>> ChildNodes;
-		int16_t SubdivisionLevel = 0;
-		Bounds NodeBounds;
-
-		PlanetNode(const CPUVertex& v0, const CPUVertex& v1, const CPUVertex& v2, const int16_t level, Matrix transform = Matrix::Identity())
-		{
-			A = v0;
-			B = v1;
-			C = v2;
-
-			A.Position = transform * A.Position;
-			B.Position = transform * B.Position;
-			C.Position = transform * C.Position;
-
-			SubdivisionLevel = level;
-
-			ComputeBoundsFromTriangle();
-		}
-
-		PlanetNode(const PlanetNode& other)
-		{
-			A = other.A;
-			B = other.B;
-			C = other.C;
-			SubdivisionLevel = other.SubdivisionLevel;
-			NodeBounds = other.NodeBounds;
-
-			// Shallow copy of the child nodes
-			ChildNodes = other.ChildNodes;
-		}
-
-		void ComputeBoundsFromTriangle()
-		{
-			NodeBounds.mins = {
-				(std::min)({A.Position.x, B.Position.x, C.Position.x}),
-				(std::min)({A.Position.y, B.Position.y, C.Position.y}),
-				(std::min)({A.Position.z, B.Position.z, C.Position.z})
-			};
-			NodeBounds.maxs = {
-				(std::max)({A.Position.x, B.Position.x, C.Position.x}),
-				(std::max)({A.Position.y, B.Position.y, C.Position.y}),
-				(std::max)({A.Position.z, B.Position.z, C.Position.z})
-			};
-		}
-
-		void UpdateBoundsFromChildren() {
-			// If no children, bounds are already computed from the triangle
-			if (ChildNodes.empty()) return;
-
-			// Start with a large inverted bounding box
-			Bounds childBounds;
-			childBounds.mins = { DBL_MAX, DBL_MAX, DBL_MAX };
-			childBounds.maxs = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
-
-			for (auto& child : ChildNodes)
-			{
-				childBounds.mins.x = (std::min)(childBounds.mins.x, child->NodeBounds.mins.x);
-				childBounds.mins.y = (std::min)(childBounds.mins.y, child->NodeBounds.mins.y);
-				childBounds.mins.z = (std::min)(childBounds.mins.z, child->NodeBounds.mins.z);
-
-				childBounds.maxs.x = (std::max)(childBounds.maxs.x, child->NodeBounds.maxs.x);
-				childBounds.maxs.y = (std::max)(childBounds.maxs.y, child->NodeBounds.maxs.y);
-				childBounds.maxs.z = (std::max)(childBounds.maxs.z, child->NodeBounds.maxs.z);
-			}
-
-			NodeBounds = childBounds;
-		}
+		Vector3 Point;
+		Vector3 Normal;
+		// Along the ray, 0 when the ray starts below the terrain
+		double Distance = 0.0;
+		// Height of the ray origin above the terrain straight below it, negative below the terrain
+		double Altitude = 0.0;
 	};
 
 	class PlanetSystem
 	{
 	public:
-		static std::mutex planetDataMutex;
-		static std::mutex terrainCollidersMutex;
-		static std::future<void> generationFuture;
-		static std::atomic<bool> newPlanetReady;
-		static std::atomic<bool> planetGenerationOngoing;
-
 		static const int16_t MAX_SUBDIVISION = 20;
 
 		enum class NextPlanetFace
@@ -151,7 +99,11 @@ namespace Toast {
 			double maxHeight;
 		};
 	private:
-		static std::vector<Ref<PlanetNode>> sPlanetNodes;
+		// Generations running at the moment, their traversals share the hardware threads
+		static std::atomic<uint32_t> sActiveGenerations;
+
+		// Terrain objects within the activation distance with their squared distance to the camera
+		static std::vector<std::pair<double, DirectX::XMFLOAT3>> sObjectCandidates;
 
 		static std::vector<Vector3> sBaseVertices;
 		static std::vector<uint32_t> sBaseIndices;
@@ -159,31 +111,98 @@ namespace Toast {
 	public:
 		static uint32_t HashFace(uint32_t index0, uint32_t index1, uint32_t index2);
 
-		static void SubdivideBasePlanet(PlanetComponent& planet, Ref<PlanetNode>& node, double scale);
-		static void SubdivideFace(Ref<PlanetNode>& node, CPUVertex& A, CPUVertex& B, CPUVertex& C, Vector3& cameraPosPlanetSpace, PlanetComponent& planet, const Vector3& planetCenter, Matrix& planetTransform, uint16_t subdivision, const siv::PerlinNoise& perlin, TerrainDetailComponent* terrainDetail);
-		static void CalculateBasePlanet(PlanetComponent& planet, double scale);
+		static void SubdivideBasePlanet(PlanetComponent& planet, uint32_t nodeIndex, double scale);
+		// With a height map path the tree is loaded from, or baked to, the PlanetBaseCache file next to it
+		static void CalculateBasePlanet(PlanetComponent& planet, double scale, const std::string& heightmapPath = "");
 
+		// Creates the planet's generator the first time, only called from the main thread
+		static PlanetGenerator& GetGenerator(PlanetComponent& planet);
+
+		// Nodes of the build last applied to the planet, valid until the next ApplyBuild. The nodes are in planet space,
+		// planetTransform is where the planet is now
+		static PlanetNodeView GetNodeView(const PlanetComponent& planet, const Matrix& planetTransform) { return PlanetNodeView(planet.Generator ? &planet.Generator->BasePlanetNodes : nullptr, planet.MeshLayout, planetTransform); }
+
+		// Scatters objects over the patches near the camera and uploads the nearest MaxNrOfObjects of them, patches keep
+		// their objects until they're rebuilt or leave the activation distance
 		static void DetailObjectPlacement(const PlanetComponent& planet, TerrainObjectComponent& objects, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR& camPos);
 
-		static void UpdatePlanet(Ref<Mesh>& renderPlanet, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, TerrainColliderComponent& terrainCollider);
+		static void UpdatePlanet(Ref<Mesh>& renderPlanet, PlanetComponent& planet, TerrainColliderComponent& terrainCollider);
+		// CPU side of UpdatePlanet, lays the finished build out into the vertex and index lists and returns true if all
+		// of them have to be uploaded. Leaves NewPlanetReady to the caller
+		static bool ApplyBuild(PlanetComponent& planet, std::vector<PlanetVertex>& vertices, std::vector<uint32_t>& indices);
+
+		// uvCoords are in texels of the full resolution height map, mip only matters for tiled height maps
+		static double GetHeight(Vector2 uvCoords, const TerrainData& terrainData, uint32_t mip = 0);
+		// Samples count heights at once, same result as calling GetHeight for each of them
+		static void GetHeights(const Vector2* uvCoords, double* heights, size_t count, const TerrainData& terrainData, uint32_t mip = 0);
+		// Same as GetUVFromPosition for unit directions, two at a time with polynomial atan2 and asin (error below 2e-12 rad)
+		static void GetUVsFromDirections(const Vector3* directions, Vector2* uvs, size_t count, double width, double height);
+		// Normalizes the positions and samples their UVs and heights in one pass, displaced can be nullptr
+		static void DisplaceVertices(const Vector3* positions, size_t count, Vector3* directions, Vector2* uvs, double* heights, Vector3* displaced, const TerrainData& terrainData, double radius, uint32_t mip = 0);
 
-		static double GetHeight(Vector2 uvCoords, TerrainData& terrainData);
+		static Vector2 GetUVFromPosition(const Vector3 pos, double width, double height);
+
+		// Coarsest mip that still has a couple of texels along the edge of a face at the subdivision level
+		static uint32_t GetTerrainMip(const TerrainData& terrainData, int16_t subdivision);
 
-		static void RegeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated, PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail = nullptr);
+		// Ray against the height map surface of the planet, marched through TerrainData::HeightRanges so it doesn't
+		// depend on the LOD the planet is drawn with. Tiled terrain is read through TerrainData::PhysicsTiles. Planet
+		// space, false without a hit or without HeightRanges
+		static bool RaycastTerrain(const PlanetComponent& planet, const TerrainDetailComponent* terrainDetail, const Vector3& origin, const Vector3& direction, double maxDistance, TerrainRaycastHit& hit);
 
-		static void Shutdown();
+		static void RegeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated, PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail = nullptr, const Vector3* cameraVelocity = nullptr);
 
-		static void GenerateDistanceLUT(std::vector<double>& distanceLUT, float radius, float FoV, float viewportSizeX);
-		static void GenerateFaceDotLevelLUT(std::vector<double>& faceLevelDotLUT, float planetRadius, float maxHeight);
+		// Waits for the planet's generation job, cancelling it first
+		static void Shutdown(PlanetComponent& planet);
+
+		// Screen-space error metric for the vertical FoV in degrees and the viewport height in pixels, fills the nominal
+		// split distance of every level into DistanceLUT
+		static void GenerateDistanceLUT(PlanetComponent& planet, float FoV, float viewportSizeY);
+		static void GenerateFaceDotLevelLUT(PlanetComponent& planet, float planetRadius, float maxHeight);
 		static void GenerateHeightMultLUT(std::vector<double>& heightMultLUT, double planetRadius, double maxHeight);
 	private:
-		static Vector2 GetUVFromPosition(const Vector3 pos, double width, double height);
+		// Displaced midpoints of up to three edges, cached edges are reused and the rest are sampled in one batch
+		static void ComputeMidpoints(const CPUVertex* const* starts, const CPUVertex* const* ends, CPUVertex* midpoints, uint32_t count, PlanetComponent& planet, const siv::PerlinNoise* perlin, TerrainDetailComponent* terrainDetail, int16_t subdivision);
 
-		static void GetFaceBounds(const std::initializer_list<Vector3>& vertices, Bounds& bounds);
+		static void ScatterObjects(const PlanetPatchGeometry& patch, const TerrainObjectComponent& objects, const siv::PerlinNoise& perlin, std::vector<DirectX::XMFLOAT3>& positions);
+
+		static void GetTexels(const TerrainData& terrainData, uint32_t mip, uint32_t x1, uint32_t y1, double& Q11, double& Q12, double& Q21, double& Q22);
 
-		static void GeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated, PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail = nullptr);
+		static void GetFaceBounds(const std::initializer_list<Vector3>& vertices, Bounds& bounds);
 
-		static void TraverseNode(Ref<PlanetNode>& node, PlanetComponent& planet, Vector3& cameraPosPlanetSpace, const Vector3& planetCenter, bool backfaceCull, bool frustumCullActivated, Ref<Frustum>& frustum, Matrix& planetTransform, const siv::PerlinNoise& perlin, TerrainDetailComponent* terrainDetail);
+		static void GeneratePlanet(Ref<Frustum>& frustum, DirectX::XMFLOAT3& scale, const Vector3& planetCenter, DirectX::XMMATRIX noScaleTransform, DirectX::XMVECTOR camPos, bool backfaceCull, bool frustumCullActivated, PlanetComponent& planet, std::unordered_map<std::pair<int, int>, Ref<ShapeBox>, PairHash>& terrainColliders, std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash>& terrainColliderPositions, TerrainDetailComponent* terrainDetail, bool prefetch, Vector3 prefetchPosPlanetSpace);
+
+		static bool CullNode(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal);
+		// Removes the culled nodes from the list, the frustum test runs over all of them at once
+		static void CullNodes(std::vector<uint32_t>& nodes, PlanetComponent& planet, PlanetTraversalData& traversal);
+		static bool IsBackfacing(const PlanetNode* node, const PlanetTraversalData& traversal);
+		// Planet space sphere around all the terrain the node can have below it
+		static void GetNodeBoundingSphere(const PlanetNode& node, const PlanetTraversalData& traversal, Vector3& center, double& radius);
+		// True if the terrain in the node's bounding sphere can't be seen from the camera because the planet is in the way
+		static bool IsBehindHorizon(const Vector3& center, double radius, const PlanetTraversalData& traversal);
+		static void CollectTraversalJobs(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal);
+		// Look-ahead pass, splits around the predicted camera position only to fill the midpoint cache and map the heightmap tiles
+		static void CollectPrefetchPatches(uint32_t baseIndex, double relief, PlanetComponent& planet, PlanetTraversalData& traversal);
+		// The planet drawn down to PLANET_FIXED_LOD_SUBDIVISION, one patch per base node at PLANET_JOB_SUBDIVISION
+		static void BuildFixedLODPatches(PlanetComponent& planet, PlanetTraversalData& traversal);
+		static void EmitFixedLODNode(PlanetPatchGeometry& geometry, std::vector<Vertex>& vertices, uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal);
+		static void PrefetchNode(const CPUVertex& A, const CPUVertex& B, const CPUVertex& C, int16_t subdivision, PlanetComponent& planet, PlanetTraversalData& traversal, std::atomic<int64_t>& budget);
+		static void TraverseNode(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal, PlanetBuildOutput& output);
+		static void UpdatePatch(uint32_t baseIndex, PlanetComponent& planet, PlanetTraversalData& traversal, PlanetBuildOutput& output);
+		static void UpdatePatchNode(PlanetPatch& patch, uint32_t nodeIndex, PlanetComponent& planet, PlanetTraversalData& traversal, double& stableDistance);
+		// Planet space box around everything the patch below the base node can emit, it doesn't depend on the splits so the
+		// quantized positions stay the same when the patch is rebuilt
+		static PlanetVertexFrame GetPatchFrame(const PlanetNode& baseNode, PlanetComponent& planet, PlanetTraversalData& traversal);
+		static void EmitPatchNode(PlanetPatch& patch, std::vector<Vertex>& vertices, uint32_t nodeIndex, uint32_t geometryIndex, PlanetComponent& planet, PlanetTraversalData& traversal);
+		// Squared distance within which the node's projected error exceeds the pixel error of the planet
+		static double GetNodeSplitDistance(const CPUVertex& A, const CPUVertex& B, const CPUVertex& C, const PlanetTraversalData& traversal);
+		// Planet space normal of the terrain at the vertex from the height map gradient around its UV. Only depends on the vertex,
+		// so vertices shared by patches of different levels get the same normal
+		static Vector3 GetAnalyticNormal(const CPUVertex& vertex, PlanetComponent& planet, PlanetTraversalData& traversal);
+		static void EmitPatchLeaf(PlanetPatch& patch, std::vector<Vertex>& vertices, const CPUVertex& A, const CPUVertex& B, const CPUVertex& C, PlanetComponent& planet, PlanetTraversalData& traversal, uint16_t subdivision);
+		static void MergeBuildOutputs(PlanetComponent& planet);
+		// Called with the triangle count of a finished build and the budget scale it was started with
+		static void UpdateTriangleBudget(PlanetComponent& planet, double buildScale);
 
 		static uint32_t GetOrAddVector3(std::unordered_map<Vector3, uint32_t, Vector3::Hasher, Vector3::Equal>& vertexMap, const Vector3& vertex, std::vector<Vector3>& vertices);
 
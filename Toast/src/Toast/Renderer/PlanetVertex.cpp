@@ -0,0 +1,123 @@
+#include "tpch.h"
+
+#include "PlanetVertex.h"
+
+#include "Toast/Renderer/Mesh.h"
+
+namespace Toast {
+
+	static uint32_t QuantizePosition(double value, float origin, float step)
+	{
+		if (step <= 0.0f)
+			return 0;
+
+		double q = std::floor((value - (double)origin) / (double)step + 0.5);
+		return (uint32_t)(std::min)((std::max)(q, 0.0), (double)PlanetVertexCodec::POSITION_MAX);
+	}
+
+	static uint32_t EncodeSnorm16(double value)
+	{
+		int32_t snorm = (int32_t)std::floor((std::min)((std::max)(value, -1.0), 1.0) * 32767.0 + 0.5);
+		return (uint32_t)(uint16_t)(int16_t)snorm;
+	}
+
+	static float DecodeSnorm16(uint32_t value)
+	{
+		return (std::max)((float)(int16_t)(uint16_t)value / 32767.0f, -1.0f);
+	}
+
+	static uint32_t EncodeUnorm16(double value)
+	{
+		return (uint32_t)std::floor((std::min)((std::max)(value, 0.0), 1.0) * 65535.0 + 0.5);
+	}
+
+	PlanetVertexFrame PlanetVertexCodec::CreateFrame(const Vector3& mins, const Vector3& maxs)
+	{
+		PlanetVertexFrame frame;
+		frame.Origin = { (float)mins.x, (float)mins.y, (float)mins.z };
+
+		// Measured from the rounded origin so the last step still reaches maxs
+		frame.Step.x = (float)((std::max)(maxs.x - (double)frame.Origin.x, 0.0) / (double)POSITION_MAX);
+		frame.Step.y = (float)((std::max)(maxs.y - (double)frame.Origin.y, 0.0) / (double)POSITION_MAX);
+		frame.Step.z = (float)((std::max)(maxs.z - (double)frame.Origin.z, 0.0) / (double)POSITION_MAX);
+
+		return frame;
+	}
+
+	PlanetVertex PlanetVertexCodec::Encode(const Vertex& vertex, const PlanetVertexFrame& frame)
+	{
+		uint32_t x = QuantizePosition((double)vertex.Position.x, frame.Origin.x, frame.Step.x);
+		uint32_t y = QuantizePosition((double)vertex.Position.y, frame.Origin.y, frame.Step.y);
+		uint32_t z = QuantizePosition((double)vertex.Position.z, frame.Origin.z, frame.Step.z);
+
+		PlanetVertex encoded;
+		encoded.Position[0] = x | (y << POSITION_BITS);
+		encoded.Position[1] = (y >> (32 - POSITION_BITS)) | (z << (2 * POSITION_BITS - 32));
+		encoded.Normal = EncodeOctahedral(vertex.Normal);
+		encoded.Texcoord = EncodeUnorm16((double)vertex.Texcoord.x) | (EncodeUnorm16((double)vertex.Texcoord.y) << 16);
+		encoded.Frame = 0;
+
+		return encoded;
+	}
+
+	void PlanetVertexCodec::Encode(const std::vector<Vertex>& vertices, const PlanetVertexFrame& frame, std::vector<PlanetVertex>& encoded)
+	{
+		encoded.resize(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			encoded[i] = Encode(vertices[i], frame);
+	}
+
+	Vertex PlanetVertexCodec::Decode(const PlanetVertex& vertex, const PlanetVertexFrame& frame)
+	{
+		uint32_t x = vertex.Position[0] & POSITION_MAX;
+		uint32_t y = (vertex.Position[0] >> POSITION_BITS) | ((vertex.Position[1] << (32 - POSITION_BITS)) & POSITION_MAX);
+		uint32_t z = (vertex.Position[1] >> (2 * POSITION_BITS - 32)) & POSITION_MAX;
+
+		Vertex decoded;
+		decoded.Position.x = (float)((double)frame.Origin.x + (double)x * (double)frame.Step.x);
+		decoded.Position.y = (float)((double)frame.Origin.y + (double)y * (double)frame.Step.y);
+		decoded.Position.z = (float)((double)frame.Origin.z + (double)z * (double)frame.Step.z);
+		decoded.Normal = DecodeOctahedral(vertex.Normal);
+		decoded.Texcoord.x = (float)(vertex.Texcoord & 0xFFFF) / 65535.0f;
+		decoded.Texcoord.y = (float)(vertex.Texcoord >> 16) / 65535.0f;
+
+		return decoded;
+	}
+
+	uint32_t PlanetVertexCodec::EncodeOctahedral(const DirectX::XMFLOAT3& normal)
+	{
+		double x = normal.x, y = normal.y, z = normal.z;
+
+		// Projected onto the octahedron, the lower half is folded over the upper one
+		double sum = std::abs(x) + std::abs(y) + std::abs(z);
+		if (sum <= 0.0)
+			return 0;
+
+		x /= sum;
+		y /= sum;
+		if (z < 0.0)
+		{
+			double foldedX = (1.0 - std::abs(y)) * (x >= 0.0 ? 1.0 : -1.0);
+			double foldedY = (1.0 - std::abs(x)) * (y >= 0.0 ? 1.0 : -1.0);
+			x = foldedX;
+			y = foldedY;
+		}
+
+		return EncodeSnorm16(x) | (EncodeSnorm16(y) << 16);
+	}
+
+	DirectX::XMFLOAT3 PlanetVertexCodec::DecodeOctahedral(uint32_t encoded)
+	{
+		float x = DecodeSnorm16(encoded & 0xFFFF);
+		float y = DecodeSnorm16(encoded >> 16);
+		float z = 1.0f - std::abs(x) - std::abs(y);
+
+		float fold = (std::max)(-z, 0.0f);
+		x += x >= 0.0f ? -fold : fold;
+		y += y >= 0.0f ? -fold : fold;
+
+		float length = std::sqrt(x * x + y * y + z * z);
+		return { x / length, y / length, z / length };
+	}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Toast/Core/Math/Math.h"
+
+#include <DirectXMath.h>
+
+#include <vector>
+
+namespace Toast {
+
+	// Forward deceleration, Vertex is found in Mesh.h
+	struct Vertex;
+
+	// Vertex the planet is drawn with, 20 bytes instead of the 60 of Vertex. The planet never fills Tangent or Color.
+	// Decoded by the planet shaders in assets/shaders/Rendering
+	struct PlanetVertex
+	{
+		// 21 bits per axis inside the frame of the patch, x in the low bits of the first word and z in the high bits of the second
+		uint32_t Position[2];
+		// Octahedral unit vector as two 16 bit snorms, x in the low half
+		uint32_t Normal;
+		// Two 16 bit unorms, u in the low half
+		uint32_t Texcoord;
+		// Slot of the patch frame in the planet frame buffer, set when the patch is placed in the mesh layout
+		uint32_t Frame;
+	};
+
+	// Box the positions of one patch are quantized in, laid out like the frame buffer elements the shaders read
+	struct PlanetVertexFrame
+	{
+		DirectX::XMFLOAT3 Origin = { 0.0f, 0.0f, 0.0f };
+		float Padding0 = 0.0f;
+		DirectX::XMFLOAT3 Step = { 0.0f, 0.0f, 0.0f };
+		float Padding1 = 0.0f;
+	};
+
+	class PlanetVertexCodec
+	{
+	public:
+		static constexpr uint32_t POSITION_BITS = 21;
+		static constexpr uint32_t POSITION_MAX = (1u << POSITION_BITS) - 1;
+	public:
+		// Frame covering the box, positions outside of it are clamped to its faces
+		static PlanetVertexFrame CreateFrame(const Vector3& mins, const Vector3& maxs);
+
+		static PlanetVertex Encode(const Vertex& vertex, const PlanetVertexFrame& frame);
+		static void Encode(const std::vector<Vertex>& vertices, const PlanetVertexFrame& frame, std::vector<PlanetVertex>& encoded);
+		// CPU side of the shader decode, for the terrain objects and for measuring the round trip error
+		static Vertex Decode(const PlanetVertex& vertex, const PlanetVertexFrame& frame);
+
+		static uint32_t EncodeOctahedral(const DirectX::XMFLOAT3& normal);
+		static DirectX::XMFLOAT3 DecodeOctahedral(uint32_t encoded);
+	};
+
+}
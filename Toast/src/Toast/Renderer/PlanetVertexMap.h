@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Toast/Core/Math/Math.h"
+
+#include <vector>
+
+namespace Toast {
+
+	// Flat open-addressing table from a vertex key to its index in a patch's vertex list, used to share smooth-shaded vertices.
+	// Keys are the stable CPUVertex ids, 0 marks an empty slot
+	class PlanetVertexMap
+	{
+	public:
+		PlanetVertexMap() = default;
+
+		// Key for vertices without an id, positions closer than 1/64 of a unit end up in the same slot
+		static uint64_t GetPositionKey(const Vector3& position)
+		{
+			uint64_t x = (uint64_t)(int64_t)std::floor(position.x * 64.0 + 0.5);
+			uint64_t y = (uint64_t)(int64_t)std::floor(position.y * 64.0 + 0.5);
+			uint64_t z = (uint64_t)(int64_t)std::floor(position.z * 64.0 + 0.5);
+
+			uint64_t key = x * 0x9E3779B97F4A7C15ull ^ y * 0xC2B2AE3D27D4EB4Full ^ z * 0x165667B19E3779F9ull;
+			key = (key ^ (key >> 31)) * 0xBF58476D1CE4E5B9ull;
+			key = key ^ (key >> 29);
+
+			return key ? key : 1;
+		}
+
+		// Makes room for count keys without growing, the previous build's vertex count is a good guess
+		void Reserve(size_t count)
+		{
+			size_t capacity = 16;
+			while (capacity < count * 2)
+				capacity *= 2;
+
+			if (capacity > mKeys.size())
+				Rehash(capacity);
+		}
+
+		void Clear()
+		{
+			if (mCount == 0)
+				return;
+
+			std::fill(mKeys.begin(), mKeys.end(), 0);
+			mCount = 0;
+		}
+
+		// Returns the index stored for key, or stores and returns index if the key is new
+		uint32_t FindOrInsert(uint64_t key, uint32_t index, bool& inserted)
+		{
+			if ((mCount + 1) * 10 > mKeys.size() * 7)
+				Rehash((std::max)((size_t)16, mKeys.size() * 2));
+
+			size_t slot = GetSlot(key);
+			while (mKeys[slot] != 0)
+			{
+				if (mKeys[slot] == key)
+				{
+					inserted = false;
+					return mIndices[slot];
+				}
+
+				slot = (slot + 1) & mMask;
+			}
+
+			mKeys[slot] = key;
+			mIndices[slot] = index;
+			mCount++;
+
+			inserted = true;
+			return index;
+		}
+
+		size_t Size() const { return mCount; }
+		size_t Capacity() const { return mKeys.size(); }
+	private:
+		// Corner ids are small numbers so the key is mixed before it picks a slot
+		size_t GetSlot(uint64_t key) const { return (size_t)((key * 0x9E3779B97F4A7C15ull) >> mShift); }
+
+		void Rehash(size_t capacity)
+		{
+			std::vector<uint64_t> keys(capacity, 0);
+			std::vector<uint32_t> indices(capacity);
+			std::swap(keys, mKeys);
+			std::swap(indices, mIndices);
+
+			mMask = capacity - 1;
+			mShift = 64;
+			for (size_t c = capacity; c > 1; c >>= 1)
+				mShift--;
+
+			for (size_t i = 0; i < keys.size(); i++)
+			{
+				if (keys[i] == 0)
+					continue;
+
+				size_t slot = GetSlot(keys[i]);
+				while (mKeys[slot] != 0)
+					slot = (slot + 1) & mMask;
+
+				mKeys[slot] = keys[i];
+				mIndices[slot] = indices[i];
+			}
+		}
+	private:
+		std::vector<uint64_t> mKeys;
+		std::vector<uint32_t> mIndices;
+		size_t mCount = 0;
+		size_t mMask = 0;
+		uint32_t mShift = 64;
+	};
+
+}
@@ -15,6 +15,19 @@ namespace Toast {
 
 	Scope<Renderer::RendererData> Renderer::sRendererData = CreateScope<Renderer::RendererData>();
 
+	// Planet vertices are relative to the planet. Its translation and the camera's world translation are both large, they're
+	// added once here so the shader only moves the vertices by the small difference
+	static DirectX::XMMATRIX GetCameraRelativeTransform(const DirectX::XMMATRIX& transform, const DirectX::XMFLOAT3& worldTranslation)
+	{
+		DirectX::XMFLOAT4X4 matrix;
+		DirectX::XMStoreFloat4x4(&matrix, transform);
+		matrix._41 += worldTranslation.x;
+		matrix._42 += worldTranslation.y;
+		matrix._43 += worldTranslation.z;
+
+		return DirectX::XMLoadFloat4x4(&matrix);
+	}
+
 	void Renderer::Init(uint32_t width, uint32_t height)
 	{
 		TOAST_PROFILE_FUNCTION();
@@ -203,6 +216,8 @@ namespace Toast {
 	{
 		TOAST_PROFILE_FUNCTION();
 
+		sRendererData->CameraWorldTranslation = camera.GetWorldTranslation();
+
 		// Updating the camera data in the buffer and mapping it to the GPU
 		sRendererData->CameraBuffer.Write((uint8_t*)&camera.GetWorldTranslationMatrix(), 64, 0);
 		sRendererData->CameraBuffer.Write((uint8_t*)&camera.GetViewMatrix(), 64, 64);
@@ -755,10 +770,20 @@ namespace Toast {
 		RenderCommand::ClearRenderTargets({ sRendererData->GPassPositionRT->GetRTV().Get(), sRendererData->GPassNormalRT->GetRTV().Get(), sRendererData->GPassAlbedoMetallicRT->GetRTV().Get(), sRendererData->GPassRoughnessAORT->GetRTV().Get(), sRendererData->GPassPickingRT->GetRTV().Get() }, { 0.0f, 0.0f, 0.0f, 1.0f });
 		RenderCommand::SetPrimitiveTopology(Topology::TRIANGLELIST);
 
-		ShaderLibrary::Get("assets/shaders/Rendering/GeometryPass.hlsl")->Bind();
+		Shader* geometryShader = ShaderLibrary::Get("assets/shaders/Rendering/GeometryPass.hlsl");
+		Shader* planetGeometryShader = ShaderLibrary::Get("assets/shaders/Rendering/PlanetGeometryPass.hlsl");
 
 		for (const auto& meshCommand : sRendererData->MeshDrawList)
 		{
+			// Planets are drawn with their compact vertices
+			if (meshCommand.PlanetData)
+			{
+				planetGeometryShader->Bind();
+				meshCommand.Mesh->BindPlanetFrames();
+			}
+			else
+				geometryShader->Bind();
+
 			if (meshCommand.Wireframe)
 				RenderCommand::SetRasterizerState(sRendererData->WireframeRasterizerState);
 			else
@@ -770,8 +795,11 @@ namespace Toast {
 
 			float clickable = meshCommand.PlanetData ? 0 : 1;
 
+			// Planets get the camera's world translation with their own, see PlanetGeometryPass.hlsl
+			DirectX::XMMATRIX transform = meshCommand.PlanetData ? GetCameraRelativeTransform(meshCommand.Transform, sRendererData->CameraWorldTranslation) : meshCommand.Transform;
+
 			// Model data
-			sRendererData->ModelBuffer.Write((uint8_t*)&meshCommand.Transform, 64, 0);
+			sRendererData->ModelBuffer.Write((uint8_t*)&transform, 64, 0);
 			sRendererData->ModelBuffer.Write((uint8_t*)&clickable, 4, 64);
 			sRendererData->ModelBuffer.Write((uint8_t*)&meshCommand.EntityID, 4, 68);
 			sRendererData->ModelBuffer.Write((uint8_t*)&meshCommand.NoWorldTransform, 4, 72);
@@ -849,10 +877,19 @@ namespace Toast {
 		RenderCommand::ClearRenderTargets({ sRendererData->ShadowMapRT->GetRTV().Get() }, { 0.0f, 0.0f, 0.0f, 1.0f });
 		RenderCommand::SetPrimitiveTopology(Topology::TRIANGLELIST);
 
-		ShaderLibrary::Get("assets/shaders/Rendering/ShadowPass.hlsl")->Bind();
+		Shader* shadowShader = ShaderLibrary::Get("assets/shaders/Rendering/ShadowPass.hlsl");
+		Shader* planetShadowShader = ShaderLibrary::Get("assets/shaders/Rendering/PlanetShadowPass.hlsl");
 
 		for (const auto& meshCommand : sRendererData->MeshDrawList)
 		{
+			if (meshCommand.PlanetData)
+			{
+				planetShadowShader->Bind();
+				meshCommand.Mesh->BindPlanetFrames();
+			}
+			else
+				shadowShader->Bind();
+
 			meshCommand.Mesh->Bind();
 
 			int isInstanced = meshCommand.Mesh->IsInstanced() ? 1 : 0;
@@ -32,6 +32,8 @@ namespace Toast {
 		struct RendererData
 		{
 			DirectX::XMFLOAT4 CameraPos;
+			// Floating origin offset of the camera, the shaders get it as worldTranslationMatrix
+			DirectX::XMFLOAT3 CameraWorldTranslation = { 0.0f, 0.0f, 0.0f };
 			DirectX::XMFLOAT4X4 ViewMatrix;
 			DirectX::XMFLOAT4X4 ProjectionMatrix;
 
@@ -145,6 +145,18 @@ namespace Toast {
 		deviceContext->Unmap(mVertexBuffer.Get(), NULL);
 	}
 
+	void VertexBuffer::SetSubData(const void* data, uint32_t offset, uint32_t size)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		RendererAPI* API = RenderCommand::sRendererAPI.get();
+		ID3D11DeviceContext* deviceContext = API->GetDeviceContext();
+
+		// Offset and size in bytes, only works on buffers created with D3D11_USAGE_DEFAULT
+		D3D11_BOX box = { offset, 0, 0, offset + size, 1, 1 };
+		deviceContext->UpdateSubresource(mVertexBuffer.Get(), 0, &box, data, 0, 0);
+	}
+
 	////////////////////////////////////////////////////////////////////////////////////////  
 	//     INDEXBUFFER     /////////////////////////////////////////////////////////////////  
 	//////////////////////////////////////////////////////////////////////////////////////// 
@@ -210,6 +222,18 @@ namespace Toast {
 		deviceContext->IASetIndexBuffer(NULL, DXGI_FORMAT_R32_UINT, 0);
 	}
 
+	void IndexBuffer::SetSubData(const void* data, uint32_t offset, uint32_t size)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		RendererAPI* API = RenderCommand::sRendererAPI.get();
+		ID3D11DeviceContext* deviceContext = API->GetDeviceContext();
+
+		// Offset and size in bytes
+		D3D11_BOX box = { offset, 0, 0, offset + size, 1, 1 };
+		deviceContext->UpdateSubresource(mIndexBuffer.Get(), 0, &box, data, 0, 0);
+	}
+
 	////////////////////////////////////////////////////////////////////////////////////////  
 	//     CONSTANTBUFFER     //////////////////////////////////////////////////////////////  
 	//////////////////////////////////////////////////////////////////////////////////////// 
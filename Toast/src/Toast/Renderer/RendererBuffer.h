@@ -62,6 +62,7 @@ namespace Toast {
 		virtual size_t GetBufferSize() const { return mSize; }
 
 		virtual void SetData(const void* data, uint32_t size);
+		virtual void SetSubData(const void* data, uint32_t offset, uint32_t size);
 	private:
 		Microsoft::WRL::ComPtr<ID3D11Buffer> mVertexBuffer = nullptr;
 		uint32_t mSize = 0, mCount, mBindSlot = 0;
@@ -78,6 +79,8 @@ namespace Toast {
 		virtual void Unbind() const;
 
 		virtual uint32_t GetCount() const { return mCount; }
+
+		virtual void SetSubData(const void* data, uint32_t offset, uint32_t size);
 	private:
 		Microsoft::WRL::ComPtr<ID3D11Buffer> mIndexBuffer = nullptr;
 		uint32_t mCount;
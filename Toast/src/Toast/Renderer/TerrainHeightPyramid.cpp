@@ -0,0 +1,152 @@
+#include "tpch.h"
+
+#include "TerrainHeightPyramid.h"
+
+#include "Toast/Renderer/Mesh.h"
+#include "Toast/Renderer/TiledHeightmap.h"
+
+namespace Toast {
+
+	static void Expand(TerrainHeightPyramid::Range& range, uint16_t texel)
+	{
+		range.Min = (std::min)(range.Min, texel);
+		range.Max = (std::max)(range.Max, texel);
+	}
+
+	static void Expand(TerrainHeightPyramid::Range& range, const TerrainHeightPyramid::Range& other)
+	{
+		range.Min = (std::min)(range.Min, other.Min);
+		range.Max = (std::max)(range.Max, other.Max);
+	}
+
+	TerrainHeightPyramid::BaseLevel::BaseLevel(uint32_t width, uint32_t height)
+		: mWidth(width), mHeight(height), mCellShift(0)
+	{
+		while ((uint64_t)((width + (1u << mCellShift) - 1) >> mCellShift) * ((height + (1u << mCellShift) - 1) >> mCellShift) > MAX_BASE_CELLS)
+			mCellShift++;
+
+		mCellsX = (width + (1u << mCellShift) - 1) >> mCellShift;
+		mCellsY = (height + (1u << mCellShift) - 1) >> mCellShift;
+		mRanges.assign((size_t)mCellsX * mCellsY, { UINT16_MAX, 0 });
+		mRow.resize(mCellsX);
+	}
+
+	void TerrainHeightPyramid::BaseLevel::AddRow(uint32_t y, const uint16_t* texels)
+	{
+		uint32_t cellSize = 1u << mCellShift;
+
+		// Samples with the last texel of a row or column as their first texel interpolate towards texel 0, like GetTexels
+		for (uint32_t cx = 0; cx < mCellsX; cx++)
+		{
+			Range& range = mRow[cx];
+			range = { UINT16_MAX, 0 };
+
+			uint32_t first = cx << mCellShift;
+			uint32_t last = (std::min)(first + cellSize, mWidth - 1);
+			for (uint32_t x = first; x <= last; x++)
+				Expand(range, texels[x]);
+
+			if (first + cellSize > mWidth - 1)
+				Expand(range, texels[0]);
+		}
+
+		Merge(y >> mCellShift, mRow);
+
+		// The first row of a cell is the last one the samples of the cell above read
+		if (y > 0 && y % cellSize == 0)
+			Merge((y >> mCellShift) - 1, mRow);
+
+		if (y == 0)
+			mFirstRow = mRow;
+	}
+
+	void TerrainHeightPyramid::BaseLevel::Finish()
+	{
+		for (uint32_t cy = 0; cy < mCellsY; cy++)
+		{
+			if ((cy << mCellShift) + (1u << mCellShift) > mHeight - 1)
+				Merge(cy, mFirstRow);
+		}
+	}
+
+	void TerrainHeightPyramid::BaseLevel::Merge(uint32_t cy, const std::vector<Range>& row)
+	{
+		if (cy >= mCellsY || row.empty())
+			return;
+
+		Range* cells = &mRanges[(size_t)cy * mCellsX];
+		for (uint32_t cx = 0; cx < mCellsX; cx++)
+			Expand(cells[cx], row[cx]);
+	}
+
+	Ref<TerrainHeightPyramid> TerrainHeightPyramid::Build(const TerrainData& terrainData)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		uint32_t width = (uint32_t)terrainData.Width, height = (uint32_t)terrainData.Height;
+		if (width == 0 || height == 0)
+			return nullptr;
+
+		if (terrainData.Tiles)
+		{
+			uint32_t cellShift, cellsX, cellsY;
+			std::vector<Range> ranges;
+			if (!terrainData.Tiles->ReadHeightRanges(cellShift, cellsX, cellsY, ranges))
+				return nullptr;
+
+			return Create(cellShift, cellsX, cellsY, std::move(ranges));
+		}
+
+		if (terrainData.HeightData.empty())
+			return nullptr;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		BaseLevel base(width, height);
+		for (uint32_t y = 0; y < height; y++)
+			base.AddRow(y, &terrainData.HeightData[(size_t)y * (terrainData.RowPitch / 2)]);
+		base.Finish();
+
+		Ref<TerrainHeightPyramid> pyramid = Create(base.GetCellShift(), base.GetWidth(), base.GetHeight(), base.GetRanges());
+
+		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+
+		TOAST_CORE_INFO("Terrain height pyramid built, %d levels, %d texel cells, time: %dms", (int)pyramid->mLevels.size(), (int)(1u << base.GetCellShift()), (int)duration.count());
+
+		return pyramid;
+	}
+
+	Ref<TerrainHeightPyramid> TerrainHeightPyramid::Create(uint32_t cellShift, uint32_t width, uint32_t height, std::vector<Range> ranges)
+	{
+		Ref<TerrainHeightPyramid> pyramid = CreateRef<TerrainHeightPyramid>();
+		pyramid->mCellShift = cellShift;
+
+		Level base;
+		base.Width = width;
+		base.Height = height;
+		base.Ranges = std::move(ranges);
+		pyramid->mLevels.emplace_back(std::move(base));
+
+		// Every following level merges 2x2 cells of the one before until a single cell is left
+		while (pyramid->mLevels.back().Width > 1 || pyramid->mLevels.back().Height > 1)
+		{
+			const Level& previous = pyramid->mLevels.back();
+
+			Level level;
+			level.Width = (previous.Width + 1) / 2;
+			level.Height = (previous.Height + 1) / 2;
+			level.Ranges.assign((size_t)level.Width * level.Height, { UINT16_MAX, 0 });
+
+			for (uint32_t y = 0; y < previous.Height; y++)
+			{
+				for (uint32_t x = 0; x < previous.Width; x++)
+					Expand(level.Ranges[(size_t)(y / 2) * level.Width + x / 2], previous.Ranges[(size_t)y * previous.Width + x]);
+			}
+
+			pyramid->mLevels.emplace_back(std::move(level));
+		}
+
+		return pyramid;
+	}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Toast/Core/Base.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+namespace Toast {
+
+	struct TerrainData;
+
+	// Lowest and highest texel below every cell of a quadtree over a height map. A cell covers every texel its bilinear
+	// samples read, so a ray above the highest texel of a cell can't hit the terrain inside of it
+	class TerrainHeightPyramid
+	{
+	public:
+		struct Range
+		{
+			uint16_t Min;
+			uint16_t Max;
+		};
+
+		// Finest level of a height map whose rows come in one after another, TiledHeightmap::Build stores it with the
+		// tiles so opening a scene doesn't read every texel again
+		class BaseLevel
+		{
+		public:
+			BaseLevel(uint32_t width, uint32_t height);
+
+			// Rows have to come in order
+			void AddRow(uint32_t y, const uint16_t* texels);
+			// The last cells also read row 0, call once every row is in
+			void Finish();
+
+			uint32_t GetCellShift() const { return mCellShift; }
+			uint32_t GetWidth() const { return mCellsX; }
+			uint32_t GetHeight() const { return mCellsY; }
+			const std::vector<Range>& GetRanges() const { return mRanges; }
+		private:
+			void Merge(uint32_t cy, const std::vector<Range>& row);
+		private:
+			uint32_t mWidth, mHeight;
+			uint32_t mCellShift;
+			uint32_t mCellsX, mCellsY;
+			std::vector<Range> mRanges;
+			std::vector<Range> mRow;
+			std::vector<Range> mFirstRow;
+		};
+	public:
+		// Cells in the finest level, bigger height maps get cells several texels wide
+		static constexpr uint32_t MAX_BASE_CELLS = 1u << 22;
+	public:
+		// Tiled height maps come with their finest level, other ones are read whole
+		static Ref<TerrainHeightPyramid> Build(const TerrainData& terrainData);
+		// Adds the coarser levels to a finest level of width x height cells, 1 << cellShift texels wide
+		static Ref<TerrainHeightPyramid> Create(uint32_t cellShift, uint32_t width, uint32_t height, std::vector<Range> ranges);
+
+		// Level 0 is the finest, the last level is a single cell
+		uint32_t GetLevelCount() const { return (uint32_t)mLevels.size(); }
+		// Cells of level 0 are 1 << GetCellShift() texels wide
+		uint32_t GetCellShift() const { return mCellShift; }
+		uint32_t GetWidth(uint32_t level) const { return mLevels[level].Width; }
+		uint32_t GetHeight(uint32_t level) const { return mLevels[level].Height; }
+
+		// x and y are clamped to the level
+		const Range& GetRange(uint32_t level, uint32_t x, uint32_t y) const
+		{
+			const Level& cells = mLevels[level];
+			return cells.Ranges[(size_t)(std::min)(y, cells.Height - 1) * cells.Width + (std::min)(x, cells.Width - 1)];
+		}
+	private:
+		struct Level
+		{
+			uint32_t Width, Height;
+			std::vector<Range> Ranges;
+		};
+	private:
+		std::vector<Level> mLevels;
+		uint32_t mCellShift = 0;
+	};
+
+}
@@ -0,0 +1,447 @@
+#include "tpch.h"
+
+#include "TiledHeightmap.h"
+
+#include <../vendor/directxtex/include/DirectXTex.h>
+
+#include <fstream>
+
+#define TILED_HEIGHTMAP_VERSION 2
+
+// File views have to start at a multiple of the allocation granularity, 64 KB on every Windows version
+#define TILED_HEIGHTMAP_ALIGNMENT 65536ull
+
+namespace Toast {
+
+	static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	TiledHeightmap::~TiledHeightmap()
+	{
+		for (uint32_t tileIndex : mMapped)
+			UnmapViewOfFile(mTiles[tileIndex].Texels.load());
+
+		if (mMapping)
+			CloseHandle((HANDLE)mMapping);
+		if (mFile)
+			CloseHandle((HANDLE)mFile);
+	}
+
+	Ref<TiledHeightmap> TiledHeightmap::Open(const std::string& sourcePath)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		std::string tiledPath = GetTiledPath(sourcePath);
+
+		std::error_code ec;
+		bool upToDate = std::filesystem::exists(tiledPath, ec);
+		if (upToDate && std::filesystem::exists(sourcePath, ec))
+			upToDate = std::filesystem::last_write_time(tiledPath, ec) >= std::filesystem::last_write_time(sourcePath, ec);
+
+		if (!upToDate && !Build(sourcePath, tiledPath))
+			return nullptr;
+
+		Ref<TiledHeightmap> heightmap = CreateRef<TiledHeightmap>();
+		if (heightmap->Map(tiledPath))
+			return heightmap;
+
+		if (!upToDate)
+			return nullptr;
+
+		// A file from an older version or one that was cut short is built again, the rejected mapping is closed first
+		// so it can be removed
+		heightmap = nullptr;
+		std::filesystem::remove(tiledPath, ec);
+		if (!Build(sourcePath, tiledPath))
+			return nullptr;
+
+		heightmap = CreateRef<TiledHeightmap>();
+		if (!heightmap->Map(tiledPath))
+			return nullptr;
+
+		return heightmap;
+	}
+
+	// Writes the tiles of every mip while the source rows stream in. Each level only keeps the band of rows its current
+	// row of tiles needs, and the level below it is box filtered from pairs of its rows as they arrive
+	class TileWriter
+	{
+	public:
+		TileWriter(std::ofstream& file, uint32_t width, uint32_t height, uint32_t tileSize, uint64_t tileStride)
+			: mFile(file), mTileSize(tileSize), mTileStride(tileStride), mTile((size_t)tileStride / sizeof(uint16_t))
+		{
+			uint64_t firstTile = 0;
+			while (true)
+			{
+				Level& level = mLevels.emplace_back();
+				level.Width = width;
+				level.Height = height;
+				level.TilesX = (width + tileSize - 1) / tileSize;
+				level.FirstTile = firstTile;
+				level.Band.resize((size_t)width * tileSize);
+
+				firstTile += (uint64_t)level.TilesX * ((height + tileSize - 1) / tileSize);
+
+				if (width <= tileSize && height <= tileSize)
+					break;
+
+				width = (std::max)((width + 1) / 2, 1u);
+				height = (std::max)((height + 1) / 2, 1u);
+			}
+
+			mTileCount = firstTile;
+		}
+
+		uint32_t GetMipCount() const { return (uint32_t)mLevels.size(); }
+		uint64_t GetTileCount() const { return mTileCount; }
+
+		// Rows of a level have to come in order
+		void AddRow(uint32_t levelIndex, const uint16_t* row)
+		{
+			Level& level = mLevels[levelIndex];
+
+			uint32_t y = level.Row++;
+			memcpy(&level.Band[(size_t)(y % mTileSize) * level.Width], row, level.Width * sizeof(uint16_t));
+
+			if (level.Row % mTileSize == 0 || level.Row == level.Height)
+				WriteBand(level, y / mTileSize);
+
+			if (levelIndex + 1 == mLevels.size())
+				return;
+
+			// The last row of an odd height is filtered with itself, like the clamped row of the 2x2 filter
+			if (y % 2 == 0 && y + 1 < level.Height)
+			{
+				level.Pending.assign(row, row + level.Width);
+				return;
+			}
+
+			const uint16_t* even = y % 2 == 0 ? row : level.Pending.data();
+
+			level.Filtered.resize(mLevels[levelIndex + 1].Width);
+			for (uint32_t x = 0; x < (uint32_t)level.Filtered.size(); x++)
+			{
+				uint32_t x0 = x * 2, x1 = (std::min)(x * 2 + 1, level.Width - 1);
+
+				uint32_t sum = even[x0] + even[x1] + row[x0] + row[x1];
+				level.Filtered[x] = (uint16_t)((sum + 2) / 4);
+			}
+
+			AddRow(levelIndex + 1, level.Filtered.data());
+		}
+	private:
+		struct Level
+		{
+			uint32_t Width, Height;
+			uint32_t TilesX;
+			uint64_t FirstTile;
+			uint32_t Row = 0;
+			std::vector<uint16_t> Band;
+			std::vector<uint16_t> Pending;
+			// Row of the next level
+			std::vector<uint16_t> Filtered;
+		};
+
+		// Tiles are stored mip by mip in row order, edge tiles are padded with zeroes that are never sampled
+		void WriteBand(const Level& level, uint32_t ty)
+		{
+			uint32_t rows = level.Row - ty * mTileSize;
+			for (uint32_t tx = 0; tx < level.TilesX; tx++)
+			{
+				std::fill(mTile.begin(), mTile.end(), (uint16_t)0);
+
+				uint32_t columns = (std::min)(mTileSize, level.Width - tx * mTileSize);
+				for (uint32_t row = 0; row < rows; row++)
+					memcpy(&mTile[(size_t)row * mTileSize], &level.Band[(size_t)row * level.Width + tx * mTileSize], columns * sizeof(uint16_t));
+
+				uint64_t tileIndex = level.FirstTile + (uint64_t)ty * level.TilesX + tx;
+				mFile.seekp((std::streamoff)(TILED_HEIGHTMAP_ALIGNMENT + tileIndex * mTileStride));
+				mFile.write(reinterpret_cast<const char*>(mTile.data()), (std::streamsize)mTileStride);
+			}
+		}
+	private:
+		std::ofstream& mFile;
+		uint32_t mTileSize;
+		uint64_t mTileStride;
+		uint64_t mTileCount = 0;
+
+		std::vector<Level> mLevels;
+		std::vector<uint16_t> mTile;
+	};
+
+	bool TiledHeightmap::Build(const std::string& sourcePath, const std::string& tiledPath)
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		std::wstring w;
+		std::copy(sourcePath.begin(), sourcePath.end(), back_inserter(w));
+
+		// The source is decoded a band of rows at a time, the whole image is never in memory
+		bool iswic2 = false;
+		IWICImagingFactory* factory = DirectX::GetWICFactory(iswic2);
+		if (!factory)
+		{
+			TOAST_CORE_ERROR("Unable to create a WIC factory for tiling %s", sourcePath.c_str());
+			return false;
+		}
+
+		Microsoft::WRL::ComPtr<IWICBitmapDecoder> decoder;
+		Microsoft::WRL::ComPtr<IWICBitmapFrameDecode> frame;
+		HRESULT result = factory->CreateDecoderFromFilename(w.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, decoder.GetAddressOf());
+		if (SUCCEEDED(result))
+			result = decoder->GetFrame(0, frame.GetAddressOf());
+		if (FAILED(result))
+		{
+			TOAST_CORE_ERROR("Unable to load height map %s for tiling", sourcePath.c_str());
+			return false;
+		}
+
+		WICPixelFormatGUID format;
+		UINT width = 0, height = 0;
+		frame->GetPixelFormat(&format);
+		frame->GetSize(&width, &height);
+		if (format != GUID_WICPixelFormat16bppGray || width == 0 || height == 0)
+		{
+			TOAST_CORE_ERROR("Height map %s isn't a 16 bit grayscale image", sourcePath.c_str());
+			return false;
+		}
+
+		std::ofstream file(tiledPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			TOAST_CORE_ERROR("Unable to create tiled height map %s", tiledPath.c_str());
+			return false;
+		}
+
+		const uint32_t tileSize = TILED_HEIGHTMAP_TILE_SIZE;
+		const uint64_t tileStride = AlignUp((uint64_t)tileSize * tileSize * sizeof(uint16_t), TILED_HEIGHTMAP_ALIGNMENT);
+
+		TileWriter writer(file, width, height, tileSize, tileStride);
+		TerrainHeightPyramid::BaseLevel ranges(width, height);
+
+		std::vector<uint16_t> band((size_t)width * tileSize);
+		for (uint32_t y = 0; y < height; y += tileSize)
+		{
+			uint32_t rows = (std::min)(tileSize, height - y);
+
+			WICRect rect = { 0, (INT)y, (INT)width, (INT)rows };
+			result = frame->CopyPixels(&rect, width * sizeof(uint16_t), (UINT)(band.size() * sizeof(uint16_t)), reinterpret_cast<BYTE*>(band.data()));
+			if (FAILED(result))
+			{
+				TOAST_CORE_ERROR("Failed decoding height map %s at row %d", sourcePath.c_str(), (int)y);
+				file.close();
+				std::error_code ec;
+				std::filesystem::remove(tiledPath, ec);
+				return false;
+			}
+
+			for (uint32_t row = 0; row < rows; row++)
+			{
+				writer.AddRow(0, &band[(size_t)row * width]);
+				ranges.AddRow(y + row, &band[(size_t)row * width]);
+			}
+		}
+
+		ranges.Finish();
+
+		uint64_t rangesOffset = TILED_HEIGHTMAP_ALIGNMENT + writer.GetTileCount() * tileStride;
+		file.seekp((std::streamoff)rangesOffset);
+		file.write(reinterpret_cast<const char*>(ranges.GetRanges().data()), (std::streamsize)(ranges.GetRanges().size() * sizeof(TerrainHeightPyramid::Range)));
+
+		Header header;
+		memcpy(header.Magic, "THMP", 4);
+		header.Version = TILED_HEIGHTMAP_VERSION;
+		header.Width = width;
+		header.Height = height;
+		header.TileSize = tileSize;
+		header.MipCount = writer.GetMipCount();
+		header.TileStride = tileStride;
+		header.RangesOffset = rangesOffset;
+		header.RangeCellShift = ranges.GetCellShift();
+		header.RangeWidth = ranges.GetWidth();
+		header.RangeHeight = ranges.GetHeight();
+		header.Padding = 0;
+
+		// The header goes in last so a file that was cut short while writing its tiles is never taken as valid
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+		if (!file)
+		{
+			TOAST_CORE_ERROR("Failed writing tiled height map %s", tiledPath.c_str());
+			return false;
+		}
+
+		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+
+		TOAST_CORE_INFO("Tiled height map built %s, %d mips, %d tiles, time: %dms", tiledPath.c_str(), (int)writer.GetMipCount(), (int)writer.GetTileCount(), (int)duration.count());
+
+		return true;
+	}
+
+	Ref<TiledHeightmap> TiledHeightmap::MapAgain() const
+	{
+		Ref<TiledHeightmap> heightmap = CreateRef<TiledHeightmap>();
+		if (!heightmap->Map(mPath))
+			return nullptr;
+
+		return heightmap;
+	}
+
+	bool TiledHeightmap::Map(const std::string& tiledPath)
+	{
+		mPath = tiledPath;
+
+		HANDLE file = CreateFileA(tiledPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			TOAST_CORE_ERROR("Unable to open tiled height map %s", tiledPath.c_str());
+			return false;
+		}
+		mFile = file;
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping)
+		{
+			TOAST_CORE_ERROR("Unable to map tiled height map %s", tiledPath.c_str());
+			return false;
+		}
+		mMapping = mapping;
+
+		const Header* header = reinterpret_cast<const Header*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(Header)));
+		if (!header)
+			return false;
+
+		bool valid = memcmp(header->Magic, "THMP", 4) == 0 && header->Version == TILED_HEIGHTMAP_VERSION && header->TileSize > 0 && header->TileStride % TILED_HEIGHTMAP_ALIGNMENT == 0
+			&& header->Width > 0 && header->Height > 0 && header->MipCount > 0 && header->MipCount <= 32;
+		if (valid)
+		{
+			mTileSize = header->TileSize;
+			mTileStride = header->TileStride;
+			mDataOffset = TILED_HEIGHTMAP_ALIGNMENT;
+			mRangesOffset = header->RangesOffset;
+			mRangeCellShift = header->RangeCellShift;
+			mRangeWidth = header->RangeWidth;
+			mRangeHeight = header->RangeHeight;
+
+			// The ranges have to cover the map the way TerrainHeightPyramid::BaseLevel lays them out
+			valid = mRangeCellShift < 16 && mRangeWidth == (header->Width + (1u << mRangeCellShift) - 1) >> mRangeCellShift
+				&& mRangeHeight == (header->Height + (1u << mRangeCellShift) - 1) >> mRangeCellShift;
+
+			uint32_t width = header->Width, height = header->Height;
+			for (uint32_t level = 0; level < header->MipCount; level++)
+			{
+				MipLevel mip;
+				mip.Width = width;
+				mip.Height = height;
+				mip.TilesX = (width + mTileSize - 1) / mTileSize;
+				mip.TilesY = (height + mTileSize - 1) / mTileSize;
+				mip.FirstTile = mTileCount;
+				mMips.emplace_back(mip);
+
+				mTileCount += mip.TilesX * mip.TilesY;
+
+				width = (std::max)((width + 1) / 2, 1u);
+				height = (std::max)((height + 1) / 2, 1u);
+			}
+		}
+
+		UnmapViewOfFile(header);
+
+		// A build that didn't finish leaves tiles or ranges missing at the end
+		LARGE_INTEGER fileSize;
+		uint64_t rangesSize = (uint64_t)mRangeWidth * mRangeHeight * sizeof(TerrainHeightPyramid::Range);
+		if (valid && (!GetFileSizeEx(file, &fileSize) || mRangesOffset % TILED_HEIGHTMAP_ALIGNMENT != 0 || mRangesOffset < mDataOffset + (uint64_t)mTileCount * mTileStride
+			|| (uint64_t)fileSize.QuadPart < mRangesOffset + rangesSize))
+			valid = false;
+
+		if (!valid)
+		{
+			TOAST_CORE_ERROR("Tiled height map %s is invalid or from an older version", tiledPath.c_str());
+			return false;
+		}
+
+		mTiles = std::make_unique<Tile[]>(mTileCount);
+
+		TOAST_CORE_INFO("Tiled height map mapped width: %d, height: %d, mips: %d, tiles: %d", mMips[0].Width, mMips[0].Height, (int)mMips.size(), mTileCount);
+
+		return true;
+	}
+
+	bool TiledHeightmap::ReadHeightRanges(uint32_t& cellShift, uint32_t& width, uint32_t& height, std::vector<TerrainHeightPyramid::Range>& ranges) const
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		size_t size = (size_t)mRangeWidth * mRangeHeight * sizeof(TerrainHeightPyramid::Range);
+		if (size == 0)
+			return false;
+
+		const TerrainHeightPyramid::Range* stored = reinterpret_cast<const TerrainHeightPyramid::Range*>(MapViewOfFile((HANDLE)mMapping, FILE_MAP_READ, (DWORD)(mRangesOffset >> 32), (DWORD)(mRangesOffset & 0xFFFFFFFF), (SIZE_T)size));
+		if (!stored)
+		{
+			TOAST_CORE_ERROR("Unable to map the height ranges of %s", mPath.c_str());
+			return false;
+		}
+
+		ranges.assign(stored, stored + (size_t)mRangeWidth * mRangeHeight);
+		UnmapViewOfFile(stored);
+
+		cellShift = mRangeCellShift;
+		width = mRangeWidth;
+		height = mRangeHeight;
+
+		return true;
+	}
+
+	const uint16_t* TiledHeightmap::MapTile(uint32_t tileIndex) const
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		std::lock_guard<std::mutex> lock(mMapMutex);
+
+		// Another thread might have mapped it while this one was waiting
+		const uint16_t* texels = mTiles[tileIndex].Texels.load(std::memory_order_acquire);
+		if (texels)
+			return texels;
+
+		uint64_t offset = mDataOffset + (uint64_t)tileIndex * mTileStride;
+		texels = reinterpret_cast<const uint16_t*>(MapViewOfFile((HANDLE)mMapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)(offset & 0xFFFFFFFF), (SIZE_T)mTileSize * mTileSize * sizeof(uint16_t)));
+		TOAST_CORE_ASSERT(texels, "Unable to map height map tile!");
+
+		mTiles[tileIndex].Texels.store(texels, std::memory_order_release);
+		mMapped.emplace_back(tileIndex);
+
+		return texels;
+	}
+
+	void TiledHeightmap::Trim()
+	{
+		TOAST_PROFILE_FUNCTION();
+
+		std::lock_guard<std::mutex> lock(mMapMutex);
+
+		if (mMapped.size() > mCapacity)
+		{
+			size_t excess = mMapped.size() - mCapacity;
+
+			// Moves the least recently used tiles to the front
+			std::nth_element(mMapped.begin(), mMapped.begin() + excess, mMapped.end(), [&](uint32_t a, uint32_t b) { return mTiles[a].LastUsed.load(std::memory_order_relaxed) < mTiles[b].LastUsed.load(std::memory_order_relaxed); });
+
+			for (size_t i = 0; i < excess; i++)
+			{
+				Tile& tile = mTiles[mMapped[i]];
+				UnmapViewOfFile(tile.Texels.load());
+				tile.Texels.store(nullptr, std::memory_order_release);
+			}
+
+			mMapped.erase(mMapped.begin(), mMapped.begin() + excess);
+		}
+
+		mGeneration.fetch_add(1, std::memory_order_relaxed);
+	}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Toast/Core/Base.h"
+
+#include "Toast/Renderer/TerrainHeightPyramid.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TILED_HEIGHTMAP_TILE_SIZE 256
+// 1024 tiles of 256x256 texels is 128 MB of mapped views
+#define TILED_HEIGHTMAP_CACHE_CAPACITY 1024
+// Physics only reads the tiles below its bodies
+#define TILED_HEIGHTMAP_PHYSICS_CAPACITY 64
+
+namespace Toast {
+
+	// 16 bit heightmap split into square tiles with a mip pyramid. The tiles live in a file next to the source image
+	// and are memory mapped one at a time, only the least recently used ones are kept mapped.
+	class TiledHeightmap
+	{
+	public:
+		struct Header
+		{
+			char Magic[4];
+			uint32_t Version;
+			uint32_t Width;
+			uint32_t Height;
+			uint32_t TileSize;
+			uint32_t MipCount;
+			// Bytes from the start of one tile to the next, a multiple of the mapping granularity
+			uint64_t TileStride;
+			// Finest level of the TerrainHeightPyramid, stored after the tiles
+			uint64_t RangesOffset;
+			uint32_t RangeCellShift;
+			uint32_t RangeWidth;
+			uint32_t RangeHeight;
+			uint32_t Padding;
+		};
+	public:
+		TiledHeightmap() = default;
+		~TiledHeightmap();
+
+		TiledHeightmap(const TiledHeightmap&) = delete;
+		TiledHeightmap& operator=(const TiledHeightmap&) = delete;
+
+		// Maps the tiled file of the source image, it's built first if it's missing, older than the source or rejected
+		// when mapped
+		static Ref<TiledHeightmap> Open(const std::string& sourcePath);
+		static bool Build(const std::string& sourcePath, const std::string& tiledPath);
+
+		static std::string GetTiledPath(const std::string& sourcePath) { return sourcePath + ".tiles"; }
+
+		// Maps the same file again with a tile cache of its own, for readers that can't wait for the Trim of this one
+		Ref<TiledHeightmap> MapAgain() const;
+
+		uint32_t GetWidth(uint32_t mip = 0) const { return mMips[mip].Width; }
+		uint32_t GetHeight(uint32_t mip = 0) const { return mMips[mip].Height; }
+		uint32_t GetMipCount() const { return (uint32_t)mMips.size(); }
+
+		// Finest level of the min and max pyramid of mip 0, see TerrainHeightPyramid::BaseLevel
+		bool ReadHeightRanges(uint32_t& cellShift, uint32_t& width, uint32_t& height, std::vector<TerrainHeightPyramid::Range>& ranges) const;
+
+		// x and y have to be inside the mip, safe to call from several threads
+		uint16_t GetTexel(uint32_t mip, uint32_t x, uint32_t y) const
+		{
+			const MipLevel& level = mMips[mip];
+			uint32_t tileIndex = level.FirstTile + (y / mTileSize) * level.TilesX + (x / mTileSize);
+
+			Tile& tile = mTiles[tileIndex];
+			const uint16_t* texels = tile.Texels.load(std::memory_order_acquire);
+			if (!texels)
+				texels = MapTile(tileIndex);
+
+			tile.LastUsed.store(mGeneration.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+			return texels[(y % mTileSize) * mTileSize + (x % mTileSize)];
+		}
+
+		// Unmaps the least recently used tiles above the capacity, nothing can sample the heightmap while this runs. Readers
+		// on other threads that run at their own time get their own mapping with MapAgain
+		void Trim();
+
+		void SetCapacity(uint32_t tiles) { mCapacity = tiles; }
+		uint32_t GetCapacity() const { return mCapacity; }
+		uint32_t GetMappedTiles() const { return (uint32_t)mMapped.size(); }
+	private:
+		struct MipLevel
+		{
+			uint32_t Width, Height;
+			uint32_t TilesX, TilesY;
+			uint32_t FirstTile;
+		};
+
+		struct Tile
+		{
+			std::atomic<const uint16_t*> Texels{ nullptr };
+			std::atomic<uint64_t> LastUsed{ 0 };
+		};
+
+		bool Map(const std::string& tiledPath);
+		const uint16_t* MapTile(uint32_t tileIndex) const;
+	private:
+		std::string mPath;
+		void* mFile = nullptr;
+		void* mMapping = nullptr;
+
+		uint32_t mTileSize = TILED_HEIGHTMAP_TILE_SIZE;
+		uint64_t mTileStride = 0;
+		uint64_t mDataOffset = 0;
+
+		uint64_t mRangesOffset = 0;
+		uint32_t mRangeCellShift = 0;
+		uint32_t mRangeWidth = 0;
+		uint32_t mRangeHeight = 0;
+
+		std::vector<MipLevel> mMips;
+		mutable std::unique_ptr<Tile[]> mTiles;
+		uint32_t mTileCount = 0;
+
+		mutable std::mutex mMapMutex;
+		mutable std::vector<uint32_t> mMapped;
+
+		std::atomic<uint64_t> mGeneration{ 1 };
+		uint32_t mCapacity = TILED_HEIGHTMAP_CACHE_CAPACITY;
+	};
+
+}
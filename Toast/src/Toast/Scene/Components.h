@@ -8,6 +8,8 @@
 #include "Toast/Scene/SceneCamera.h"
 
 #include "Toast/Renderer/Mesh.h"
+#include "Toast/Renderer/PlanetNode.h"
+#include "Toast/Renderer/PlanetPatchCache.h"
 #include "Toast/Renderer/SceneEnvironment.h"
 
 #include "Toast/Renderer/UI/UIElement.h"
@@ -20,15 +22,15 @@
 
 namespace Toast {
 
-	// Forward deceleration, PlanetNode is found in PlanetSystem.cpp
-	struct PlanetNode;
-
 	// Forward deceleration, Particle is found in ParticleSystem.h
 	struct Particle;
 
 	// Forward deceleration, EmitFunction is found in ParticleSystem.h
 	enum class EmitFunction;
 
+	// Forward deceleration, PlanetGenerator is found in PlanetGenerator.h
+	class PlanetGenerator;
+
 	struct PairHash {
 		std::size_t operator()(const std::pair<int, int>& p) const {
 			return std::hash<int>()(p.first) ^ (std::hash<int>()(p.second) << 1);
@@ -145,19 +147,41 @@ namespace Toast {
 		bool IsDirty;
 
 		Ref<Mesh> RenderMesh;
-		std::vector<Vertex> BuildVertices;
-		std::vector<uint32_t> BuildIndices;
+		// Written by the generation job while RenderMesh and MeshLayout keep the previous generation,
+		// UpdatePlanet lays it out and swaps it in once the job is done
+		PlanetBuildOutput Build;
+		PlanetMeshLayout MeshLayout;
 
 		std::vector<double> DistanceLUT;
 		std::vector<double> FaceLevelDotLUT;
 		std::vector<double> HeightMultLUT;
 		int16_t Subdivisions = 0;
+
+		// Largest error in pixels a node is allowed to have on screen before it's split
+		float LODPixelError = 2.0f;
+		// Distance at which a geometric error of 1 reaches LODPixelError, for the projection below
+		double LODErrorScale = 0.0;
+		float LODFoV = 0.0f;
+		float LODViewportHeight = 0.0f;
+
+		// Triangles the planet may use, 0 for no limit. Between generations the split distances are scaled by LODBudgetScale
+		// to stay below it
+		uint32_t TriangleBudget = 0;
+		double LODBudgetScale = 1.0;
+		// Triangles of the last finished build
+		uint32_t TriangleCount = 0;
+
+		// Seconds ahead along the camera velocity the LOD is prepared for, 0 disables the look-ahead
+		float PrefetchTime = 0.0f;
+
+		// Vertex normals from the height map gradient instead of summed face normals. Smooth shading still shares the vertices
+		bool AnalyticNormals = false;
 		
 		GPUData PlanetData;
 
-		std::unordered_map<Vertex, size_t, Vertex::Hasher, Vertex::Equal> VertexMap;
-
-		std::vector<Ref<PlanetNode>> PlanetNodesWorldSpace;
+		// Base tree, caches and generation job of the planet, created by PlanetSystem::GetGenerator. Copies of the
+		// component share it
+		Ref<PlanetGenerator> Generator;
 
 		// Remove
 		std::unordered_map<std::pair<int, int>, std::vector<Vector3>, PairHash> TerrainChunks;
@@ -339,11 +363,25 @@ namespace Toast {
 
 	struct TerrainObjectComponent
 	{
+		// Objects scattered over one planet patch, kept until the patch is rebuilt or leaves the activation distance
+		struct Cell
+		{
+			Ref<PlanetPatchGeometry> Geometry;
+			std::vector<DirectX::XMFLOAT3> Positions;
+			bool Active = false;
+		};
+
 		int SubdivisionActivation = 0;
 		int MaxNrOfObjectPerFace = 0;
 		int MaxNrOfObjects = 0;
 		Ref<Mesh> MeshObject;
 
+		std::unordered_map<uint32_t, Cell> Cells;
+		// Last instance data uploaded to MeshObject and the camera position and planet transform it was picked for
+		std::vector<DirectX::XMFLOAT3> Instances;
+		Vector3 GatherCameraPos;
+		Matrix GatherPlanetTransform = Matrix::Identity();
+
 		TerrainObjectComponent() = default;
 		TerrainObjectComponent(const TerrainObjectComponent& other) = default;
 		TerrainObjectComponent(const Ref<Mesh>& mesh)
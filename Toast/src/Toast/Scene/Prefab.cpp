@@ -225,6 +225,15 @@ namespace Toast {
 		if (planetComponent)
 		{
 			auto& pc = deserializedEntity.AddComponent<PlanetComponent>(planetComponent["Subdivisions"].as<int16_t>(), planetComponent["MaxAltitude"].as<float>(), planetComponent["MinAltitude"].as<float>(), planetComponent["Radius"].as<float>(), planetComponent["GravitationalAcceleration"].as<float>(), planetComponent["SmoothShading"].as<bool>(), planetComponent["AtmosphereHeight"].as<float>(), planetComponent["AtmosphereToggle"].as<bool>(), planetComponent["InScatteringPoints"].as<int>(), planetComponent["OpticalDepthPoints"].as<int>(), planetComponent["MieAnisotropy"].as<float>(), planetComponent["RayScaleHeight"].as<float>(), planetComponent["MieScaleHeight"].as<float>(), planetComponent["RayBaseScatteringCoefficient"].as<DirectX::XMFLOAT3>(), planetComponent["MieBaseScatteringCoefficient"].as<float>(), planetComponent["SunDisc"].as<bool>(), planetComponent["SunDiscRadius"].as<float>(), planetComponent["SunGlowIntensity"].as<float>(), planetComponent["SunEdgeSoftness"].as<float>(), planetComponent["SunGlowSize"].as<float>());
+
+			if (planetComponent["LODPixelError"])
+				pc.LODPixelError = planetComponent["LODPixelError"].as<float>();
+			if (planetComponent["TriangleBudget"])
+				pc.TriangleBudget = planetComponent["TriangleBudget"].as<uint32_t>();
+			if (planetComponent["PrefetchTime"])
+				pc.PrefetchTime = planetComponent["PrefetchTime"].as<float>();
+			if (planetComponent["AnalyticNormals"])
+				pc.AnalyticNormals = planetComponent["AnalyticNormals"].as<bool>();
 		}
 
 		auto skylightComponent = entityData["SkyLightComponent"];
@@ -350,7 +359,7 @@ namespace Toast {
 				if (!tcc.Collider->mFilePath.empty())
 					pc.TerrainData = PhysicsEngine::LoadTerrainData(tcc.Collider->mFilePath.c_str(), pc.PlanetData.maxAltitude, pc.PlanetData.minAltitude);
 
-				PlanetSystem::CalculateBasePlanet(pc, pc.PlanetData.radius);
+				PlanetSystem::CalculateBasePlanet(pc, pc.PlanetData.radius, tcc.Collider->mFilePath);
 
 				tcc.Collider->mMaxAltitude = planetComponent["MaxAltitude"].as<float>() + planetComponent["Radius"].as<float>();
 				tcc.Collider->CalculateBounds();
@@ -592,6 +601,10 @@ namespace Toast {
 			out << YAML::Key << "SunGlowIntensity" << YAML::Value << pc.PlanetData.SunGlowIntensity;
 			out << YAML::Key << "SunEdgeSoftness" << YAML::Value << pc.PlanetData.SunEdgeSoftness;
 			out << YAML::Key << "SunGlowSize" << YAML::Value << pc.PlanetData.SunGlowSize;
+			out << YAML::Key << "LODPixelError" << YAML::Value << pc.LODPixelError;
+			out << YAML::Key << "TriangleBudget" << YAML::Value << pc.TriangleBudget;
+			out << YAML::Key << "PrefetchTime" << YAML::Value << pc.PrefetchTime;
+			out << YAML::Key << "AnalyticNormals" << YAML::Value << pc.AnalyticNormals;
 
 			out << YAML::EndMap; // PlanetComponent
 		}
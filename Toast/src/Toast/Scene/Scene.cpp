@@ -43,7 +43,7 @@ namespace Toast {
 		{
 			auto [planet, planetTransform] = view.get<PlanetComponent, TransformComponent>(entity);
 
-			PlanetSystem::Shutdown();
+			PlanetSystem::Shutdown(planet);
 		}
 
 		sActiveScenes.erase(mSceneID);
@@ -167,6 +167,8 @@ namespace Toast {
 			}
 
 			mStats.VerticesCount = 0;
+			mStats.PlanetTriangles = 0;
+			mStats.PlanetTriangleBudget = 0;
 		}
 
 		if (!mIsPaused) 
@@ -310,6 +312,7 @@ namespace Toast {
 		}
 
 		SceneCamera* mainCamera = nullptr;
+		Entity mainCameraEntity;
 		DirectX::XMMATRIX cameraTransform;
 		{
 			auto view = mRegistry.view<TransformComponent, CameraComponent>();
@@ -320,6 +323,7 @@ namespace Toast {
 				if (camera.Primary)
 				{
 					mainCamera = &camera.Camera;
+					mainCameraEntity = { entity, this };
 					cameraTransform = transform.GetTransform();
 
 					break;
@@ -450,6 +454,10 @@ namespace Toast {
 				if (e.HasComponent<TerrainColliderComponent>())
 					tcc = &e.GetComponent<TerrainColliderComponent>();
 
+				// The LOD metric depends on the projection
+				if (pc.LODFoV != mainCamera->GetPerspectiveVerticalFOV() || pc.LODViewportHeight != (float)mViewportHeight)
+					PlanetSystem::GenerateDistanceLUT(pc, mainCamera->GetPerspectiveVerticalFOV(), (float)mViewportHeight);
+
 				DirectX::XMVECTOR cameraForward = { 0.0f, 0.0f, 1.0f };
 				DirectX::XMVECTOR cameraPos, cameraRot, cameraScale;
 
@@ -464,9 +472,20 @@ namespace Toast {
 				// Starting new thread to create a new planet if one isn't already being created
 				DirectX::XMVECTOR cameraPosWorldMovement = DirectX::XMLoadFloat3(&mainCamera->GetWorldTranslation());
 
-				PlanetSystem::RegeneratePlanet(mFrustum, tc.Scale, tc.Translation, noScaleModelMatrix, -cameraPosWorldMovement, mSettings.BackfaceCulling, mSettings.FrustumCulling, pc, tcc->BuildColliders, tcc->BuildColliderPositions, tdc);
+				// The look-ahead follows the rigid body the camera sits on, if there is one
+				const Vector3* cameraVelocity = nullptr;
+				if (mainCameraEntity.HasComponent<RigidBodyComponent>())
+					cameraVelocity = &mainCameraEntity.GetComponent<RigidBodyComponent>().LinearVelocity;
+				else if (mainCameraEntity.HasParent())
+				{
+					Entity cameraParent = FindEntityByUUID(mainCameraEntity.GetParentUUID());
+					if (cameraParent && cameraParent.HasComponent<RigidBodyComponent>())
+						cameraVelocity = &cameraParent.GetComponent<RigidBodyComponent>().LinearVelocity;
+				}
+
+				PlanetSystem::RegeneratePlanet(mFrustum, tc.Scale, tc.Translation, noScaleModelMatrix, -cameraPosWorldMovement, mSettings.BackfaceCulling, mSettings.FrustumCulling, pc, tcc->BuildColliders, tcc->BuildColliderPositions, tdc, cameraVelocity);
 
-				PlanetSystem::UpdatePlanet(pc.RenderMesh, pc.BuildVertices, pc.BuildIndices, *tcc);
+				PlanetSystem::UpdatePlanet(pc.RenderMesh, pc, *tcc);
 			}
 
 			DirectX::XMMatrixDecompose(&cameraScale, &cameraRot, &cameraPos, cameraTransform);
@@ -498,10 +517,44 @@ namespace Toast {
 
 				// Meshes!
 				auto viewMeshes = mRegistry.view<TransformComponent, MeshComponent>();
+
+				// All the meshes are tested against the camera frustum in one batch, in the order the view is walked below
+				bool cullMeshes = mSettings.FrustumCulling && mFrustum;
+				if (cullMeshes)
+				{
+					InvalidateFrustum();
+
+					mMeshSpheres.Clear();
+					for (auto entity : viewMeshes)
+					{
+						auto [transform, mesh] = viewMeshes.get<TransformComponent, MeshComponent>(entity);
+
+						// Instances are placed by their own buffer, those meshes are always drawn
+						double radius = mesh.MeshObject->GetBoundingRadius();
+						if (radius < 0.0 || mesh.MeshObject->IsInstanced())
+						{
+							mMeshSpheres.Add(Vector3(), DBL_MAX);
+							continue;
+						}
+
+						const Vector3& localCenter = mesh.MeshObject->GetBoundingCenter();
+						DirectX::XMVECTOR center = DirectX::XMVector3Transform(DirectX::XMVectorSet((float)localCenter.x, (float)localCenter.y, (float)localCenter.z, 1.0f), transform.GetTransform());
+						double scale = (std::max)(std::abs(transform.Scale.x), (std::max)(std::abs(transform.Scale.y), std::abs(transform.Scale.z)));
+
+						mMeshSpheres.Add(Vector3(center), radius * scale);
+					}
+
+					mFrustum->CullSpheres(mMeshSpheres, mMeshVisible);
+				}
+
+				size_t meshIndex = 0;
 				for (auto entity : viewMeshes)
 				{
 					auto [transform, mesh] = viewMeshes.get<TransformComponent, MeshComponent>(entity);
 
+					if (cullMeshes && !mMeshVisible[meshIndex++])
+						continue;
+
 					//Do not submit mesh if it's a planet
 					//if (!mesh.MeshObject->GetIsPlanet())
 					//{
@@ -568,14 +621,14 @@ namespace Toast {
 					case Settings::Wireframe::NO:
 					{
 						if (planet.RenderMesh->mLODGroups[0]->Submeshes.size() > 0)
-							Renderer::SubmitMesh(planet.RenderMesh, DirectX::XMMatrixIdentity(), (int)entity, false, 1, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
+							Renderer::SubmitMesh(planet.RenderMesh, transform.GetTransformWithoutScale(), (int)entity, false, 0, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
 
 						break;
 					}
 					case Settings::Wireframe::YES:
 					{
 						if (planet.RenderMesh->mLODGroups[0]->Submeshes.size() > 0)
-							Renderer::SubmitMesh(planet.RenderMesh, DirectX::XMMatrixIdentity(), (int)entity, false, 1, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
+							Renderer::SubmitMesh(planet.RenderMesh, transform.GetTransformWithoutScale(), (int)entity, false, 0, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
 
 						break;
 					}
@@ -587,7 +640,9 @@ namespace Toast {
 					}
 					}
 
-					mStats.VerticesCount += static_cast<uint32_t>(planet.RenderMesh->GetVertices().size());
+					mStats.VerticesCount += planet.MeshLayout.GetVertexCount();
+					mStats.PlanetTriangles += planet.TriangleCount;
+					mStats.PlanetTriangleBudget += planet.TriangleBudget;
 				}
 
 				Renderer::EndScene(true, mSettings.Shadows, mSettings.SSAO, mSettings.DynamicIBL, *mainCamera, cameraPosFloat, mSettings.SSAORadius, mSettings.SSAObias);
@@ -828,6 +883,8 @@ namespace Toast {
 			}
 
 			mStats.VerticesCount = 0;
+			mStats.PlanetTriangles = 0;
+			mStats.PlanetTriangleBudget = 0;
 		}
 		// Frustum corners in light's view space
 		DirectX::XMVECTOR frustumCorners[8];
@@ -1042,10 +1099,15 @@ namespace Toast {
 
 				if (mainCamera)
 				{
+					// The LOD metric depends on the projection
+					float fov = mainCameraComponent->Camera.GetPerspectiveVerticalFOV();
+					if (pc.LODFoV != fov || pc.LODViewportHeight != (float)mViewportHeight)
+						PlanetSystem::GenerateDistanceLUT(pc, fov, (float)mViewportHeight);
+
 					if (pc.IsDirty)
 					{
-						PlanetSystem::GenerateDistanceLUT(pc.DistanceLUT, pc.PlanetData.radius, mainCameraComponent->Camera.GetPerspectiveVerticalFOV(), mViewportWidth);
-						PlanetSystem::GenerateFaceDotLevelLUT(pc.FaceLevelDotLUT, tc.Scale.x, pc.PlanetData.maxAltitude);
+						PlanetSystem::GenerateDistanceLUT(pc, fov, (float)mViewportHeight);
+						PlanetSystem::GenerateFaceDotLevelLUT(pc, tc.Scale.x, pc.PlanetData.maxAltitude);
 						PlanetSystem::GenerateHeightMultLUT(pc.HeightMultLUT, tc.Scale.x, pc.PlanetData.maxAltitude);
 
 						pc.IsDirty = false;
@@ -1066,7 +1128,7 @@ namespace Toast {
 					PlanetSystem::RegeneratePlanet(mFrustum, tc.Scale, tc.Translation, noScaleModelMatrix, cameraPos, mSettings.BackfaceCulling, mSettings.FrustumCulling, pc, tcc->BuildColliders, tcc->BuildColliderPositions, tdc);
 
 					// Check if planet build is ready and if that is the case move it to the render mesh
-					PlanetSystem::UpdatePlanet(pc.RenderMesh, pc.BuildVertices, pc.BuildIndices, *tcc);
+					PlanetSystem::UpdatePlanet(pc.RenderMesh, pc, *tcc);
 
 					if (e.HasComponent<TerrainObjectComponent>()) 
 					{
@@ -1175,14 +1237,14 @@ namespace Toast {
 				case Settings::Wireframe::NO:
 				{
 					if (planet.RenderMesh->mLODGroups[0]->Submeshes.size() > 0)
-						Renderer::SubmitMesh(planet.RenderMesh, DirectX::XMMatrixIdentity(), (int)entity, false, 1, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
+						Renderer::SubmitMesh(planet.RenderMesh, transform.GetTransformWithoutScale(), (int)entity, false, 0, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
 
 					break;
 				}
 				case Settings::Wireframe::YES:
 				{
 					if (planet.RenderMesh->mLODGroups[0]->Submeshes.size() > 0)
-						Renderer::SubmitMesh(planet.RenderMesh, DirectX::XMMatrixIdentity(), (int)entity, true, 1, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
+						Renderer::SubmitMesh(planet.RenderMesh, transform.GetTransformWithoutScale(), (int)entity, true, 0, &planet.PlanetData, planet.PlanetData.atmosphereToggle);
 
 					break;
 				}
@@ -1197,7 +1259,9 @@ namespace Toast {
 				if (mSelectedEntity == entity)
 					Renderer::SubmitSelecetedMesh(planet.RenderMesh, transform.GetTransform());
 
-				mStats.VerticesCount += static_cast<uint32_t>(planet.RenderMesh->GetVertices().size());
+				mStats.VerticesCount += planet.MeshLayout.GetVertexCount();
+				mStats.PlanetTriangles += planet.TriangleCount;
+				mStats.PlanetTriangleBudget += planet.TriangleBudget;
 			}
 
 			Renderer::EndScene(true, mSettings.Shadows, mSettings.SSAO, mSettings.DynamicIBL, *editorCamera, cameraPosFloat, mSettings.SSAORadius, mSettings.SSAObias);
@@ -1510,6 +1574,14 @@ namespace Toast {
 			{
 				cameraComponent.Camera.SetViewportSize(width, height);
 			}
+
+			// The planet LOD targets an error in pixels so it has to follow the viewport
+			if (cameraComponent.Primary)
+			{
+				auto planetView = mRegistry.view<PlanetComponent>();
+				for (auto planetEntity : planetView)
+					PlanetSystem::GenerateDistanceLUT(planetView.get<PlanetComponent>(planetEntity), cameraComponent.Camera.GetPerspectiveVerticalFOV(), (float)height);
+			}
 		}
 	}
 
@@ -1882,9 +1954,9 @@ namespace Toast {
 
 		InvalidateFrustum();
 
-		PlanetSystem::GenerateDistanceLUT(component.DistanceLUT, component.PlanetData.radius, mainCamera->GetPerspectiveVerticalFOV(), mViewportWidth);
+		PlanetSystem::GenerateDistanceLUT(component, mainCamera->GetPerspectiveVerticalFOV(), (float)mViewportHeight);
 		PlanetSystem::GenerateHeightMultLUT(component.HeightMultLUT, component.PlanetData.radius, component.PlanetData.maxAltitude);
-		PlanetSystem::GenerateFaceDotLevelLUT(component.FaceLevelDotLUT, tc.Scale.x, component.PlanetData.maxAltitude);
+		PlanetSystem::GenerateFaceDotLevelLUT(component, tc.Scale.x, component.PlanetData.maxAltitude);
 
 		DirectX::XMMATRIX noScaleModelMatrix = DirectX::XMMatrixIdentity() * (DirectX::XMMatrixRotationQuaternion(DirectX::XMQuaternionRotationRollPitchYaw(DirectX::XMConvertToRadians(tc.RotationEulerAngles.x), DirectX::XMConvertToRadians(tc.RotationEulerAngles.y), DirectX::XMConvertToRadians(tc.RotationEulerAngles.z)))) * DirectX::XMMatrixRotationQuaternion(DirectX::XMLoadFloat4(&tc.RotationQuaternion))
 			* DirectX::XMMatrixTranslation(tc.Translation.x, tc.Translation.y, tc.Translation.z);
@@ -76,6 +76,10 @@ namespace Toast {
 			float FrameTime = 0.0f;
 			float FPS = 0.0f;
 			uint32_t VerticesCount = 0;
+
+			// Summed over all planets, planets without a triangle budget add 0 to it
+			uint32_t PlanetTriangles = 0;
+			uint32_t PlanetTriangleBudget = 0;
 		};
 
 		Scene();
@@ -114,6 +118,8 @@ namespace Toast {
 		int GetFPS() const { return (int)mStats.FPS; }
 		float GetFrameTime() const { return mStats.FrameTime; }
 		int GetVertices() const { return (int)mStats.VerticesCount; }
+		int GetPlanetTriangles() const { return (int)mStats.PlanetTriangles; }
+		int GetPlanetTriangleBudget() const { return (int)mStats.PlanetTriangleBudget; }
 
 		Entity FindEntityByName(std::string_view name);
 		Entity FindEntityByUUID(UUID uuid);
@@ -176,6 +182,10 @@ namespace Toast {
 		Ref<Frustum> mFrustum;
 		bool mInvalidatePlanet = false;
 
+		// Kept between frames for the mesh culling
+		BoundingSphereBatch mMeshSpheres;
+		std::vector<uint8_t> mMeshVisible;
+
 		Ref<ParticleSystem> mParticleSystem;
 
 		friend class Entity;
@@ -0,0 +1,243 @@
+#inputlayout
+vertex
+vertex
+vertex
+vertex
+
+#type vertex
+#pragma pack_matrix( row_major )
+
+cbuffer Camera : register(b0)
+{
+    matrix worldTranslationMatrix;
+    matrix viewMatrix;
+    matrix projectionMatrix;
+    matrix inverseViewMatrix;
+    matrix inverseProjectionMatrix;
+    float4 cameraPosition;
+    float far;
+    float near;
+    float viewportWidth;
+    float viewportHeight;
+};
+
+cbuffer Model : register(b1)
+{
+    matrix worldMatrix;
+    float clickable;
+    int entityID;
+    int noWorldTransform;
+    int isInstanced;
+};
+
+// Box the positions of one patch are quantized in, see PlanetVertexFrame
+struct PlanetVertexFrame
+{
+    float3 origin;
+    float padding0;
+    float3 step;
+    float padding1;
+};
+
+StructuredBuffer<PlanetVertexFrame> planetFrames : register(t0);
+
+// Compact planet vertex, see PlanetVertex
+struct VertexInputType
+{
+    uint2 position  : POSITION;
+    uint normal     : NORMAL;
+    uint texCoord   : TEXCOORD;
+    uint frame      : FRAME;
+};
+
+struct PixelInputType
+{
+    float4 pixelPosition    : SV_POSITION;
+    float3 viewPosition     : VIEWPOS;
+    float3 viewNormal       : NORMAL;
+    float2 texCoord         : TEXCOORD;
+    float3x3 TBN            : TBASIS;
+    int entityID            : TEXTUREID;
+};
+
+float3 DecodePosition(uint2 position, PlanetVertexFrame frame)
+{
+    // 21 bits per axis
+    uint3 q;
+    q.x = position.x & 0x1FFFFF;
+    q.y = (position.x >> 21) | ((position.y & 0x3FF) << 11);
+    q.z = (position.y >> 10) & 0x1FFFFF;
+
+    return frame.origin + float3(q) * frame.step;
+}
+
+float DecodeSnorm16(uint value)
+{
+    // Sign extended from 16 bits
+    return max((float)((int)(value << 16) >> 16) / 32767.0f, -1.0f);
+}
+
+float3 DecodeOctahedral(uint normal)
+{
+    float3 n = float3(DecodeSnorm16(normal & 0xFFFF), DecodeSnorm16(normal >> 16), 0.0f);
+    n.z = 1.0f - abs(n.x) - abs(n.y);
+
+    float fold = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -fold : fold;
+
+    return normalize(n);
+}
+
+PixelInputType main(VertexInputType input)
+{
+    PixelInputType output;
+
+    PlanetVertexFrame frame = planetFrames[input.frame];
+
+    // The planet vertices are in planet space, worldMatrix is the transform of the planet with the camera's world
+    // translation already added to it
+    float4 worldPosition = mul(float4(DecodePosition(input.position, frame), 1.0f), worldMatrix);
+    float3 worldNormal = mul(DecodeOctahedral(input.normal), (float3x3) worldMatrix);
+    float4 worldTangent = float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    float4 viewPosition = mul(worldPosition, viewMatrix);
+    output.pixelPosition = mul(viewPosition, projectionMatrix);
+    output.viewPosition = viewPosition.xyz;
+
+    float3 viewNormal = normalize(mul(worldNormal, (float3x3) viewMatrix));
+    float4 viewTangent = normalize(mul(worldTangent, viewMatrix));
+    
+    float3 viewBitangent = cross(viewNormal, viewTangent.xyz) * viewTangent.w;
+    
+    float3x3 TBN = float3x3(viewTangent.xyz, viewBitangent, viewNormal);
+    
+    output.TBN = TBN;
+    output.viewNormal = viewNormal;
+
+    output.texCoord = float2(input.texCoord & 0xFFFF, input.texCoord >> 16) / 65535.0f;
+
+    if (clickable > 0)
+        output.entityID = entityID;
+    else
+        output.entityID = -1;
+
+    return output;
+}
+
+#type pixel
+#pragma pack_matrix( row_major )
+
+struct PixelInputType
+{
+    float4 pixelPosition    : SV_POSITION;
+    float3 viewPosition     : VIEWPOS;
+    float3 viewNormal       : NORMAL;
+    float2 texCoord         : TEXCOORD;
+    float3x3 TBN            : TBASIS;
+    int entityID            : TEXTUREID;
+};
+
+struct PixelOutputType
+{
+    float4 position         : SV_Target0;
+    float4 normal           : SV_Target1;
+    float4 albedoMetallic   : SV_Target2;
+    float4 roughnessAO      : SV_Target3;
+    int entityID            : SV_Target4;
+};
+
+cbuffer Material : register(b2)
+{
+    float4 Albedo;
+    float Emission;
+    float Metalness;
+    float Roughness;
+    int AlbedoTexToggle;
+    int NormalTexToggle;
+    int MetalRoughTexToggle;
+};
+
+Texture2D AlbedoTexture : register(t3);
+Texture2D NormalTexture : register(t4);
+Texture2D MetalRoughTexture : register(t5);
+
+SamplerState defaultSampler : register(s0);
+
+SamplerState defaultSampler2
+{
+    Filter = MIN_MAG_MIP_LINEAR;
+    AddressU = Wrap;
+    AddressV = Wrap;
+    AddressW = Wrap;
+    MipLODBias = 0.0f;
+    MaxAnisotropy = 1;
+    ComparisonFunc = NEVER;
+    BorderColor = float4(0, 0, 0, 0);
+    MinLOD = 0.0f;
+    MaxLOD = FLT_MAX;
+};
+
+struct PBRParameters
+{
+    float3 Albedo;
+    float Metalness;
+    float Roughness;
+    float AO;
+};
+
+PixelOutputType main(PixelInputType input)
+{
+    PixelOutputType output;
+    PBRParameters params;
+	
+    // Sample input textures to get shading model params.
+    params.Albedo = AlbedoTexToggle > 0 ? AlbedoTexture.Sample(defaultSampler, input.texCoord).rgb : Albedo.rgb;
+    params.Metalness = MetalRoughTexToggle > 0 ? MetalRoughTexture.Sample(defaultSampler, input.texCoord).b : Metalness;
+    params.Roughness = MetalRoughTexToggle > 0 ? MetalRoughTexture.Sample(defaultSampler, input.texCoord).r : Roughness;
+    params.Roughness = max(params.Roughness, 0.05f); // Minimum roughness of 0.05 to keep specular highlight
+    
+    // Position
+    output.position = float4(input.viewPosition, 1.0f);
+	
+    // Entity ID
+    if (input.entityID > -1)
+        output.entityID = input.entityID + 1;
+    
+    // Handle Normal Mapping
+    float3 N;
+    
+    if (NormalTexToggle > 0)
+    {
+        // Sample the normal map
+        float3 sampledNormal = NormalTexture.Sample(defaultSampler, input.texCoord).rgb;
+        
+        // Decode the normal from [0,1] to [-1,1]
+        sampledNormal = sampledNormal * 2.0f - 1.0f;
+        sampledNormal = normalize(sampledNormal);
+        
+        // Transform the sampled normal to view space
+        N = normalize(mul(sampledNormal, input.TBN));
+    }
+    else
+    {
+        // Use the default view normal
+        N = normalize(input.viewNormal);
+    }
+    
+    // Encode Normal  
+    float3 encodedNormal = N * 0.5 + 0.5;
+
+    if (input.entityID > -1)
+       output.normal = float4(encodedNormal, 0.0);
+    else
+        output.normal = float4(encodedNormal, (float)input.entityID);
+    
+    // Albedo & Metallic
+    output.albedoMetallic.rgb = params.Albedo;
+    output.albedoMetallic.a = params.Metalness;
+    
+    // RoughnessAO
+    output.roughnessAO = float4(params.Roughness, 0.0f, 0.0f, 1.0f);
+    
+    return output;
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#inputlayout
+vertex
+vertex
+vertex
+vertex
+
+#type vertex
+#pragma pack_matrix( row_major )
+
+cbuffer Model : register(b1)
+{
+    matrix worldMatrix;
+};
+
+cbuffer DirectionalLight : register(b3)
+{
+    matrix lightViewProj;
+    float4 direction;
+    float4 radiance;
+    float multiplier;
+};
+
+// Box the positions of one patch are quantized in, see PlanetVertexFrame
+struct PlanetVertexFrame
+{
+    float3 origin;
+    float padding0;
+    float3 step;
+    float padding1;
+};
+
+StructuredBuffer<PlanetVertexFrame> planetFrames : register(t0);
+
+// Compact planet vertex, see PlanetVertex. Only the position is used but the layout has to match the vertex buffer
+struct VertexInputType
+{
+    uint2 position  : POSITION;
+    uint normal     : NORMAL;
+    uint texCoord   : TEXCOORD;
+    uint frame      : FRAME;
+};
+
+struct PixelInputType
+{
+    float4 position : SV_POSITION;
+};
+
+float3 DecodePosition(uint2 position, PlanetVertexFrame frame)
+{
+    // 21 bits per axis
+    uint3 q;
+    q.x = position.x & 0x1FFFFF;
+    q.y = (position.x >> 21) | ((position.y & 0x3FF) << 11);
+    q.z = (position.y >> 10) & 0x1FFFFF;
+
+    return frame.origin + float3(q) * frame.step;
+}
+
+PixelInputType main(VertexInputType input)
+{
+    PixelInputType output;
+
+    // The planet vertices are in planet space, worldMatrix is the transform of the planet
+    float4 worldPosition = mul(float4(DecodePosition(input.position, planetFrames[input.frame]), 1.0f), worldMatrix);
+
+    output.position = mul(worldPosition, lightViewProj);
+    return output;
+}
+
+#type pixel
+struct PixelInputType
+{
+    float4 position                 : SV_POSITION;
+};
+
+float4 main(PixelInputType input) : SV_TARGET
+{
+    // Depth is automatically written to the depth buffer
+    return float4(0.0f, 0.0f, 0.0f, 0.0f);
+}
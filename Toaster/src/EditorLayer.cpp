@@ -59,7 +59,9 @@ namespace Toast {
 		// Load all shaders
 		// Deffered Rendering
 		ShaderLibrary::Load("assets/shaders/Rendering/GeometryPass.hlsl");
+		ShaderLibrary::Load("assets/shaders/Rendering/PlanetGeometryPass.hlsl");
 		ShaderLibrary::Load("assets/shaders/Rendering/ShadowPass.hlsl");
+		ShaderLibrary::Load("assets/shaders/Rendering/PlanetShadowPass.hlsl");
 		ShaderLibrary::Load("assets/shaders/Rendering/SSAOPass.hlsl");
 		ShaderLibrary::Load("assets/shaders/Rendering/SSAOBlurPass.hlsl");
 		ShaderLibrary::Load("assets/shaders/Rendering/LightningPass.hlsl");
@@ -435,6 +437,7 @@ namespace Toast {
 			ImGui::Text("FPS: %d", mEditorScene->GetFPS());
 			ImGui::Text("Frame time: %fms", mEditorScene->GetFrameTime());
 			ImGui::Text("Vertex count: %d", mEditorScene->GetVertices());
+			ImGui::Text("Planet triangles: %d / %d", mEditorScene->GetPlanetTriangles(), mEditorScene->GetPlanetTriangleBudget());
 
 			ImGui::End();
 
@@ -766,10 +766,25 @@ namespace Toast {
 				if (DrawFloatControl("Gravitational acceleration(m/s^2)", component.PlanetData.gravAcc, window, activeDragArea, 90.0f, 0.0f, 0.0f, 0.1f, "%.2f"))
 					modified = true;
 
+				if (DrawFloatControl("LOD Pixel Error", component.LODPixelError, window, activeDragArea, 90.0f, 0.1f, 64.0f, 0.1f, "%.1f"))
+					modified = true;
+
+				// Only changes what the next builds prefetch, the current planet stays valid
+				DrawFloatControl("Prefetch Time(s)", component.PrefetchTime, window, activeDragArea, 90.0f, 0.0f, 10.0f, 0.05f, "%.2f");
+
 				ImGui::BeginTable("PlanetComponentTable2", 2, flags);
 				ImGui::TableSetupColumn("##col1", ImGuiTableColumnFlags_WidthFixed, 90.0f);
 				ImGui::TableSetupColumn("##col2", ImGuiTableColumnFlags_WidthFixed, contentRegionAvailable.x * 0.7f);
 
+				ImGui::TableNextRow();
+				ImGui::TableSetColumnIndex(0);
+				ImGui::Text("Triangle Budget");
+				ImGui::TableSetColumnIndex(1);
+				ImGui::PushItemWidth(-1);
+				int triangleBudget = (int)component.TriangleBudget;
+				if (ImGui::DragInt("##TriangleBudget", &triangleBudget, 1000.0f, 0, INT_MAX))
+					component.TriangleBudget = (uint32_t)triangleBudget;
+
 				ImGui::TableNextRow();
 				ImGui::TableSetColumnIndex(0);
 				ImGui::Text("Smooth Shading)");
@@ -777,6 +792,13 @@ namespace Toast {
 				ImGui::PushItemWidth(-1);
 				ImGui::Checkbox("##smoothShading", &component.PlanetData.smoothShading);
 
+				ImGui::TableNextRow();
+				ImGui::TableSetColumnIndex(0);
+				ImGui::Text("Height Map\nNormals");
+				ImGui::TableSetColumnIndex(1);
+				ImGui::PushItemWidth(-1);
+				ImGui::Checkbox("##analyticNormals", &component.AnalyticNormals);
+
 				ImGui::TableNextRow();
 				ImGui::TableSetColumnIndex(0);
 				ImGui::Text("Atmosphere)");
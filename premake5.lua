@@ -33,6 +33,7 @@ group ""
 
 group "Tools"
 	include "Toaster"
+	include "Toast-Bench"
 group ""
 
 group "Misc"